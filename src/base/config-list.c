@@ -22,6 +22,7 @@
 #include <stdint.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <drm_fourcc.h>
 
 #include "platform-utils.h"
@@ -84,6 +85,12 @@ const EplFormatInfo FORMAT_INFO_LIST[] =
     { DRM_FORMAT_RGBA1010102, 32, { 10, 10, 10, 2 }, { 22, 12,  2, 0 } },
     { DRM_FORMAT_BGRA1010102, 32, { 10, 10, 10, 2 }, {  2, 12, 22, 0 } },
 
+    /* 64 bpp half-float RGB */
+    { DRM_FORMAT_ABGR16161616F, 64, { 16, 16, 16, 16 }, {  0, 16, 32, 48 }, EGL_TRUE },
+    { DRM_FORMAT_XBGR16161616F, 64, { 16, 16, 16, 0 },  {  0, 16, 32, 0 },  EGL_TRUE },
+    { DRM_FORMAT_ARGB16161616F, 64, { 16, 16, 16, 16 }, { 32, 16,  0, 48 }, EGL_TRUE },
+    { DRM_FORMAT_XRGB16161616F, 64, { 16, 16, 16, 0 },  { 32, 16,  0, 0 },  EGL_TRUE },
+
     { DRM_FORMAT_INVALID }
 };
 const int FORMAT_INFO_COUNT = (sizeof(FORMAT_INFO_LIST) / sizeof(FORMAT_INFO_LIST[0])) - 1;
@@ -108,10 +115,13 @@ static int CompareConfig(const void *p1, const void *p2)
     }
 }
 
-static void LookupConfigInfo(EplPlatformData *platform, EGLDisplay edpy, EGLConfig config, EplConfig *info)
+static void LookupConfigInfo(EplPlatformData *platform, EGLDisplay edpy, EGLConfig config,
+        EGLBoolean supports_float, EplConfig *info)
 {
     EGLint color[4] = { 0, 0, 0, 0 };
     EGLint surfaceMask = 0;
+    EGLint componentType = EGL_COLOR_COMPONENT_TYPE_FIXED_EXT;
+    EGLBoolean isFloat;
     EGLint i;
 
     memset(info, 0, sizeof(*info));
@@ -130,11 +140,21 @@ static void LookupConfigInfo(EplPlatformData *platform, EGLDisplay edpy, EGLConf
 
     info->surfaceMask = surfaceMask;
 
-    // For now, just find a format with the right color sizes.
+    // Without EGL_EXT_pixel_format_float, everything is fixed-point.
+    if (supports_float && !platform->egl.GetConfigAttrib(edpy, config,
+                EGL_COLOR_COMPONENT_TYPE_EXT, &componentType))
+    {
+        componentType = EGL_COLOR_COMPONENT_TYPE_FIXED_EXT;
+    }
+    isFloat = (componentType == EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT);
+
+    // For now, just find a format with the right color sizes. The platform
+    // library can replace this with something more specific.
     info->fourcc = DRM_FORMAT_INVALID;
     for (i=0; i<FORMAT_INFO_COUNT; i++)
     {
-        if (FORMAT_INFO_LIST[i].colors[0] == color[0]
+        if (FORMAT_INFO_LIST[i].is_float == isFloat
+                && FORMAT_INFO_LIST[i].colors[0] == color[0]
                 && FORMAT_INFO_LIST[i].colors[1] == color[1]
                 && FORMAT_INFO_LIST[i].colors[2] == color[2]
                 && FORMAT_INFO_LIST[i].colors[3] == color[3])
@@ -150,6 +170,7 @@ EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
     EplConfigList *list = NULL;
     EGLConfig *driverConfigs = NULL;
     EGLint numConfigs = 0;
+    EGLBoolean supportsFloat;
     EGLint i;
 
     if (!platform->egl.GetConfigs(edpy, NULL, 0, &numConfigs) || numConfigs <= 0)
@@ -178,11 +199,14 @@ EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
         return NULL;
     }
 
+    supportsFloat = eplFindExtension("EGL_EXT_pixel_format_float",
+            platform->egl.QueryString(edpy, EGL_EXTENSIONS));
+
     list->configs = (EplConfig *) (list + 1);
     list->num_configs = numConfigs;
     for (i=0; i<numConfigs; i++)
     {
-        LookupConfigInfo(platform, edpy, driverConfigs[i], &list->configs[i]);
+        LookupConfigInfo(platform, edpy, driverConfigs[i], supportsFloat, &list->configs[i]);
     }
     free(driverConfigs);
 
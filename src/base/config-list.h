@@ -45,6 +45,11 @@ typedef struct
     int bpp;
     int colors[4];
     int offset[4];
+
+    /**
+     * True if this is a floating-point format.
+     */
+    EGLBoolean is_float;
 } EplFormatInfo;
 
 /**
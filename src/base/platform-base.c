@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <time.h>
 
 #include "platform-utils.h"
 #include "platform-impl.h"
@@ -43,6 +44,8 @@ static void TerminateDisplay(EplDisplay *pdpy);
 static void CheckTerminateDisplay(EplDisplay *pdpy);
 static void DestroyDisplay(EplDisplay *pdpy);
 
+static void StopLingerThread(EplPlatformData *platform);
+
 /**
  * A list of all EplDisplay structs.
  */
@@ -57,9 +60,24 @@ static pthread_mutex_t display_list_mutex;
 static struct glvnd_list platform_data_list = { &platform_data_list, &platform_data_list };
 static pthread_mutex_t platform_data_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * Set from an atexit handler once the process starts exiting.
+ *
+ * Since this library is loaded after the driver, the atexit handler runs
+ * before the driver's own destructor, which is what calls
+ * eplUnloadExternalPlatformExport.
+ */
+static volatile EGLBoolean process_exiting = EGL_FALSE;
+
+static void OnProcessExit(void)
+{
+    process_exiting = EGL_TRUE;
+}
+
 static __attribute__((constructor)) void LibraryInit(void)
 {
     eplInitRecursiveMutex(&display_list_mutex);
+    atexit(OnProcessExit);
 }
 
 static __attribute__((destructor)) void LibraryFini(void)
@@ -68,7 +86,13 @@ static __attribute__((destructor)) void LibraryFini(void)
 }
 
 EPL_REFCOUNT_DEFINE_TYPE_FUNCS(EplPlatformData, eplPlatformData, refcount, free);
-EPL_REFCOUNT_DEFINE_TYPE_FUNCS(EplInternalDisplay, eplInternalDisplay, refcount, free);
+static void FreeInternalDisplay(EplInternalDisplay *idpy)
+{
+    pthread_mutex_destroy(&idpy->init_mutex);
+    free(idpy);
+}
+
+EPL_REFCOUNT_DEFINE_TYPE_FUNCS(EplInternalDisplay, eplInternalDisplay, refcount, FreeInternalDisplay);
 
 EplPlatformData *eplPlatformBaseAllocate(int major, int minor,
         const EGLExtDriver *driver, EGLExtPlatform *extplatform,
@@ -114,6 +138,15 @@ EplPlatformData *eplPlatformBaseAllocate(int major, int minor,
     glvnd_list_init(&platform->entry);
     glvnd_list_init(&platform->internal_display_list);
 
+    pthread_mutex_init(&platform->linger.mutex, NULL);
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&platform->linger.cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+
     platform->callbacks.getProcAddress = driver->getProcAddress;
     platform->callbacks.setError = driver->setError;
     platform->callbacks.debugMessage = driver->debugMessage;
@@ -223,6 +256,12 @@ static EGLBoolean eplUnloadExternalPlatformExport(void *platformData)
     pthread_mutex_unlock(&platform_data_list_mutex);
 
     platform->destroyed = EGL_TRUE;
+    platform->exiting = process_exiting;
+
+    // Stop the linger thread before anything else, so that it doesn't try
+    // to terminate anything. The driver terminates any lingering displays
+    // itself.
+    StopLingerThread(platform);
 
     pthread_mutex_lock(&display_list_mutex);
     glvnd_list_for_each_entry_safe(pdpy, pdpyTmp, &display_list, entry)
@@ -433,6 +472,7 @@ EplInternalDisplay *eplLookupInternalDisplay(EplPlatformData *platform, EGLDispl
             eplRefCountInit(&found->refcount);
             found->edpy = handle;
             found->init_count = 0;
+            pthread_mutex_init(&found->init_mutex, NULL);
             glvnd_list_add(&found->entry, &platform->internal_display_list);
         }
     }
@@ -461,6 +501,164 @@ EplInternalDisplay *eplGetDeviceInternalDisplay(EplPlatformData *platform, EGLDe
     return eplLookupInternalDisplay(platform, handle);
 }
 
+/**
+ * Terminates any lingering internal displays whose deadline has passed.
+ *
+ * \return The earliest deadline of any display that's still lingering, or
+ *      zero if there aren't any.
+ */
+static uint64_t TerminateExpiredDisplays(EplPlatformData *platform)
+{
+    while (EGL_TRUE)
+    {
+        EplInternalDisplay *node = NULL;
+        EplInternalDisplay *expired = NULL;
+        uint64_t now = eplGetMonotonicTime();
+        uint64_t next = 0;
+
+        // Find one expired display. We don't want to hold the list mutex
+        // while we call into the driver, so terminate it after unlocking the
+        // list, and then start over.
+        pthread_mutex_lock(&platform->internal_display_list_mutex);
+        glvnd_list_for_each_entry(node, &platform->internal_display_list, entry)
+        {
+            pthread_mutex_lock(&node->init_mutex);
+            if (node->lingering)
+            {
+                if (node->linger_deadline <= now)
+                {
+                    expired = eplInternalDisplayRef(node);
+                }
+                else if (next == 0 || node->linger_deadline < next)
+                {
+                    next = node->linger_deadline;
+                }
+            }
+            pthread_mutex_unlock(&node->init_mutex);
+
+            if (expired != NULL)
+            {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&platform->internal_display_list_mutex);
+
+        if (expired == NULL)
+        {
+            return next;
+        }
+
+        // Check again, in case another thread initialized the display while
+        // we didn't have it locked.
+        pthread_mutex_lock(&expired->init_mutex);
+        if (expired->lingering && expired->linger_deadline <= eplGetMonotonicTime())
+        {
+            assert(expired->init_count == 0);
+            platform->egl.Terminate(expired->edpy);
+            expired->lingering = EGL_FALSE;
+        }
+        pthread_mutex_unlock(&expired->init_mutex);
+        eplInternalDisplayUnref(expired);
+    }
+}
+
+static void *LingerThread(void *param)
+{
+    EplPlatformData *platform = param;
+
+    pthread_mutex_lock(&platform->linger.mutex);
+    while (!platform->linger.quit)
+    {
+        uint64_t next;
+
+        platform->linger.kick = EGL_FALSE;
+        pthread_mutex_unlock(&platform->linger.mutex);
+
+        next = TerminateExpiredDisplays(platform);
+
+        pthread_mutex_lock(&platform->linger.mutex);
+        if (platform->linger.quit || platform->linger.kick)
+        {
+            continue;
+        }
+
+        if (next != 0)
+        {
+            struct timespec ts;
+            ts.tv_sec = next / 1000000000ULL;
+            ts.tv_nsec = next % 1000000000ULL;
+            pthread_cond_timedwait(&platform->linger.cond, &platform->linger.mutex, &ts);
+        }
+        else
+        {
+            pthread_cond_wait(&platform->linger.cond, &platform->linger.mutex);
+        }
+    }
+    pthread_mutex_unlock(&platform->linger.mutex);
+
+    return NULL;
+}
+
+/**
+ * Starts the linger period for an internal display, instead of terminating
+ * it right away.
+ *
+ * The caller must hold EplInternalDisplay::init_mutex.
+ *
+ * \return EGL_TRUE if the display is now lingering, or EGL_FALSE if the
+ *      caller should terminate it immediately.
+ */
+static EGLBoolean StartLinger(EplPlatformData *platform, EplInternalDisplay *idpy)
+{
+    EGLBoolean ret = EGL_FALSE;
+
+    if (platform->internal_display_linger == 0 || platform->destroyed)
+    {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&platform->linger.mutex);
+    if (!platform->linger.quit)
+    {
+        if (!platform->linger.thread_started)
+        {
+            if (pthread_create(&platform->linger.thread, NULL, LingerThread, platform) == 0)
+            {
+                platform->linger.thread_started = EGL_TRUE;
+            }
+        }
+
+        if (platform->linger.thread_started)
+        {
+            idpy->lingering = EGL_TRUE;
+            idpy->linger_deadline = eplGetMonotonicTime() + platform->internal_display_linger;
+            platform->linger.kick = EGL_TRUE;
+            pthread_cond_signal(&platform->linger.cond);
+            ret = EGL_TRUE;
+        }
+    }
+    pthread_mutex_unlock(&platform->linger.mutex);
+
+    return ret;
+}
+
+static void StopLingerThread(EplPlatformData *platform)
+{
+    EGLBoolean started;
+
+    pthread_mutex_lock(&platform->linger.mutex);
+    platform->linger.quit = EGL_TRUE;
+    started = platform->linger.thread_started;
+    pthread_cond_signal(&platform->linger.cond);
+    pthread_mutex_unlock(&platform->linger.mutex);
+
+    if (started)
+    {
+        pthread_join(platform->linger.thread, NULL);
+        platform->linger.thread_started = EGL_FALSE;
+    }
+}
+
 EGLBoolean eplInitializeInternalDisplay(EplPlatformData *platform,
         EplInternalDisplay *idpy, EGLint *major, EGLint *minor)
 {
@@ -469,12 +667,19 @@ EGLBoolean eplInitializeInternalDisplay(EplPlatformData *platform,
         return EGL_FALSE;
     }
 
-    pthread_mutex_lock(&platform->internal_display_list_mutex);
-    if (idpy->init_count == 0)
+    // Note that this only locks the one display, so that other threads can
+    // initialize displays on other devices at the same time.
+    pthread_mutex_lock(&idpy->init_mutex);
+    if (idpy->init_count == 0 && idpy->lingering)
+    {
+        // The driver's display is still initialized, so just reuse it.
+        idpy->lingering = EGL_FALSE;
+    }
+    else if (idpy->init_count == 0)
     {
         if (!platform->egl.Initialize(idpy->edpy, &idpy->major, &idpy->minor))
         {
-            pthread_mutex_unlock(&platform->internal_display_list_mutex);
+            pthread_mutex_unlock(&idpy->init_mutex);
             return EGL_FALSE;
         }
     }
@@ -489,7 +694,7 @@ EGLBoolean eplInitializeInternalDisplay(EplPlatformData *platform,
         *minor = idpy->minor;
     }
 
-    pthread_mutex_unlock(&platform->internal_display_list_mutex);
+    pthread_mutex_unlock(&idpy->init_mutex);
     return EGL_TRUE;
 }
 
@@ -500,20 +705,25 @@ EGLBoolean eplTerminateInternalDisplay(EplPlatformData *platform, EplInternalDis
         return EGL_FALSE;
     }
 
-    pthread_mutex_lock(&platform->internal_display_list_mutex);
+    pthread_mutex_lock(&idpy->init_mutex);
     if (idpy->init_count > 0)
     {
-        if (idpy->init_count == 1)
+        if (idpy->init_count == 1 && StartLinger(platform, idpy))
+        {
+            // The linger thread will terminate the display later, unless
+            // something initializes it again first.
+        }
+        else if (idpy->init_count == 1)
         {
             if (!platform->egl.Terminate(idpy->edpy))
             {
-                pthread_mutex_unlock(&platform->internal_display_list_mutex);
+                pthread_mutex_unlock(&idpy->init_mutex);
                 return EGL_FALSE;
             }
         }
         idpy->init_count--;
     }
-    pthread_mutex_unlock(&platform->internal_display_list_mutex);
+    pthread_mutex_unlock(&idpy->init_mutex);
 
     return EGL_TRUE;
 }
@@ -561,13 +771,52 @@ void eplSurfaceRelease(EplDisplay *pdpy, EplSurface *psurf)
     }
 }
 
+/**
+ * Looks for an existing EplDisplay that matches the parameters of an
+ * eglGetPlatformDisplay call.
+ *
+ * The caller must hold \c display_list_mutex.
+ */
+static EplDisplay *FindMatchingDisplay(EplPlatformData *plat, EGLenum platform,
+        void *nativeDisplay, EGLBoolean track_references,
+        const EGLAttrib *remainingAttribs)
+{
+    EplDisplay *node;
+
+    glvnd_list_for_each_entry(node, &display_list, entry)
+    {
+        if (node->track_references != track_references)
+        {
+            continue;
+        }
+        if (node->native_display != nativeDisplay)
+        {
+            continue;
+        }
+
+        if (plat->impl->IsSameDisplay != NULL)
+        {
+            if (!plat->impl->IsSameDisplay(plat, node, platform, nativeDisplay, remainingAttribs))
+            {
+                continue;
+            }
+        }
+
+        // At this point, either IsSameDisplay returned true, or we don't have
+        // any additional attributes beyond what the platform base code handles.
+        return node;
+    }
+
+    return NULL;
+}
+
 static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
         EGLenum platform, void *nativeDisplay, const EGLAttrib* attribs)
 {
     EplPlatformData *plat = platformData;
     EGLAttrib *remainingAttribs = NULL;
     EplDisplay *pdpy = NULL;
-    EplDisplay *node;
+    EplDisplay *existing;
     EGLDisplay ret = EGL_NO_DISPLAY;
     int attribCount = 0;
     int attribIndex = 0;
@@ -615,51 +864,32 @@ static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
     remainingAttribs[attribIndex] = EGL_NONE;
 
     pthread_mutex_lock(&display_list_mutex);
-    glvnd_list_for_each_entry(node, &display_list, entry)
+    existing = FindMatchingDisplay(plat, platform, nativeDisplay,
+            track_references, remainingAttribs);
+    if (existing != NULL)
     {
-        if (node->track_references != track_references)
-        {
-            continue;
-        }
-        if (node->native_display != nativeDisplay)
-        {
-            continue;
-        }
-
-        if (plat->impl->IsSameDisplay != NULL)
-        {
-            if (!plat->impl->IsSameDisplay(plat, node, platform, nativeDisplay, remainingAttribs))
-            {
-                continue;
-            }
-        }
-
-        // At this point, either IsSameDisplay returned true, or we don't have
-        // any additional attributes beyond what the platform base code handles.
-
-        pdpy = node;
-        break;
+        // We found a matching display, so return it
+        ret = existing->external_display;
     }
+    pthread_mutex_unlock(&display_list_mutex);
 
-    if (pdpy != NULL)
+    if (existing != NULL)
     {
-        // We found a matching display, so return it
-        ret = pdpy->external_display;
-        goto done;
+        return ret;
     }
 
     pdpy = calloc(1, sizeof(EplDisplay));
     if (pdpy == NULL)
     {
         eplSetError(plat, EGL_BAD_ALLOC, "Out of memory");
-        goto done;
+        return EGL_NO_DISPLAY;
     }
 
     if (!eplInitRecursiveMutex(&pdpy->mutex))
     {
         eplSetError(plat, EGL_BAD_ALLOC, "Failed to create internal mutex");
         free(pdpy);
-        goto done;
+        return EGL_NO_DISPLAY;
     }
 
     pdpy->platform = eplPlatformDataRef(plat);
@@ -670,21 +900,48 @@ static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
     glvnd_list_init(&pdpy->surface_list);
     glvnd_list_init(&pdpy->entry);
 
-    if (!plat->impl->GetPlatformDisplay(plat, pdpy, nativeDisplay, remainingAttribs, &display_list))
+    /*
+     * Note that we don't hold display_list_mutex here. Depending on the
+     * platform, GetPlatformDisplay might have to connect to and probe a
+     * server, which can take a while, and we don't want to block every other
+     * thread's eplDisplayAcquire calls in the meantime.
+     */
+    if (!plat->impl->GetPlatformDisplay(plat, pdpy, nativeDisplay, remainingAttribs))
     {
         pthread_mutex_destroy(&pdpy->mutex);
         eplPlatformDataUnref(pdpy->platform);
         free(pdpy);
-        ret = EGL_NO_DISPLAY;
-        goto done;
+        return EGL_NO_DISPLAY;
     }
 
-    eplRefCountInit(&pdpy->refcount);
-    glvnd_list_add(&pdpy->entry, &display_list);
-    ret = pdpy->external_display;
+    pthread_mutex_lock(&display_list_mutex);
+
+    // Another thread might have created a matching display while we weren't
+    // holding the lock, so check again before we add the new one.
+    existing = FindMatchingDisplay(plat, platform, nativeDisplay,
+            track_references, remainingAttribs);
+    if (existing != NULL)
+    {
+        ret = existing->external_display;
+    }
+    else
+    {
+        eplRefCountInit(&pdpy->refcount);
+        glvnd_list_add(&pdpy->entry, &display_list);
+        ret = pdpy->external_display;
+    }
 
-done:
     pthread_mutex_unlock(&display_list_mutex);
+
+    if (existing != NULL)
+    {
+        // We lost the race, so throw away the display that we just created.
+        plat->impl->CleanupDisplay(pdpy);
+        pthread_mutex_destroy(&pdpy->mutex);
+        eplPlatformDataUnref(pdpy->platform);
+        free(pdpy);
+    }
+
     return ret;
 }
 
@@ -30,6 +30,7 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #include <eglexternalplatform.h>
 
@@ -71,6 +72,36 @@ typedef struct
     EGLint major;
     EGLint minor;
 
+    /**
+     * Protects \c init_count, and serializes calls to the driver's
+     * eglInitialize and eglTerminate for this display.
+     *
+     * Those can take a long time, so each internal display has its own mutex
+     * rather than using EplPlatformData::internal_display_list_mutex. That
+     * way, initializing a display on one device doesn't block initializing
+     * a display on another one.
+     */
+    pthread_mutex_t init_mutex;
+
+    /**
+     * True if the last user has terminated this display, but we're keeping
+     * the driver's display initialized in case something initializes it
+     * again. See EplPlatformData::internal_display_linger.
+     *
+     * This is protected by \c init_mutex.
+     */
+    EGLBoolean lingering;
+
+    /**
+     * The CLOCK_MONOTONIC time in nanoseconds when a lingering display should
+     * be terminated.
+     */
+    uint64_t linger_deadline;
+
+    /**
+     * The entry in EplPlatformData::internal_display_list. This is protected
+     * by EplPlatformData::internal_display_list_mutex.
+     */
     struct glvnd_list entry;
 } EplInternalDisplay;
 
@@ -246,6 +277,20 @@ typedef struct _EplPlatformData
      */
     EGLBoolean destroyed;
 
+    /**
+     * True if the platform is being torn down because the process is exiting,
+     * rather than because the driver is being unloaded.
+     *
+     * In that case, the kernel and the X server will clean up every buffer,
+     * syncobj, and XID that we own as soon as the process is gone, so the
+     * implementation can skip freeing them one by one. Only anything that
+     * would outlive the process, such as a property on a window that some
+     * other client owns, still needs to be cleaned up.
+     *
+     * This is only ever set along with \c destroyed.
+     */
+    EGLBoolean exiting;
+
     /**
      * Private data for the implementation.
      */
@@ -254,6 +299,38 @@ typedef struct _EplPlatformData
     struct glvnd_list internal_display_list;
     pthread_mutex_t internal_display_list_mutex;
 
+    /**
+     * How long to keep an internal display initialized after the last call
+     * to eplTerminateInternalDisplay, in nanoseconds.
+     *
+     * If something initializes the display again before then, then it can
+     * reuse the driver's display instead of going through the driver's
+     * eglInitialize again. This helps with applications that repeatedly
+     * initialize and terminate an EGLDisplay.
+     *
+     * This is zero (disabled) by default. The implementation can set it
+     * before calling eplPlatformBaseInitFinish.
+     */
+    uint64_t internal_display_linger;
+
+    /**
+     * State for the thread that terminates lingering internal displays.
+     */
+    struct
+    {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        pthread_t thread;
+        EGLBoolean thread_started;
+
+        /**
+         * Set when a display starts lingering, so that the thread knows to
+         * recheck its deadline.
+         */
+        EGLBoolean kick;
+        EGLBoolean quit;
+    } linger;
+
     EGLenum platform_enum;
     const struct _EplImplFuncs *impl;
 
@@ -358,6 +435,9 @@ EGLBoolean eplInitializeInternalDisplay(EplPlatformData *platform,
 
 /**
  * Calls eglTerminate on an internal display.
+ *
+ * If EplPlatformData::internal_display_linger is set, then the driver's
+ * eglTerminate is deferred until the display has gone unused for that long.
  */
 EGLBoolean eplTerminateInternalDisplay(EplPlatformData *platform, EplInternalDisplay *idpy);
 
@@ -124,11 +124,15 @@ typedef struct _EplImplFuncs
      * \param attribs The remaining attributes. This array does not include
      *      the attributes that the base library handles.
      *
+     * This is called without holding the global display list lock, so it may
+     * safely block (for example, to connect to a server). If another thread
+     * creates a matching display in the meantime, then the base library will
+     * discard this one by calling \c CleanupDisplay.
+     *
      * \return EGL_TRUE on success, or EGL_FALSE on failure.
      */
     EGLBoolean (* GetPlatformDisplay) (EplPlatformData *plat, EplDisplay *pdpy,
-            void *native_display, const EGLAttrib *attribs,
-            struct glvnd_list *existing_displays);
+            void *native_display, const EGLAttrib *attribs);
 
     /**
      * Cleans up any implementation data in an EplDisplay.
@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static int HookFuncCmp(const void *key, const void *elem)
 {
@@ -110,3 +111,11 @@ EGLint eplCountAttribs32(const EGLint *attribs)
     }
     return count;
 }
+
+uint64_t eplGetMonotonicTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
@@ -25,6 +25,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <EGL/egl.h>
 
@@ -66,6 +67,11 @@ EGLint eplCountAttribs(const EGLAttrib *attribs);
 
 EGLint eplCountAttribs32(const EGLint *attribs);
 
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t eplGetMonotonicTime(void);
+
 #ifdef __cplusplus
 }
 #endif
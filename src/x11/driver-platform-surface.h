@@ -32,6 +32,7 @@
 #define DRIVER_PLATFORM_SURFACE_H
 
 #include <EGL/egl.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -56,7 +57,7 @@ extern "C" {
 #define EGL_SURFACE_Y_INVERTED_NVX 0x31DB
 
 #define EGL_PLATFORM_SURFACE_INTERFACE_MAJOR_VERSION 0
-#define EGL_PLATFORM_SURFACE_INTERFACE_MINOR_VERSION 1
+#define EGL_PLATFORM_SURFACE_INTERFACE_MINOR_VERSION 2
 
 static inline EGLint EGL_PLATFORM_SURFACE_INTERFACE_GET_MAJOR_VERSION(EGLint version)
 {
@@ -364,6 +365,61 @@ typedef EGLBoolean (* pfn_eglPlatformSetColorBuffersNVX) (EGLDisplay dpy,
 typedef EGLBoolean (* pfn_eglPlatformGetConfigAttribNVX) (EGLDisplay dpy,
         EGLConfig config, EGLint attribute, EGLint *value);
 
+/**
+ * Signals a point on a DRM timeline syncobj when rendering finishes.
+ *
+ * The timeline point will be signaled once all of the commands that the
+ * current context has issued so far are finished. This implicitly flushes
+ * the current context.
+ *
+ * This is equivalent to creating an EGL_SYNC_NATIVE_FENCE_ANDROID sync,
+ * exporting it as a sync file, and then importing that sync file into the
+ * timeline point, but without the intermediate file descriptors.
+ *
+ * This function was added in version 0.2, and is optional. A platform library
+ * should fall back to using EGL_ANDROID_native_fence_sync if the driver
+ * doesn't provide it, or if it fails.
+ *
+ * This function may NOT be called from the update callback.
+ *
+ * \param dpy The internal EGLDisplay handle. The display must be current.
+ * \param drm_fd A file descriptor for the DRM device that \p syncobj belongs
+ *      to. The driver does not take ownership of this file descriptor.
+ * \param syncobj The DRM syncobj handle.
+ * \param point The timeline point to signal.
+ *
+ * \return EGL_TRUE on success, or EGL_FALSE on failure.
+ */
+typedef EGLBoolean (* pfn_eglPlatformSignalSyncobjNVX) (EGLDisplay dpy,
+        int drm_fd, uint32_t syncobj, uint64_t point);
+
+/**
+ * Makes the current context wait on the GPU for a point on a DRM timeline
+ * syncobj.
+ *
+ * Any commands that the current context issues after this call will not
+ * execute until the timeline point is signaled. The timeline point does not
+ * need to have a fence attached yet, as if with
+ * DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT.
+ *
+ * This is equivalent to exporting the timeline point as a sync file and then
+ * calling eglWaitSync with an EGL_SYNC_NATIVE_FENCE_ANDROID sync.
+ *
+ * This function was added in version 0.2, and is optional.
+ *
+ * This function may NOT be called from the update callback.
+ *
+ * \param dpy The internal EGLDisplay handle. The display must be current.
+ * \param drm_fd A file descriptor for the DRM device that \p syncobj belongs
+ *      to. The driver does not take ownership of this file descriptor.
+ * \param syncobj The DRM syncobj handle.
+ * \param point The timeline point to wait for.
+ *
+ * \return EGL_TRUE on success, or EGL_FALSE on failure.
+ */
+typedef EGLBoolean (* pfn_eglPlatformWaitSyncobjNVX) (EGLDisplay dpy,
+        int drm_fd, uint32_t syncobj, uint64_t point);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,7 @@
 #include <xcb/dri3.h>
 
 #include "x11-platform.h"
+#include "x11-roundtrip.h"
 #include "config-list.h"
 
 static int CompareFormatSupportInfo(const void *p1, const void *p2)
@@ -205,9 +206,19 @@ static xcb_visualid_t FindVisualForFormat(EplPlatformData *plat, xcb_connection_
 {
     xcb_depth_iterator_t depthIter;
     int depth = fmt->colors[0] + fmt->colors[1] + fmt->colors[2] + fmt->colors[3];
-    uint32_t red_mask   = ((1 << fmt->colors[0]) - 1) << fmt->offset[0];
-    uint32_t green_mask = ((1 << fmt->colors[1]) - 1) << fmt->offset[1];
-    uint32_t blue_mask  = ((1 << fmt->colors[2]) - 1) << fmt->offset[2];
+    uint32_t red_mask;
+    uint32_t green_mask;
+    uint32_t blue_mask;
+
+    // X11 visuals can only describe integer pixels of up to 32 bits.
+    if (fmt->is_float || fmt->bpp > 32)
+    {
+        return 0;
+    }
+
+    red_mask   = ((1U << fmt->colors[0]) - 1) << fmt->offset[0];
+    green_mask = ((1U << fmt->colors[1]) - 1) << fmt->offset[1];
+    blue_mask  = ((1U << fmt->colors[2]) - 1) << fmt->offset[2];
 
     for (depthIter = xcb_screen_allowed_depths_iterator(xscreen);
             depthIter.rem > 0;
@@ -267,9 +278,17 @@ static void SetupConfig(EplPlatformData *plat, X11DisplayInstance *inst, EplConf
     }
 
     // We should be able to support pixmaps with any supported format, as long
-    // as they have a supported modifier.
-    config->surfaceMask |= EGL_PIXMAP_BIT;
+    // as they have a supported modifier. Without DRI3, though, we don't have
+    // any way to share a pixmap with the server, and X11 pixmaps can't hold
+    // floating-point pixels.
+    if (!inst->software_present && !support->fmt->is_float)
+    {
+        config->surfaceMask |= EGL_PIXMAP_BIT;
+    }
 
+    // Note that the driver only reports one fourcc code for each config, so
+    // if the server uses a different channel order for the same depth, then
+    // the config doesn't get a visual.
     visual = FindVisualForFormat(inst->platform, inst->conn, inst->xscreen, support->fmt);
     if (visual != 0)
     {
@@ -304,7 +323,7 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
 {
     xcb_generic_error_t *error = NULL;
     xcb_get_geometry_cookie_t geomCookie = xcb_get_geometry(pdpy->priv->inst->conn, xpix);
-    xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(pdpy->priv->inst->conn, geomCookie, &error);
+    xcb_get_geometry_reply_t *geom = X11_ROUNDTRIP(xcb_get_geometry_reply(pdpy->priv->inst->conn, geomCookie, &error));
 
     xcb_dri3_buffers_from_pixmap_cookie_t buffersCookie;
     xcb_dri3_buffers_from_pixmap_reply_t *buffers = NULL;
@@ -370,7 +389,7 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
     // DRI3BuffersFromPixmap request.
 
     buffersCookie = xcb_dri3_buffers_from_pixmap(pdpy->priv->inst->conn, xpix);
-    buffers = xcb_dri3_buffers_from_pixmap_reply(pdpy->priv->inst->conn, buffersCookie, &error);
+    buffers = X11_ROUNDTRIP(xcb_dri3_buffers_from_pixmap_reply(pdpy->priv->inst->conn, buffersCookie, &error));
     if (buffers == NULL)
     {
         eplSetError(pdpy->platform, EGL_BAD_NATIVE_PIXMAP, "Can't look up dma-buf for pixmap 0x%x\n", xpix);
@@ -444,6 +463,7 @@ EGLBoolean eplX11HookChooseConfig(EGLDisplay edpy, EGLint const *attribs,
     EGLBoolean success = EGL_FALSE;
     EplConfig **found = NULL;
     EGLint count = 0;
+    X11_ROUNDTRIP_ENTRY("eglChooseConfig");
 
     pdpy = eplDisplayAcquire(edpy);
     if (pdpy == NULL)
@@ -25,6 +25,7 @@
  */
 
 #include "x11-platform.h"
+#include "x11-roundtrip.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -179,7 +180,7 @@ static EGLBoolean AllocLinearPixmap(X11DisplayInstance *inst, EplSurface *surf,
             0, 0, 0, 0, 0, 0, eplFormatInfoDepth(fmt->fmt), fmt->fmt->bpp,
             DRM_FORMAT_MOD_LINEAR, &fd);
 
-    error = xcb_request_check(inst->conn, cookie);
+    error = X11_ROUNDTRIP(xcb_request_check(inst->conn, cookie));
     if (error != NULL)
     {
         eplSetError(inst->platform, EGL_BAD_ALLOC, "DRI3PixmapFromBuffers request failed with error %d\n",
@@ -222,7 +223,7 @@ static EGLBoolean ImportPixmap(X11DisplayInstance *inst, EplSurface *surf,
     }
 
     cookie = xcb_dri3_buffers_from_pixmap(inst->conn, xpix);
-    reply = xcb_dri3_buffers_from_pixmap_reply(inst->conn, cookie, &error);
+    reply = X11_ROUNDTRIP(xcb_dri3_buffers_from_pixmap_reply(inst->conn, cookie, &error));
     if (reply == NULL)
     {
         free(error);
@@ -373,6 +374,14 @@ void eplX11DestroyPixmap(EplSurface *surf)
     surf->priv = NULL;
     if (ppix != NULL)
     {
+        if (ppix->inst != NULL && ppix->inst->platform->exiting)
+        {
+            // The driver and the server will clean up the buffers and the
+            // PRIME pixmap along with the rest of the process.
+            eplX11DisplayInstanceUnref(ppix->inst);
+            free(ppix);
+            return;
+        }
         if (ppix->inst != NULL)
         {
             if (surf->internal_surface != EGL_NO_SURFACE)
@@ -401,6 +410,46 @@ void eplX11DestroyPixmap(EplSurface *surf)
     }
 }
 
+EGLBoolean eplX11WaitNativePixmap(EplDisplay *pdpy, EplSurface *surf)
+{
+    X11Pixmap *ppix = (X11Pixmap *) surf->priv;
+    int fd;
+
+    if (!eplX11WaitForServerRequests(ppix->inst))
+    {
+        return EGL_FALSE;
+    }
+
+    if (ppix->prime_dmabuf < 0 || ppix->blit_target != NULL)
+    {
+        // With PRIME, we render into an internal buffer and then copy it to
+        // the pixmap, so the GL rendering never reads anything that the
+        // server draws.
+        return EGL_TRUE;
+    }
+
+    /*
+     * The server has submitted its rendering now, so the dma-buf has the
+     * server's fences attached to it. If we can get them, then let the GPU
+     * wait for them.
+     *
+     * If we can't, then the server's rendering was at least submitted before
+     * anything that we submit from here on, which is as much as the server
+     * itself would guarantee without implicit sync.
+     */
+    fd = eplX11ExportDmaBufSyncFile(ppix->inst, ppix->prime_dmabuf);
+    if (fd >= 0)
+    {
+        if (!eplX11WaitForSyncFDGPU(ppix->inst, fd))
+        {
+            eplX11WaitForFD(fd);
+        }
+        close(fd);
+    }
+
+    return EGL_TRUE;
+}
+
 static EGLBoolean CheckExistingPixmap(EplDisplay *pdpy, xcb_pixmap_t xpix)
 {
     EplSurface *psurf;
@@ -443,6 +492,7 @@ EGLSurface eplX11CreatePixmapSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         EGL_NONE
     };
     EGLAttrib *internalAttribs = NULL;
+    X11_ROUNDTRIP_ENTRY("eglCreatePixmapSurface");
 
     if (xpix == 0)
     {
@@ -475,7 +525,7 @@ EGLSurface eplX11CreatePixmapSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     }
 
     geomCookie = xcb_get_geometry(inst->conn, xpix);
-    geomReply = xcb_get_geometry_reply(inst->conn, geomCookie, &error);
+    geomReply = X11_ROUNDTRIP(xcb_get_geometry_reply(inst->conn, geomCookie, &error));
     if (geomReply == NULL)
     {
         eplSetError(plat, EGL_BAD_NATIVE_PIXMAP, "Invalid pixmap 0x%x", xpix);
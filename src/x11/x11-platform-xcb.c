@@ -32,6 +32,11 @@ xcb_connection_t *eplX11GetXCBConnection(void *native_display, int *ret_screen)
     return NULL;
 }
 
+const char *eplX11GetDisplayName(void *native_display)
+{
+    return NULL;
+}
+
 X11XlibDisplayClosedData *eplX11AddXlibDisplayClosedCallback(void *xlib_native_display)
 {
     return NULL;
@@ -79,6 +79,11 @@ xcb_connection_t *eplX11GetXCBConnection(void *native_display, int *ret_screen)
     return XGetXCBConnection(xdpy);
 }
 
+const char *eplX11GetDisplayName(void *native_display)
+{
+    return DisplayString((Display *) native_display);
+}
+
 static void RemoveDisplayClosedCallback(X11XlibDisplayClosedData *callback)
 {
     glvnd_list_del(&callback->entry);
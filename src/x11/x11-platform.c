@@ -22,6 +22,7 @@
  */
 
 #include "x11-platform.h"
+#include "x11-roundtrip.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -30,9 +31,14 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <poll.h>
 #include <assert.h>
 
+#if defined(__linux__)
+#include <linux/sync_file.h>
+#endif
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
@@ -44,17 +50,26 @@
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/sync.h>
 
 #include "platform-utils.h"
 #include "dma-buf.h"
+#include "x11-swpresent.h"
 
 static const char *FORCE_ENABLE_ENV = "__NV_FORCE_ENABLE_X11_EGL_PLATFORM";
+static const char *PRIVATE_PRESENT_CONNECTION_ENV = "__NV_X11_EGL_PRIVATE_PRESENT_CONNECTION";
+static const char *SOFTWARE_PRESENT_ENV = "__NV_X11_EGL_SOFTWARE_PRESENT";
+static const char *MAX_FPS_ENV = "__NV_X11_EGL_MAX_FPS";
+static const char *HIDDEN_FPS_ENV = "__NV_X11_EGL_HIDDEN_FPS";
+static const char *VRR_ENV = "__NV_X11_EGL_VRR";
+static const char *DISPLAY_LINGER_ENV = "__NV_X11_EGL_DISPLAY_LINGER_MS";
 
 #define CLIENT_EXTENSIONS_XLIB "EGL_KHR_platform_x11 EGL_EXT_platform_x11"
 #define CLIENT_EXTENSIONS_XCB "EGL_EXT_platform_xcb"
 
 static const EGLint NEED_PLATFORM_SURFACE_MAJOR = 0;
 static const EGLint NEED_PLATFORM_SURFACE_MINOR = 1;
+static const EGLint SYNCOBJ_PLATFORM_SURFACE_MINOR = 2;
 static const uint32_t NEED_DRI3_MAJOR = 1;
 static const uint32_t NEED_DRI3_MINOR = 2;
 static const uint32_t REQUEST_DRI3_MINOR = 4;
@@ -73,19 +88,21 @@ static void *eplX11GetHookFunction(EplPlatformData *plat, const char *name);
 static EGLBoolean eplX11IsSameDisplay(EplPlatformData *plat, EplDisplay *pdpy, EGLint platform,
         void *native_display, const EGLAttrib *attribs);
 static EGLBoolean eplX11GetPlatformDisplay(EplPlatformData *plat, EplDisplay *pdpy,
-        void *native_display, const EGLAttrib *attribs,
-        struct glvnd_list *existing_displays);
+        void *native_display, const EGLAttrib *attribs);
 static EGLBoolean eplX11InitializeDisplay(EplPlatformData *plat, EplDisplay *pdpy, EGLint *major, EGLint *minor);
 static void eplX11TerminateDisplay(EplPlatformData *plat, EplDisplay *pdpy);
 static void eplX11DestroySurface(EplDisplay *pdpy, EplSurface *surf);
 static void eplX11FreeSurface(EplDisplay *pdpy, EplSurface *surf);
 static EGLBoolean eplX11WaitGL(EplDisplay *pdpy, EplSurface *psurf);
+static EGLBoolean eplX11WaitNative(EplDisplay *pdpy, EplSurface *psurf);
 
 static const EplHookFunc X11_HOOK_FUNCTIONS[] =
 {
     { "eglChooseConfig", eplX11HookChooseConfig },
     { "eglGetConfigAttrib", eplX11HookGetConfigAttrib },
+    { "eglQuerySurfacePresentIdNVX", eplX11QuerySurfacePresentIdNVX },
     { "eglSwapInterval", eplX11SwapInterval },
+    { "eglWaitForPresentNVX", eplX11WaitForPresentNVX },
 };
 static const int NUM_X11_HOOK_FUNCTIONS = sizeof(X11_HOOK_FUNCTIONS) / sizeof(X11_HOOK_FUNCTIONS[0]);
 
@@ -105,6 +122,7 @@ static const EplImplFuncs X11_IMPL_FUNCS =
     .FreeSurface = eplX11FreeSurface,
     .SwapBuffers = eplX11SwapBuffers,
     .WaitGL = eplX11WaitGL,
+    .WaitNative = eplX11WaitNative,
 };
 
 /**
@@ -134,6 +152,7 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     EplPlatformData *plat = NULL;
     EGLBoolean timelineSupported = EGL_TRUE;
     pfn_eglPlatformGetVersionNVX ptr_eglPlatformGetVersionNVX;
+    EGLint driverVersion;
 
     // Before we do anything else, make sure that we've got a recent enough
     // version of libgbm.
@@ -151,8 +170,13 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     }
 
     ptr_eglPlatformGetVersionNVX = driver->getProcAddress("eglPlatformGetVersionNVX");
-    if (ptr_eglPlatformGetVersionNVX == NULL
-            || !EGL_PLATFORM_SURFACE_INTERFACE_CHECK_VERSION(ptr_eglPlatformGetVersionNVX(),
+    if (ptr_eglPlatformGetVersionNVX == NULL)
+    {
+        eplPlatformBaseInitFail(plat);
+        return EGL_FALSE;
+    }
+    driverVersion = ptr_eglPlatformGetVersionNVX();
+    if (!EGL_PLATFORM_SURFACE_INTERFACE_CHECK_VERSION(driverVersion,
                 NEED_PLATFORM_SURFACE_MAJOR, NEED_PLATFORM_SURFACE_MINOR))
     {
         // The driver doesn't support a compatible version of the platform
@@ -168,6 +192,7 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     plat->priv->egl.CreateSync = driver->getProcAddress("eglCreateSync");
     plat->priv->egl.DestroySync = driver->getProcAddress("eglDestroySync");
     plat->priv->egl.WaitSync = driver->getProcAddress("eglWaitSync");
+    plat->priv->egl.ClientWaitSync = driver->getProcAddress("eglClientWaitSync");
     plat->priv->egl.DupNativeFenceFDANDROID = driver->getProcAddress("eglDupNativeFenceFDANDROID");
     plat->priv->egl.Flush = driver->getProcAddress("glFlush");
     plat->priv->egl.Finish = driver->getProcAddress("glFinish");
@@ -180,6 +205,14 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     plat->priv->egl.PlatformAllocColorBufferNVX = driver->getProcAddress("eglPlatformAllocColorBufferNVX");
     plat->priv->egl.PlatformExportColorBufferNVX = driver->getProcAddress("eglPlatformExportColorBufferNVX");
 
+    // The syncobj functions were added in version 0.2, and are optional.
+    if (EGL_PLATFORM_SURFACE_INTERFACE_CHECK_VERSION(driverVersion,
+                NEED_PLATFORM_SURFACE_MAJOR, SYNCOBJ_PLATFORM_SURFACE_MINOR))
+    {
+        plat->priv->egl.PlatformSignalSyncobjNVX = driver->getProcAddress("eglPlatformSignalSyncobjNVX");
+        plat->priv->egl.PlatformWaitSyncobjNVX = driver->getProcAddress("eglPlatformWaitSyncobjNVX");
+    }
+
     if (plat->priv->egl.QueryDisplayAttribKHR == NULL
             || plat->priv->egl.SwapInterval == NULL
             || plat->priv->egl.QueryDmaBufFormatsEXT == NULL
@@ -223,16 +256,25 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     LOAD_PROC(timelineSupported, "drm", drm, SyncobjTransfer);
 
     plat->priv->timeline_funcs_supported = timelineSupported;
+    pthread_mutex_init(&plat->priv->device_cache.mutex, NULL);
 
 #undef LOAD_PROC
 
+    {
+        const char *env = getenv(DISPLAY_LINGER_ENV);
+        if (env != NULL && atoi(env) > 0)
+        {
+            plat->internal_display_linger = ((uint64_t) atoi(env)) * 1000000ULL;
+        }
+    }
+
     eplPlatformBaseInitFinish(plat);
     return EGL_TRUE;
 }
 
 static void eplX11CleanupPlatform(EplPlatformData *plat)
 {
-    // Nothing to do here yet.
+    pthread_mutex_destroy(&plat->priv->device_cache.mutex);
 }
 
 static const char *eplX11QueryString(EplPlatformData *plat, EplDisplay *pdpy, EGLExtPlatformString name)
@@ -256,7 +298,7 @@ static const char *eplX11QueryString(EplPlatformData *plat, EplDisplay *pdpy, EG
                 return "";
             }
         case EGL_EXT_PLATFORM_DISPLAY_EXTENSIONS:
-            return "";
+            return PRESENT_WAIT_EXTENSION_NAME;
         default:
             return NULL;
     }
@@ -434,20 +476,29 @@ static EGLDeviceEXT FindDeviceForNode(EplPlatformData *plat, const char *node)
 /**
  * Returns an EGLDeviceEXT that corresponds to a device node.
  *
- * This is used to translate the file descriptor from DRI3Open into an
- * EGLDeviceEXT.
+ * This does the actual lookup for FindDeviceForFD, without using the cache.
+ *
+ * \param resolve If false, then only check whether this is an NVIDIA device,
+ *      and don't look up the EGLDeviceEXT.
+ * \param[out] ret_is_nv Returns EGL_TRUE if this is an NVIDIA device.
+ * \param[out] ret_cacheable Returns EGL_TRUE if the result should be cached.
  */
-static EGLDeviceEXT FindDeviceForFD(EplPlatformData *plat, int fd)
+static EGLDeviceEXT LookupDeviceForFD(EplPlatformData *plat, int fd,
+        EGLBoolean resolve, EGLBoolean *ret_is_nv, EGLBoolean *ret_cacheable)
 {
     drmDevice *dev = NULL;
     int ret;
     EGLDeviceEXT found = EGL_NO_DEVICE_EXT;
 
+    *ret_is_nv = EGL_FALSE;
+    *ret_cacheable = EGL_FALSE;
+
     ret = drmGetDevice(fd, &dev);
     if (ret != 0)
     {
         return EGL_NO_DEVICE_EXT;
     }
+    *ret_cacheable = EGL_TRUE;
 
     if ((dev->available_nodes & (1 << DRM_NODE_PRIMARY)) != 0
             && dev->nodes[DRM_NODE_PRIMARY] != NULL)
@@ -486,7 +537,8 @@ static EGLDeviceEXT FindDeviceForFD(EplPlatformData *plat, int fd)
             }
         }
 
-        if (isNV)
+        *ret_is_nv = isNV;
+        if (isNV && resolve)
         {
             found = FindDeviceForNode(plat, dev->nodes[DRM_NODE_PRIMARY]);
         }
@@ -496,6 +548,93 @@ static EGLDeviceEXT FindDeviceForFD(EplPlatformData *plat, int fd)
     return found;
 }
 
+/**
+ * Returns an EGLDeviceEXT that corresponds to a device node.
+ *
+ * This is used to translate the file descriptor from DRI3Open into an
+ * EGLDeviceEXT. The result is cached by the device number, so that this only
+ * needs an fstat for any device that we've already seen.
+ *
+ * \param resolve If false, then only check whether this is an NVIDIA device.
+ *      That only needs libdrm, so unlike eglQueryDevicesEXT, it won't wake up
+ *      the GPU. The return value is only valid if the device is cached.
+ * \param[out] ret_is_nv If not NULL, returns EGL_TRUE if this is an NVIDIA
+ *      device.
+ */
+static EGLDeviceEXT FindDeviceForFD(EplPlatformData *plat, int fd,
+        EGLBoolean resolve, EGLBoolean *ret_is_nv)
+{
+    EGLDeviceEXT found = EGL_NO_DEVICE_EXT;
+    EGLBoolean isNV = EGL_FALSE;
+    EGLBoolean cacheable = EGL_FALSE;
+    struct stat st;
+    int i;
+
+    if (fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode))
+    {
+        found = LookupDeviceForFD(plat, fd, resolve, &isNV, &cacheable);
+        if (ret_is_nv != NULL)
+        {
+            *ret_is_nv = isNV;
+        }
+        return found;
+    }
+
+    pthread_mutex_lock(&plat->priv->device_cache.mutex);
+    for (i=0; i<plat->priv->device_cache.count; i++)
+    {
+        if (plat->priv->device_cache.entries[i].rdev == st.st_rdev
+                && (plat->priv->device_cache.entries[i].resolved || !resolve))
+        {
+            found = plat->priv->device_cache.entries[i].device;
+            if (ret_is_nv != NULL)
+            {
+                *ret_is_nv = plat->priv->device_cache.entries[i].is_nv;
+            }
+            pthread_mutex_unlock(&plat->priv->device_cache.mutex);
+            return found;
+        }
+    }
+    pthread_mutex_unlock(&plat->priv->device_cache.mutex);
+
+    // Don't hold the mutex while we look up the device, since that can be
+    // slow. If another thread looks up the same device in the meantime,
+    // then we'll both get the same result anyway.
+    found = LookupDeviceForFD(plat, fd, resolve, &isNV, &cacheable);
+
+    if (cacheable)
+    {
+        pthread_mutex_lock(&plat->priv->device_cache.mutex);
+        for (i=0; i<plat->priv->device_cache.count; i++)
+        {
+            if (plat->priv->device_cache.entries[i].rdev == st.st_rdev)
+            {
+                break;
+            }
+        }
+        if (i < X11_MAX_CACHED_DEVICES)
+        {
+            if (i == plat->priv->device_cache.count)
+            {
+                plat->priv->device_cache.count++;
+            }
+            plat->priv->device_cache.entries[i].rdev = st.st_rdev;
+            plat->priv->device_cache.entries[i].device = found;
+            plat->priv->device_cache.entries[i].is_nv = isNV;
+
+            // For a non-NVIDIA device, there's no EGLDeviceEXT to look up.
+            plat->priv->device_cache.entries[i].resolved = (resolve || !isNV);
+        }
+        pthread_mutex_unlock(&plat->priv->device_cache.mutex);
+    }
+
+    if (ret_is_nv != NULL)
+    {
+        *ret_is_nv = isNV;
+    }
+    return found;
+}
+
 /**
  * Finds the xcb_screen_t for a screen number.
  */
@@ -523,7 +662,7 @@ static int GetDRI3DeviceFD(xcb_connection_t *conn, xcb_screen_t *xscr)
 {
     xcb_generic_error_t *error = NULL;
     xcb_dri3_open_cookie_t cookie = xcb_dri3_open(conn, xscr->root, 0);
-    xcb_dri3_open_reply_t *reply = xcb_dri3_open_reply(conn, cookie, &error);
+    xcb_dri3_open_reply_t *reply = X11_ROUNDTRIP(xcb_dri3_open_reply(conn, cookie, &error));
     int fd;
 
     if (reply == NULL)
@@ -540,11 +679,11 @@ static int GetDRI3DeviceFD(xcb_connection_t *conn, xcb_screen_t *xscr)
 }
 
 static EGLBoolean eplX11GetPlatformDisplay(EplPlatformData *plat, EplDisplay *pdpy,
-        void *native_display, const EGLAttrib *attribs,
-        struct glvnd_list *existing_displays)
+        void *native_display, const EGLAttrib *attribs)
 {
     const char *env;
     X11DisplayInstance *inst;
+    X11_ROUNDTRIP_ENTRY("eglGetPlatformDisplay");
 
     env = getenv("DISPLAY");
     if (env == NULL && native_display == NULL)
@@ -644,6 +783,9 @@ static EGLBoolean eplX11GetPlatformDisplay(EplPlatformData *plat, EplDisplay *pd
      * Ideally, we'd wait until eglInitialize to open the connection or do the
      * rest of our compatibility checks, but we have to do that now to check
      * whether we can actually support whichever server we're connecting to.
+     *
+     * This only does the cheap checks, though. Anything that needs the
+     * driver, and so might wake up the GPU, waits until eglInitialize.
      */
     inst = eplX11DisplayInstanceCreate(pdpy, EGL_FALSE);
     if (inst == NULL)
@@ -676,6 +818,60 @@ static void eplX11CleanupDisplay(EplDisplay *pdpy)
     }
 }
 
+/**
+ * Checks whether a connection uses a domain socket.
+ */
+static EGLBoolean IsLocalConnection(xcb_connection_t *conn)
+{
+    struct sockaddr addr;
+    socklen_t addrlen = sizeof(addr);
+
+    if (getsockname(xcb_get_file_descriptor(conn), &addr, &addrlen) != 0)
+    {
+        return EGL_FALSE;
+    }
+    return (addr.sa_family == AF_UNIX);
+}
+
+/**
+ * Checks if the NV-GLX extension is present. If it is, then that means we're
+ * talking to a normal X server running with the NVIDIA driver, so we should
+ * fail here so that the driver can use its normal X11 path.
+ *
+ * Note that if/when this replaces our existing X11 path for EGL, then we could
+ * add some requests to NV-GLX to support older (pre DRI3 1.2) servers or
+ * non-Linux systems.
+ *
+ * \return EGL_TRUE if we should leave this server to the driver's X11 path.
+ */
+static EGLBoolean CheckNVGLX(X11DisplayInstance *inst)
+{
+    const char NVGLX_EXTENSION_NAME[] = "NV-GLX";
+    const char *env;
+    xcb_query_extension_cookie_t extCookie;
+    xcb_query_extension_reply_t *nvglxReply = NULL;
+    EGLBoolean present;
+
+    env = getenv(FORCE_ENABLE_ENV);
+    if (env != NULL && atoi(env) != 0)
+    {
+        return EGL_FALSE;
+    }
+
+    extCookie = xcb_query_extension(inst->conn,
+            sizeof(NVGLX_EXTENSION_NAME) - 1, NVGLX_EXTENSION_NAME);
+    nvglxReply = X11_ROUNDTRIP(xcb_query_extension_reply(inst->conn, extCookie, NULL));
+    if (nvglxReply == NULL)
+    {
+        // XQueryExtension isn't supposed to generate any errors.
+        return EGL_TRUE;
+    }
+
+    present = (nvglxReply->present != 0);
+    free(nvglxReply);
+    return present;
+}
+
 /**
  * Checks whether the server has the necessary support that we need.
  *
@@ -684,9 +880,6 @@ static void eplX11CleanupDisplay(EplDisplay *pdpy)
  */
 static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
 {
-    const char *env;
-    struct sockaddr addr;
-    socklen_t addrlen = sizeof(addr);
     const xcb_query_extension_reply_t *extReply;
     xcb_generic_error_t *error = NULL;
 
@@ -694,16 +887,11 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
     xcb_dri3_query_version_reply_t *dri3Reply = NULL;
     xcb_present_query_version_cookie_t presentCookie;
     xcb_present_query_version_reply_t *presentReply = NULL;
-    xcb_query_extension_reply_t *nvglxReply = NULL;
     EGLBoolean success = EGL_FALSE;
 
     // Check to make sure that we're using a domain socket, since we need to be
     // able to push file descriptors through it.
-    if (getsockname(xcb_get_file_descriptor(inst->conn), &addr, &addrlen) != 0)
-    {
-        return EGL_FALSE;
-    }
-    if (addr.sa_family != AF_UNIX)
+    if (!IsLocalConnection(inst->conn))
     {
         return EGL_FALSE;
     }
@@ -719,38 +907,14 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
         return EGL_FALSE;
     }
 
-    env = getenv(FORCE_ENABLE_ENV);
-    if (env == NULL || atoi(env) == 0)
+    if (CheckNVGLX(inst))
     {
-        /*
-         * Check if the NV-GLX extension is present. If it is, then that means
-         * we're talking to a normal X server running with the NVIDIA driver.
-         * In that case, fail here so that the driver can use its normal X11
-         * path.
-         *
-         * Note that if/when this replaces our existing X11 path for EGL, then
-         * we could add some requests to NV-GLX to support older (pre DRI3 1.2)
-         * servers or non-Linux systems.
-         */
-        const char NVGLX_EXTENSION_NAME[] = "NV-GLX";
-        xcb_query_extension_cookie_t extCookie = xcb_query_extension(inst->conn,
-                sizeof(NVGLX_EXTENSION_NAME) - 1, NVGLX_EXTENSION_NAME);
-        nvglxReply = xcb_query_extension_reply(inst->conn, extCookie, &error);
-        if (nvglxReply == NULL)
-        {
-            // XQueryExtension isn't supposed to generate any errors.
-            goto done;
-        }
-
-        if (nvglxReply->present)
-        {
-            goto done;
-        }
+        return EGL_FALSE;
     }
 
     // TODO: Send these requests in parallel, not in sequence
     dri3Cookie = xcb_dri3_query_version(inst->conn, NEED_DRI3_MAJOR, REQUEST_DRI3_MINOR);
-    dri3Reply = xcb_dri3_query_version_reply(inst->conn, dri3Cookie, &error);
+    dri3Reply = X11_ROUNDTRIP(xcb_dri3_query_version_reply(inst->conn, dri3Cookie, &error));
     if (dri3Reply == NULL)
     {
         goto done;
@@ -761,7 +925,7 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
     }
 
     presentCookie = xcb_present_query_version(inst->conn, NEED_PRESENT_MAJOR, REQUEST_PRESENT_MINOR);
-    presentReply = xcb_present_query_version_reply(inst->conn, presentCookie, &error);
+    presentReply = X11_ROUNDTRIP(xcb_present_query_version_reply(inst->conn, presentCookie, &error));
     if (presentReply == NULL)
     {
         goto done;
@@ -788,7 +952,6 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
     success = EGL_TRUE;
 
 done:
-    free(nvglxReply);
     free(presentReply);
     free(dri3Reply);
     free(error);
@@ -796,6 +959,48 @@ done:
     return success;
 }
 
+/**
+ * Checks whether we can use the software presentation path with a server that
+ * doesn't support DRI3 and Present.
+ *
+ * This is opt-in, since otherwise we'd take over servers like Xvfb or remote
+ * displays that another vendor library might handle better.
+ */
+static EGLBoolean CheckSoftwarePresent(X11DisplayInstance *inst)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint8_t NATIVE_IMAGE_ORDER = XCB_IMAGE_ORDER_LSB_FIRST;
+#else
+    const uint8_t NATIVE_IMAGE_ORDER = XCB_IMAGE_ORDER_MSB_FIRST;
+#endif
+    const char *env;
+    EGLBoolean local;
+
+    env = getenv(SOFTWARE_PRESENT_ENV);
+    if (env == NULL || atoi(env) == 0)
+    {
+        return EGL_FALSE;
+    }
+
+    // We send images to the server without converting them, so the server
+    // has to use the same byte order that we do.
+    if (xcb_get_setup(inst->conn)->image_byte_order != NATIVE_IMAGE_ORDER)
+    {
+        return EGL_FALSE;
+    }
+
+    local = IsLocalConnection(inst->conn);
+    if (local && CheckNVGLX(inst))
+    {
+        return EGL_FALSE;
+    }
+
+    // MIT-SHM only works if the server can see our shared memory segments.
+    inst->supports_shm = (local && eplX11CheckSoftwarePresentSHM(inst->conn));
+
+    return EGL_TRUE;
+}
+
 static EGLBoolean CheckServerFormatSupport(X11DisplayInstance *inst,
         EGLBoolean *ret_supports_direct, EGLBoolean *ret_supports_linear)
 {
@@ -815,7 +1020,7 @@ static EGLBoolean CheckServerFormatSupport(X11DisplayInstance *inst,
 
     cookie = xcb_dri3_get_supported_modifiers(inst->conn, inst->xscreen->root,
             eplFormatInfoDepth(fmt->fmt), fmt->fmt->bpp);
-    reply = xcb_dri3_get_supported_modifiers_reply(inst->conn, cookie, &error);
+    reply = X11_ROUNDTRIP(xcb_dri3_get_supported_modifiers_reply(inst->conn, cookie, &error));
     if (reply == NULL)
     {
         free(error);
@@ -851,6 +1056,64 @@ static EGLBoolean CheckServerFormatSupport(X11DisplayInstance *inst,
     return EGL_TRUE;
 }
 
+/**
+ * Opens a second connection to the same server as \c inst->conn, which we
+ * can use for presentation.
+ *
+ * If we can't open the connection, or if it looks like it goes to a different
+ * server, then this returns NULL, and the caller should just keep using the
+ * application's connection.
+ */
+static xcb_connection_t *OpenPresentConnection(EplDisplay *pdpy, X11DisplayInstance *inst)
+{
+    const char *name = NULL;
+    const xcb_setup_t *setup;
+    const xcb_setup_t *presentSetup;
+    xcb_screen_t *presentScreen;
+    xcb_connection_t *conn;
+    int xcbScreen = 0;
+
+    if (pdpy->platform_enum == EGL_PLATFORM_X11_KHR)
+    {
+        name = eplX11GetDisplayName(pdpy->native_display);
+    }
+    if (name == NULL)
+    {
+        // With EGL_PLATFORM_XCB_EXT, we have no way to find out which display
+        // an xcb_connection_t goes to, so the best we can do is to use
+        // DISPLAY and then check that it's the same server below.
+        name = pdpy->priv->display_env;
+    }
+
+    conn = xcb_connect(name, &xcbScreen);
+    if (conn == NULL)
+    {
+        return NULL;
+    }
+    if (xcb_connection_has_error(conn))
+    {
+        xcb_disconnect(conn);
+        return NULL;
+    }
+
+    setup = xcb_get_setup(inst->conn);
+    presentSetup = xcb_get_setup(conn);
+    presentScreen = GetXCBScreen(conn, inst->screen);
+    if (presentScreen == NULL
+            || presentScreen->root != inst->xscreen->root
+            || presentSetup->release_number != setup->release_number
+            || presentSetup->roots_len != setup->roots_len
+            || xcb_setup_vendor_length(presentSetup) != xcb_setup_vendor_length(setup)
+            || memcmp(xcb_setup_vendor(presentSetup), xcb_setup_vendor(setup),
+                xcb_setup_vendor_length(setup)) != 0)
+    {
+        xcb_disconnect(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
 X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean from_init)
 {
     X11DisplayInstance *inst = NULL;
@@ -868,6 +1131,11 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         return NULL;
     }
     eplRefCountInit(&inst->refcount);
+    glvnd_list_init(&inst->buffer_pool);
+    pthread_mutex_init(&inst->buffer_pool_mutex, NULL);
+    glvnd_list_init(&inst->visibility_windows);
+    pthread_mutex_init(&inst->visibility_mutex, NULL);
+    pthread_mutex_init(&inst->native_fence_mutex, NULL);
     inst->screen = pdpy->priv->screen_attrib;
     inst->platform = eplPlatformDataRef(pdpy->platform);
 
@@ -934,23 +1202,50 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
 
     if (!CheckServerExtensions(inst))
     {
-        if (from_init)
+        if (!CheckSoftwarePresent(inst))
         {
-            eplSetError(pdpy->platform, EGL_BAD_ACCESS, "X server is missing required extensions");
+            if (from_init)
+            {
+                eplSetError(pdpy->platform, EGL_BAD_ACCESS, "X server is missing required extensions");
+            }
+            eplX11DisplayInstanceUnref(inst);
+            return NULL;
         }
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        inst->software_present = EGL_TRUE;
     }
 
-    fd = GetDRI3DeviceFD(inst->conn, inst->xscreen);
-    if (fd < 0)
+    if (!inst->software_present)
     {
-        eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't open DRI3 device");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
-    }
+        fd = GetDRI3DeviceFD(inst->conn, inst->xscreen);
+        if (fd < 0)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't open DRI3 device");
+            eplX11DisplayInstanceUnref(inst);
+            return NULL;
+        }
 
-    serverDevice = FindDeviceForFD(pdpy->platform, fd);
+        if (!from_init && pdpy->priv->requested_device == EGL_NO_DEVICE_EXT)
+        {
+            EGLBoolean serverIsNV = EGL_FALSE;
+
+            /*
+             * If this is from eglGetPlatformDisplay, and the server is
+             * running on an NVIDIA device, then that's the device that
+             * eglInitialize will use. We don't need the EGLDeviceEXT handle
+             * for it yet, so check the vendor with libdrm and stop here,
+             * rather than calling eglQueryDevicesEXT and waking up the GPU for
+             * an application that might never call eglInitialize.
+             */
+            FindDeviceForFD(pdpy->platform, fd, EGL_FALSE, &serverIsNV);
+            if (serverIsNV)
+            {
+                close(fd);
+                return inst;
+            }
+        }
+
+        serverDevice = FindDeviceForFD(pdpy->platform, fd, EGL_TRUE, NULL);
+    }
     if (serverDevice != EGL_NO_DEVICE_EXT)
     {
         /*
@@ -990,7 +1285,9 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
          * If the user/caller requested a particular device, then use it.
          *
          * Otherwise, if PRIME is enabled, then we'll pick an arbitrary NVIDIA
-         * device to use.
+         * device to use. Likewise if we're using software presentation, since
+         * then we don't know which device the server is on, and it doesn't
+         * matter anyway.
          *
          * Otherwise, we'll fail. If this is from eglGetPlatformDisplay, then
          * eglGetPlatformDisplay will fail and the next vendor library can try.
@@ -1001,7 +1298,7 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
             // Pick whatever device the user/caller requested.
             inst->device = pdpy->priv->requested_device;
         }
-        else if (pdpy->priv->enable_alt_device)
+        else if (pdpy->priv->enable_alt_device || inst->software_present)
         {
             // If PRIME is enabled, then pick an NVIDIA device.
             EGLint num = 0;
@@ -1011,7 +1308,7 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
             }
         }
 
-        inst->supports_implicit_sync = EGL_TRUE;
+        inst->supports_implicit_sync = !inst->software_present;
     }
 
     if (inst->device == EGL_NO_DEVICE_EXT)
@@ -1020,7 +1317,10 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "X server is not running on an NVIDIA device");
         }
-        close(fd);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
         eplX11DisplayInstanceUnref(inst);
         return NULL;
     }
@@ -1031,7 +1331,10 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         // to open the correct device node for GBM.
         const char *node;
 
-        close(fd);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
 
         node = pdpy->platform->egl.QueryDeviceStringEXT(inst->device, EGL_DRM_DEVICE_FILE_EXT);
         if (node == NULL)
@@ -1052,6 +1355,18 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         inst->force_prime = EGL_TRUE;
     }
 
+    if (!from_init)
+    {
+        // We know which device we'd use, which is all that
+        // eglGetPlatformDisplay needs. Leave creating the GBM device and
+        // initializing the driver's display until eglInitialize.
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return inst;
+    }
+
     inst->gbmdev = gbm_create_device(fd);
     if (inst->gbmdev == NULL)
     {
@@ -1106,6 +1421,11 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         {
             inst->supports_EGL_ANDROID_native_fence_sync = EGL_TRUE;
         }
+        if (pdpy->platform->priv->egl.ClientWaitSync != NULL
+                && eplFindExtension("EGL_KHR_fence_sync", extensions))
+        {
+            inst->supports_EGL_KHR_fence_sync = EGL_TRUE;
+        }
     }
 
     if (!eplX11InitDriverFormats(pdpy->platform, inst))
@@ -1117,7 +1437,15 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         return NULL;
     }
 
-    if (!CheckServerFormatSupport(inst, &supportsDirect, &supportsLinear))
+    if (inst->software_present)
+    {
+        // With software presentation, the server never sees our buffers, so
+        // it doesn't matter which modifiers it supports. We always copy to a
+        // linear buffer, though, so we still need PRIME support.
+        supportsDirect = EGL_FALSE;
+        supportsLinear = EGL_TRUE;
+    }
+    else if (!CheckServerFormatSupport(inst, &supportsDirect, &supportsLinear))
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't get a format modifier list from the X server");
         eplX11DisplayInstanceUnref(inst);
@@ -1169,8 +1497,40 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         return NULL;
     }
 
+    inst->present_conn = inst->conn;
+    if (from_init && !inst->own_display)
+    {
+        // If we opened our own connection, then nothing else is using it,
+        // so there's no point in opening a second one.
+        const char *env = getenv(PRIVATE_PRESENT_CONNECTION_ENV);
+        if (env != NULL && atoi(env) != 0)
+        {
+            xcb_connection_t *conn = OpenPresentConnection(pdpy, inst);
+            if (conn != NULL)
+            {
+                inst->present_conn = conn;
+            }
+        }
+    }
+
     if (from_init)
     {
+        const char *env = getenv(MAX_FPS_ENV);
+        if (env != NULL && atoi(env) > 0)
+        {
+            inst->max_fps = atoi(env);
+        }
+        env = getenv(HIDDEN_FPS_ENV);
+        if (env != NULL && atoi(env) > 0)
+        {
+            inst->hidden_fps = atoi(env);
+        }
+        env = getenv(VRR_ENV);
+        if (env != NULL && atoi(env) != 0)
+        {
+            inst->vrr = EGL_TRUE;
+        }
+
         if (!eplX11InitConfigList(pdpy->platform, inst))
         {
             eplX11DisplayInstanceUnref(inst);
@@ -1183,11 +1543,33 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
 
 static void eplX11DisplayInstanceFree(X11DisplayInstance *inst)
 {
+    // The pooled buffers need the display connection and the internal
+    // display, so free them first.
+    eplX11FreeBufferPool(inst);
+    pthread_mutex_destroy(&inst->buffer_pool_mutex);
+    pthread_mutex_destroy(&inst->visibility_mutex);
+
+    if (inst->native_fence_xid != 0)
+    {
+        if (inst->conn != NULL && !inst->platform->exiting)
+        {
+            xcb_sync_destroy_fence(inst->conn, inst->native_fence_xid);
+        }
+        inst->native_fence_xid = 0;
+    }
+    pthread_mutex_destroy(&inst->native_fence_mutex);
+
     eplConfigListFree(inst->configs);
     inst->configs = NULL;
 
     eplX11CleanupDriverFormats(inst);
 
+    if (inst->present_conn != NULL && inst->present_conn != inst->conn)
+    {
+        xcb_disconnect(inst->present_conn);
+    }
+    inst->present_conn = NULL;
+
     if (inst->conn != NULL && inst->own_display)
     {
         xcb_disconnect(inst->conn);
@@ -1220,6 +1602,8 @@ static void eplX11DisplayInstanceFree(X11DisplayInstance *inst)
 
 static EGLBoolean eplX11InitializeDisplay(EplPlatformData *plat, EplDisplay *pdpy, EGLint *major, EGLint *minor)
 {
+    X11_ROUNDTRIP_ENTRY("eglInitialize");
+
     assert(pdpy->priv->inst == NULL);
 
     if (eplX11IsNativeClosed(pdpy->priv->closed_callback))
@@ -1240,6 +1624,8 @@ static EGLBoolean eplX11InitializeDisplay(EplPlatformData *plat, EplDisplay *pdp
 
 static void eplX11TerminateDisplay(EplPlatformData *plat, EplDisplay *pdpy)
 {
+    X11_ROUNDTRIP_ENTRY("eglTerminate");
+
     assert(pdpy->priv->inst != NULL);
     eplX11DisplayInstanceUnref(pdpy->priv->inst);
     pdpy->priv->inst = NULL;
@@ -1247,6 +1633,8 @@ static void eplX11TerminateDisplay(EplPlatformData *plat, EplDisplay *pdpy)
 
 static void eplX11DestroySurface(EplDisplay *pdpy, EplSurface *surf)
 {
+    X11_ROUNDTRIP_ENTRY("eglDestroySurface");
+
     if (surf->type == EPL_SURFACE_TYPE_WINDOW)
     {
         eplX11DestroyWindow(surf);
@@ -1272,6 +1660,7 @@ static void eplX11FreeSurface(EplDisplay *pdpy, EplSurface *surf)
 static EGLBoolean eplX11WaitGL(EplDisplay *pdpy, EplSurface *psurf)
 {
     EGLBoolean ret = EGL_TRUE;
+    X11_ROUNDTRIP_ENTRY("eglWaitGL");
 
     pdpy->platform->priv->egl.Finish();
     if (psurf != NULL && psurf->type == EPL_SURFACE_TYPE_WINDOW)
@@ -1282,6 +1671,109 @@ static EGLBoolean eplX11WaitGL(EplDisplay *pdpy, EplSurface *psurf)
     return ret;
 }
 
+static EGLBoolean eplX11WaitNative(EplDisplay *pdpy, EplSurface *psurf)
+{
+    X11_ROUNDTRIP_ENTRY("eglWaitNative");
+
+    if (psurf == NULL)
+    {
+        return EGL_TRUE;
+    }
+
+    if (psurf->type == EPL_SURFACE_TYPE_PIXMAP)
+    {
+        return eplX11WaitNativePixmap(pdpy, psurf);
+    }
+
+    // For a window, we render into our own color buffers, so there's nothing
+    // for the GPU to wait on. We still need the server to process any X
+    // rendering before our next present, though, since that might go out on
+    // a different connection.
+    return eplX11WaitForServerRequests(pdpy->priv->inst);
+}
+
+/**
+ * Waits for the server to process all of the requests that we've sent so far
+ * by doing a round trip.
+ */
+static EGLBoolean WaitForServerRoundTrip(X11DisplayInstance *inst)
+{
+    xcb_get_input_focus_reply_t *reply = X11_ROUNDTRIP(xcb_get_input_focus_reply(inst->conn,
+            xcb_get_input_focus(inst->conn), NULL));
+    if (reply == NULL)
+    {
+        eplSetError(inst->platform, EGL_BAD_NATIVE_WINDOW, "Failed to sync with the X server");
+        return EGL_FALSE;
+    }
+    free(reply);
+    return EGL_TRUE;
+}
+
+EGLBoolean eplX11WaitForServerRequests(X11DisplayInstance *inst)
+{
+    if (inst->software_present)
+    {
+        // Without DRI3, we haven't checked for the SYNC extension, so just
+        // do a round trip.
+        return WaitForServerRoundTrip(inst);
+    }
+
+    pthread_mutex_lock(&inst->native_fence_mutex);
+
+    if (inst->native_fence_xid == 0 && !inst->native_fence_failed)
+    {
+        xcb_void_cookie_t cookie;
+        xcb_generic_error_t *error;
+
+        inst->native_fence_xid = xcb_generate_id(inst->conn);
+        cookie = xcb_sync_create_fence_checked(inst->conn, inst->xscreen->root,
+                inst->native_fence_xid, 0);
+        error = X11_ROUNDTRIP(xcb_request_check(inst->conn, cookie));
+        if (error != NULL)
+        {
+            // If the server can't create the fence, then don't bother trying
+            // again. The round trip alone still orders the requests.
+            free(error);
+            inst->native_fence_xid = 0;
+            inst->native_fence_failed = EGL_TRUE;
+        }
+    }
+
+    if (inst->native_fence_xid != 0)
+    {
+        // Triggering a fence makes the server flush its queued rendering
+        // to the GPU. We don't need to wait for the fence itself, since the
+        // round trip below means the server has processed the trigger.
+        xcb_sync_trigger_fence(inst->conn, inst->native_fence_xid);
+    }
+
+    pthread_mutex_unlock(&inst->native_fence_mutex);
+
+    return WaitForServerRoundTrip(inst);
+}
+
+EGLBoolean eplX11WaitForSyncFDGPU(X11DisplayInstance *inst, int syncfd)
+{
+    EGLBoolean success = EGL_FALSE;
+
+    if (syncfd >= 0)
+    {
+        const EGLAttrib syncAttribs[] =
+        {
+            EGL_SYNC_NATIVE_FENCE_FD_ANDROID, syncfd,
+            EGL_NONE
+        };
+        EGLSync sync = inst->platform->priv->egl.CreateSync(inst->internal_display->edpy,
+                EGL_SYNC_NATIVE_FENCE_ANDROID, syncAttribs);
+        if (sync != EGL_NO_SYNC)
+        {
+            success = inst->platform->priv->egl.WaitSync(inst->internal_display->edpy, sync, 0);
+            inst->platform->priv->egl.DestroySync(inst->internal_display->edpy, sync);
+        }
+    }
+    return success;
+}
+
 EGLAttrib *eplX11GetInternalSurfaceAttribs(EplPlatformData *plat, EplDisplay *pdpy, const EGLAttrib *attribs)
 {
     EGLAttrib *internalAttribs = NULL;
@@ -1401,6 +1893,55 @@ EGLBoolean eplX11WaitForFD(int syncfd)
     }
 }
 
+EGLBoolean eplX11GetSyncFDTimestamp(int syncfd, uint64_t *ret_timestamp)
+{
+#if defined(SYNC_IOC_FILE_INFO)
+    struct sync_file_info info = {};
+    struct sync_fence_info *fences = NULL;
+    uint64_t timestamp = 0;
+    EGLBoolean success = EGL_FALSE;
+    uint32_t i;
+
+    // The first call just tells us how many fences there are.
+    if (drmIoctl(syncfd, SYNC_IOC_FILE_INFO, &info) != 0
+            || info.status != 1 || info.num_fences == 0)
+    {
+        return EGL_FALSE;
+    }
+
+    fences = calloc(info.num_fences, sizeof(struct sync_fence_info));
+    if (fences == NULL)
+    {
+        return EGL_FALSE;
+    }
+    info.sync_fence_info = (uintptr_t) fences;
+
+    if (drmIoctl(syncfd, SYNC_IOC_FILE_INFO, &info) != 0 || info.status != 1)
+    {
+        goto done;
+    }
+
+    for (i=0; i<info.num_fences; i++)
+    {
+        if (fences[i].timestamp_ns > timestamp)
+        {
+            timestamp = fences[i].timestamp_ns;
+        }
+    }
+
+    *ret_timestamp = timestamp;
+    success = EGL_TRUE;
+
+done:
+    free(fences);
+    return success;
+#else
+    (void) syncfd;
+    (void) ret_timestamp;
+    return EGL_FALSE;
+#endif
+}
+
 uint32_t eplX11GetNativeXID(EplDisplay *pdpy, void *native_surface, EGLBoolean create_platform)
 {
     unsigned long xid = 0;
@@ -34,14 +34,18 @@
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/sync.h>
 #include <gbm.h>
 #include <xf86drm.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 #include "platform-impl.h"
 #include "platform-utils.h"
 #include "driver-platform-surface.h"
 #include "config-list.h"
 #include "refcountobj.h"
+#include "glvnd_list.h"
 
 #ifndef EGL_EXT_platform_xcb
 #define EGL_EXT_platform_xcb 1
@@ -62,6 +66,11 @@ typedef struct _X11XlibDisplayClosedData X11XlibDisplayClosedData;
 
 EPL_REFCOUNT_DECLARE_TYPE_FUNCS(X11XlibDisplayClosedData, eplX11XlibDisplayClosedData);
 
+/**
+ * The maximum number of DRM devices to keep in EplImplPlatform::device_cache.
+ */
+#define X11_MAX_CACHED_DEVICES 8
+
 /**
  * Platform-specific stuff for X11.
  *
@@ -78,6 +87,7 @@ struct _EplImplPlatform
         PFNEGLCREATESYNCPROC CreateSync;
         PFNEGLDESTROYSYNCPROC DestroySync;
         PFNEGLWAITSYNCPROC WaitSync;
+        PFNEGLCLIENTWAITSYNCPROC ClientWaitSync;
         PFNEGLDUPNATIVEFENCEFDANDROIDPROC DupNativeFenceFDANDROID;
         void (* Flush) (void);
         void (* Finish) (void);
@@ -90,6 +100,11 @@ struct _EplImplPlatform
         pfn_eglPlatformCopyColorBufferNVX PlatformCopyColorBufferNVX;
         pfn_eglPlatformAllocColorBufferNVX PlatformAllocColorBufferNVX;
         pfn_eglPlatformExportColorBufferNVX PlatformExportColorBufferNVX;
+
+        // These are optional. If they're NULL, then we pass fences around
+        // with sync files instead.
+        pfn_eglPlatformSignalSyncobjNVX PlatformSignalSyncobjNVX;
+        pfn_eglPlatformWaitSyncobjNVX PlatformWaitSyncobjNVX;
     } egl;
 
     struct
@@ -130,6 +145,32 @@ struct _EplImplPlatform
     } drm;
 
     EGLBoolean timeline_funcs_supported;
+
+    /**
+     * Caches the EGLDeviceEXT for each DRM device that we've seen from
+     * DRI3Open, keyed by the device number.
+     *
+     * Looking up a device means scanning sysfs in libdrm and then checking
+     * every EGLDeviceEXT, so this lets any later displays on the same device
+     * skip all of that. A non-NVIDIA device is cached as EGL_NO_DEVICE_EXT.
+     */
+    struct
+    {
+        struct
+        {
+            dev_t rdev;
+            EGLDeviceEXT device;
+            EGLBoolean is_nv;
+
+            /**
+             * True if \c device is valid. If this is false, then we've only
+             * checked whether it's an NVIDIA device.
+             */
+            EGLBoolean resolved;
+        } entries[X11_MAX_CACHED_DEVICES];
+        int count;
+        pthread_mutex_t mutex;
+    } device_cache;
 };
 
 /**
@@ -198,6 +239,22 @@ typedef struct
      */
     EGLBoolean own_display;
 
+    /**
+     * The connection that we use for DRI3 and Present requests for windows.
+     *
+     * Normally, this is the same as \c conn. If the
+     * __NV_X11_EGL_PRIVATE_PRESENT_CONNECTION environment variable is set,
+     * then this is a separate connection that we open ourselves, so that
+     * presenting doesn't have to compete with the application's own X11
+     * traffic for XCB's locks and socket.
+     *
+     * Window XIDs are global, so a window that the application created with
+     * its own connection works just as well here. Any pixmaps, syncobjs, and
+     * event registrations that we create for a window belong to this
+     * connection, though, so all of those requests have to use it.
+     */
+    xcb_connection_t *present_conn;
+
     /**
      * The internal (driver) EGLDisplay.
      */
@@ -243,6 +300,15 @@ typedef struct
      */
     EGLBoolean supports_EGL_ANDROID_native_fence_sync;
 
+    /**
+     * If true, then the driver supports EGL_KHR_fence_sync, and we have
+     * eglClientWaitSync.
+     *
+     * This is used to defer presentation to another thread if we don't have
+     * EGL_ANDROID_native_fence_sync.
+     */
+    EGLBoolean supports_EGL_KHR_fence_sync;
+
     /**
      * If true, then the server supports implicit sync semantics.
      */
@@ -262,6 +328,57 @@ typedef struct
      */
     EGLBoolean supports_explicit_sync;
 
+    /**
+     * If true, then the server doesn't support DRI3 and Present, and we're
+     * using the software presentation path instead.
+     *
+     * In that case, every window uses the PRIME path to copy into a linear
+     * buffer, and then we upload that buffer with a PutImage request. Pixmaps
+     * aren't supported. See x11-swpresent.h.
+     */
+    EGLBoolean software_present;
+
+    /**
+     * If true, then we can try to use MIT-SHM for software presentation.
+     */
+    EGLBoolean supports_shm;
+
+    /**
+     * The default frame rate limit for windows, from the
+     * __NV_X11_EGL_MAX_FPS environment variable, or 0 for no limit.
+     *
+     * A profile can override this for specific windows.
+     */
+    uint32_t max_fps;
+
+    /**
+     * The default frame rate for hidden windows, from the
+     * __NV_X11_EGL_HIDDEN_FPS environment variable, or 0 to present hidden
+     * windows normally.
+     */
+    uint32_t hidden_fps;
+
+    /**
+     * If true, then use variable refresh presentation for windows by
+     * default. This comes from the __NV_X11_EGL_VRR environment variable.
+     */
+    EGLBoolean vrr;
+
+    /**
+     * The windows that are tracking VisibilityNotify events.
+     *
+     * We can only select for core events on \c present_conn when it's our
+     * own private connection, since selecting them on the application's
+     * connection would replace the application's own event mask. In that
+     * case, whichever thread swaps next reads the events for every window
+     * and updates the matching window's state.
+     *
+     * Protected by \c visibility_mutex. The entries are private to
+     * x11-window.c.
+     */
+    struct glvnd_list visibility_windows;
+    pthread_mutex_t visibility_mutex;
+
     /**
      * The list of EGLConfigs.
      */
@@ -272,6 +389,38 @@ typedef struct
      */
     X11DriverFormat *driver_formats;
     int num_driver_formats;
+
+    /**
+     * A pool of color buffers from windows that have been destroyed.
+     *
+     * Applications that create and destroy a lot of short-lived windows, like
+     * tooltips or popup menus, would otherwise have to allocate new color
+     * buffers for every one of them. Instead, we keep a few of the most
+     * recently freed buffers around so that a new window with the same size
+     * and format can pick them up.
+     *
+     * The list is in most-recently-freed order, and is protected by
+     * \c buffer_pool_mutex, since windows on different threads can use it.
+     * The buffers themselves are private to x11-window.c.
+     */
+    struct glvnd_list buffer_pool;
+    int buffer_pool_count;
+    pthread_mutex_t buffer_pool_mutex;
+
+    /**
+     * A SyncFence that eglWaitNative triggers to make the server flush its
+     * rendering.
+     *
+     * This is created the first time that eglWaitNative is called, and is
+     * protected by \c native_fence_mutex. It's zero if it hasn't been
+     * created yet.
+     *
+     * If the server fails to create the fence, then \c native_fence_failed
+     * is set, and we just use a round trip from then on.
+     */
+    xcb_sync_fence_t native_fence_xid;
+    EGLBoolean native_fence_failed;
+    pthread_mutex_t native_fence_mutex;
 } X11DisplayInstance;
 
 /**
@@ -347,6 +496,14 @@ EPL_REFCOUNT_DECLARE_TYPE_FUNCS(X11DisplayInstance, eplX11DisplayInstance);
  */
 xcb_connection_t *eplX11GetXCBConnection(void *native_display, int *ret_screen);
 
+/**
+ * Returns the display name that was used to open a native xlib Display, or
+ * NULL if it isn't known.
+ *
+ * This is used to open a second connection to the same server.
+ */
+const char *eplX11GetDisplayName(void *native_display);
+
 /**
  * Registers a callback for when an Xlib Display is closed.
  *
@@ -435,12 +592,68 @@ void eplX11DestroyPixmap(EplSurface *surf);
 
 EGLBoolean eplX11SwapInterval(EGLDisplay edpy, EGLint interval);
 
+/**
+ * \defgroup present_wait EGL_NVX_present_wait
+ *
+ * Lets an application wait for a specific frame to be displayed, similar to
+ * VK_KHR_present_wait.
+ *
+ * Each eglSwapBuffers call that presents a frame assigns it the next present
+ * ID, starting at 1. eglQuerySurfacePresentIdNVX returns the ID of the last
+ * frame, and eglWaitForPresentNVX waits until that frame, and thus every
+ * earlier frame, has completed.
+ *
+ * eglWaitForPresentNVX returns EGL_CONDITION_SATISFIED_KHR,
+ * EGL_TIMEOUT_EXPIRED_KHR, or EGL_FALSE on error, like eglClientWaitSync. The
+ * timeout is in nanoseconds, and can be EGL_FOREVER_KHR.
+ * @{
+ */
+#define PRESENT_WAIT_EXTENSION_NAME "EGL_NVX_present_wait"
+
+EGLBoolean eplX11QuerySurfacePresentIdNVX(EGLDisplay edpy, EGLSurface esurf,
+        EGLuint64KHR *ret_id);
+EGLint eplX11WaitForPresentNVX(EGLDisplay edpy, EGLSurface esurf,
+        EGLuint64KHR present_id, EGLTimeKHR timeout);
+/** @} */
+
 void eplX11DestroyWindow(EplSurface *surf);
 
 void eplX11FreeWindow(EplSurface *surf);
 
+/**
+ * Frees any color buffers in a display's buffer pool.
+ */
+void eplX11FreeBufferPool(X11DisplayInstance *inst);
+
 EGLBoolean eplX11WaitGLWindow(EplDisplay *pdpy, EplSurface *psurf);
 
+/**
+ * Implements eglWaitNative for a pixmap surface.
+ *
+ * If the surface renders directly into the pixmap's buffer, then this makes
+ * the GPU wait for any X rendering into it before any later GL rendering.
+ */
+EGLBoolean eplX11WaitNativePixmap(EplDisplay *pdpy, EplSurface *psurf);
+
+/**
+ * Waits for the server to process every request that we've sent on
+ * \c X11DisplayInstance::conn so far.
+ *
+ * This triggers a SyncFence and then does a round trip. Triggering a fence
+ * makes the server flush any rendering that it's queued up, so after this
+ * returns, the server's rendering has been submitted to the GPU, although it
+ * may not have finished.
+ */
+EGLBoolean eplX11WaitForServerRequests(X11DisplayInstance *inst);
+
+/**
+ * Makes the GPU wait for a sync FD using eglWaitSync, without a CPU stall.
+ *
+ * \param inst The X11DisplayInstance
+ * \param syncfd The sync file descriptor. This must be a regular fence.
+ */
+EGLBoolean eplX11WaitForSyncFDGPU(X11DisplayInstance *inst, int syncfd);
+
 /**
  * A wrapper around the DMA_BUF_IOCTL_IMPORT_SYNC_FILE ioctl.
  *
@@ -461,4 +674,18 @@ int eplX11ExportDmaBufSyncFile(X11DisplayInstance *inst, int dmabuf);
  */
 EGLBoolean eplX11WaitForFD(int syncfd);
 
+/**
+ * Returns the time that a sync file signaled, without waiting for it.
+ *
+ * This uses the SYNC_IOC_FILE_INFO ioctl. If the sync file contains more than
+ * one fence, then this returns the time that the last one signaled.
+ *
+ * \param syncfd The sync file.
+ * \param[out] ret_timestamp Returns the CLOCK_MONOTONIC time in nanoseconds
+ *      that the sync file signaled.
+ * \return EGL_TRUE if the sync file has signaled, or EGL_FALSE if it's still
+ *      pending or if the timestamp isn't available.
+ */
+EGLBoolean eplX11GetSyncFDTimestamp(int syncfd, uint64_t *ret_timestamp);
+
 #endif // X11_PLATFORM_H
@@ -0,0 +1,479 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Loading and matching per-application presentation profiles.
+ */
+
+#include "x11-profile.h"
+#include "x11-roundtrip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <xcb/xproto.h>
+
+static const char *SYSTEM_PROFILE_FILE = "/etc/egl-x11/profiles.conf";
+static const char *USER_PROFILE_FILE = "egl-x11/profiles.conf";
+
+static const int PROFILE_MIN_COLOR_BUFFERS = 2;
+static const int PROFILE_MAX_COLOR_BUFFERS = 8;
+static const int PROFILE_MAX_PENDING_FRAMES = 4;
+
+/**
+ * A single profile from a config file.
+ *
+ * Any setting that the profile doesn't specify is -1.
+ */
+typedef struct
+{
+    char *executable;
+    char *wm_class;
+
+    int max_color_buffers;
+    int max_pending_frames;
+    int prime;
+    int sync;
+    int modifiers;
+    int trim_idle_frames;
+    int swap_interval;
+    int max_fps;
+    int hidden_fps;
+    int vrr;
+} X11Profile;
+
+/**
+ * The table of profiles that apply to this process.
+ *
+ * This is filled in once by LoadProfiles, and then never changes, so it
+ * doesn't need a mutex after that.
+ *
+ * Profiles whose \c executable doesn't match the current process are dropped
+ * when the files are loaded, since they can't match any window.
+ */
+static X11Profile *profiles = NULL;
+static int num_profiles = 0;
+
+/**
+ * True if any of the profiles match on WM_CLASS, in which case we have to
+ * look up the WM_CLASS property of each window.
+ */
+static EGLBoolean need_wm_class = EGL_FALSE;
+
+static pthread_once_t profiles_once = PTHREAD_ONCE_INIT;
+
+static void CleanupProfiles(void) __attribute__((destructor));
+
+static char *TrimString(char *str)
+{
+    char *end;
+
+    while (*str == ' ' || *str == '\t')
+    {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t'
+                || end[-1] == '\n' || end[-1] == '\r'))
+    {
+        end--;
+    }
+    *end = '\0';
+    return str;
+}
+
+static int ParseInt(const char *value, int min, int max)
+{
+    char *end = NULL;
+    long num;
+
+    errno = 0;
+    num = strtol(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0' || num < min || num > max)
+    {
+        return -1;
+    }
+    return (int) num;
+}
+
+/**
+ * Looks up a string value in a NULL-terminated list of names, and returns
+ * the index, or -1 if it doesn't match any of them.
+ */
+static int ParseEnum(const char *value, const char * const *names)
+{
+    int i;
+    for (i=0; names[i] != NULL; i++)
+    {
+        if (strcasecmp(value, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void SetProfileValue(X11Profile *profile, const char *key, const char *value)
+{
+    static const char * const PRIME_NAMES[] = { "auto", "always", "avoid", NULL };
+    static const char * const SYNC_NAMES[] = { "auto", "implicit", "explicit", NULL };
+    static const char * const MODIFIER_NAMES[] = { "optimal", "fixed", NULL };
+
+    // Unknown keys and invalid values are ignored, so that a config file
+    // written for a newer version doesn't break an older one.
+    if (strcmp(key, "executable") == 0)
+    {
+        free(profile->executable);
+        profile->executable = strdup(value);
+    }
+    else if (strcmp(key, "wm-class") == 0)
+    {
+        free(profile->wm_class);
+        profile->wm_class = strdup(value);
+    }
+    else if (strcmp(key, "swapchain-depth") == 0)
+    {
+        profile->max_color_buffers = ParseInt(value,
+                PROFILE_MIN_COLOR_BUFFERS, PROFILE_MAX_COLOR_BUFFERS);
+    }
+    else if (strcmp(key, "frames-in-flight") == 0)
+    {
+        profile->max_pending_frames = ParseInt(value, 0, PROFILE_MAX_PENDING_FRAMES);
+    }
+    else if (strcmp(key, "prime") == 0)
+    {
+        profile->prime = ParseEnum(value, PRIME_NAMES);
+    }
+    else if (strcmp(key, "sync") == 0)
+    {
+        profile->sync = ParseEnum(value, SYNC_NAMES);
+    }
+    else if (strcmp(key, "modifiers") == 0)
+    {
+        profile->modifiers = ParseEnum(value, MODIFIER_NAMES);
+    }
+    else if (strcmp(key, "trim-idle-frames") == 0)
+    {
+        profile->trim_idle_frames = ParseInt(value, 0, INT_MAX);
+    }
+    else if (strcmp(key, "swap-interval") == 0)
+    {
+        profile->swap_interval = ParseInt(value, 0, INT_MAX);
+    }
+    else if (strcmp(key, "max-fps") == 0)
+    {
+        profile->max_fps = ParseInt(value, 0, INT_MAX);
+    }
+    else if (strcmp(key, "hidden-fps") == 0)
+    {
+        profile->hidden_fps = ParseInt(value, 0, INT_MAX);
+    }
+    else if (strcmp(key, "vrr") == 0)
+    {
+        profile->vrr = ParseInt(value, 0, 1);
+    }
+}
+
+static X11Profile *AddProfile(void)
+{
+    X11Profile *newProfiles = realloc(profiles, (num_profiles + 1) * sizeof(X11Profile));
+    X11Profile *profile;
+
+    if (newProfiles == NULL)
+    {
+        return NULL;
+    }
+    profiles = newProfiles;
+
+    profile = &profiles[num_profiles++];
+    profile->executable = NULL;
+    profile->wm_class = NULL;
+    profile->max_color_buffers = -1;
+    profile->max_pending_frames = -1;
+    profile->prime = -1;
+    profile->sync = -1;
+    profile->modifiers = -1;
+    profile->trim_idle_frames = -1;
+    profile->swap_interval = -1;
+    profile->max_fps = -1;
+    profile->hidden_fps = -1;
+    profile->vrr = -1;
+    return profile;
+}
+
+static void FreeProfile(X11Profile *profile)
+{
+    free(profile->executable);
+    free(profile->wm_class);
+}
+
+static void LoadProfileFile(const char *path)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t lineSize = 0;
+    X11Profile *current = NULL;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    while (getline(&line, &lineSize, fp) >= 0)
+    {
+        char *str = TrimString(line);
+        char *sep;
+
+        if (str[0] == '\0' || str[0] == '#')
+        {
+            continue;
+        }
+
+        if (strcmp(str, "[profile]") == 0)
+        {
+            current = AddProfile();
+            if (current == NULL)
+            {
+                break;
+            }
+            continue;
+        }
+
+        sep = strchr(str, '=');
+        if (current == NULL || sep == NULL)
+        {
+            continue;
+        }
+        *sep = '\0';
+        SetProfileValue(current, TrimString(str), TrimString(sep + 1));
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+/**
+ * Returns true if \p name matches the name of the current executable.
+ *
+ * This checks both the name of the executable file and the short name from
+ * argv[0], since those can be different if the app is run through a symlink
+ * or a launcher script.
+ */
+static EGLBoolean MatchExecutable(const char *name)
+{
+    char path[PATH_MAX];
+    ssize_t len;
+
+    if (strcmp(name, program_invocation_short_name) == 0)
+    {
+        return EGL_TRUE;
+    }
+
+    len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len > 0)
+    {
+        const char *base;
+
+        path[len] = '\0';
+        base = strrchr(path, '/');
+        base = (base != NULL ? base + 1 : path);
+        if (strcmp(name, base) == 0)
+        {
+            return EGL_TRUE;
+        }
+    }
+
+    return EGL_FALSE;
+}
+
+static void LoadProfiles(void)
+{
+    const char *configHome;
+    char *userPath = NULL;
+    int i, j;
+
+    LoadProfileFile(SYSTEM_PROFILE_FILE);
+
+    configHome = getenv("XDG_CONFIG_HOME");
+    if (configHome != NULL && configHome[0] != '\0')
+    {
+        if (asprintf(&userPath, "%s/%s", configHome, USER_PROFILE_FILE) < 0)
+        {
+            userPath = NULL;
+        }
+    }
+    else
+    {
+        const char *home = getenv("HOME");
+        if (home != NULL && home[0] != '\0')
+        {
+            if (asprintf(&userPath, "%s/.config/%s", home, USER_PROFILE_FILE) < 0)
+            {
+                userPath = NULL;
+            }
+        }
+    }
+    if (userPath != NULL)
+    {
+        LoadProfileFile(userPath);
+        free(userPath);
+    }
+
+    // The executable doesn't change, so filter out any profiles that don't
+    // match it now, rather than checking again for every window.
+    j = 0;
+    for (i=0; i<num_profiles; i++)
+    {
+        if (profiles[i].executable != NULL && !MatchExecutable(profiles[i].executable))
+        {
+            FreeProfile(&profiles[i]);
+            continue;
+        }
+        if (profiles[i].wm_class != NULL)
+        {
+            need_wm_class = EGL_TRUE;
+        }
+        profiles[j++] = profiles[i];
+    }
+    num_profiles = j;
+}
+
+static void CleanupProfiles(void)
+{
+    int i;
+
+    for (i=0; i<num_profiles; i++)
+    {
+        FreeProfile(&profiles[i]);
+    }
+    free(profiles);
+    profiles = NULL;
+    num_profiles = 0;
+}
+
+/**
+ * Checks whether a window's WM_CLASS matches a profile.
+ *
+ * WM_CLASS contains two strings, the instance name and the class name. The
+ * profile matches if it's equal to either one.
+ */
+static EGLBoolean MatchWMClass(const char *name, const char *wmClass, int wmClassLength)
+{
+    int offset = 0;
+
+    while (offset < wmClassLength)
+    {
+        int len = strnlen(wmClass + offset, wmClassLength - offset);
+        if (len == (int) strlen(name) && strncasecmp(name, wmClass + offset, len) == 0)
+        {
+            return EGL_TRUE;
+        }
+        offset += len + 1;
+    }
+    return EGL_FALSE;
+}
+
+void eplX11ApplyPresentProfiles(xcb_connection_t *conn, xcb_window_t xwin,
+        X11PresentPolicy *policy)
+{
+    xcb_get_property_reply_t *wmClassReply = NULL;
+    const char *wmClass = NULL;
+    int wmClassLength = 0;
+    int i;
+
+    pthread_once(&profiles_once, LoadProfiles);
+
+    if (num_profiles == 0)
+    {
+        return;
+    }
+
+    if (need_wm_class)
+    {
+        xcb_get_property_cookie_t cookie = xcb_get_property(conn, 0, xwin,
+                XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 256);
+        wmClassReply = X11_ROUNDTRIP(xcb_get_property_reply(conn, cookie, NULL));
+        if (wmClassReply != NULL && wmClassReply->format == 8)
+        {
+            wmClass = xcb_get_property_value(wmClassReply);
+            wmClassLength = xcb_get_property_value_length(wmClassReply);
+        }
+    }
+
+    for (i=0; i<num_profiles; i++)
+    {
+        const X11Profile *profile = &profiles[i];
+
+        if (profile->wm_class != NULL
+                && (wmClass == NULL || !MatchWMClass(profile->wm_class, wmClass, wmClassLength)))
+        {
+            continue;
+        }
+
+        if (profile->max_color_buffers >= 0)
+        {
+            policy->max_color_buffers = profile->max_color_buffers;
+        }
+        if (profile->max_pending_frames >= 0)
+        {
+            policy->max_pending_frames = profile->max_pending_frames;
+        }
+        if (profile->prime >= 0)
+        {
+            policy->prime = profile->prime;
+        }
+        if (profile->sync >= 0)
+        {
+            policy->sync = profile->sync;
+        }
+        if (profile->modifiers >= 0)
+        {
+            policy->modifiers = profile->modifiers;
+        }
+        if (profile->trim_idle_frames >= 0)
+        {
+            policy->trim_idle_frames = profile->trim_idle_frames;
+        }
+        if (profile->swap_interval >= 0)
+        {
+            policy->swap_interval = profile->swap_interval;
+        }
+        if (profile->max_fps >= 0)
+        {
+            policy->max_fps = profile->max_fps;
+        }
+        if (profile->hidden_fps >= 0)
+        {
+            policy->hidden_fps = profile->hidden_fps;
+        }
+        if (profile->vrr >= 0)
+        {
+            policy->vrr = (profile->vrr != 0);
+        }
+    }
+
+    free(wmClassReply);
+}
@@ -0,0 +1,191 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef X11_PROFILE_H
+#define X11_PROFILE_H
+
+/**
+ * \file
+ *
+ * Per-application presentation profiles.
+ *
+ * Profiles are read from a system-wide config file and a per-user config
+ * file. Each profile can match on the executable name and/or the window's
+ * WM_CLASS, and overrides some of the presentation settings for windows that
+ * it matches.
+ *
+ * The config files use a simple format:
+ *
+ * \code
+ * # Comments start with '#'
+ * [profile]
+ * executable = glxgears
+ * wm-class = Glxgears
+ * swapchain-depth = 3
+ * frames-in-flight = 2
+ * prime = auto | always | avoid
+ * sync = auto | explicit | implicit
+ * modifiers = optimal | fixed
+ * trim-idle-frames = 120
+ * swap-interval = 0
+ * max-fps = 60
+ * hidden-fps = 1
+ * vrr = 1
+ * \endcode
+ *
+ * A profile with no \c executable or \c wm-class keys applies to every
+ * application. If more than one profile matches, then they're applied in
+ * order, with the per-user file after the system file.
+ */
+
+#include <EGL/egl.h>
+#include <xcb/xcb.h>
+
+/**
+ * How to pick between the direct and PRIME presentation paths.
+ */
+typedef enum
+{
+    /**
+     * Use the PRIME path only if we can't find a format modifier that the
+     * server can use directly.
+     */
+    X11_PRIME_POLICY_AUTO,
+
+    /**
+     * Always use the PRIME path if it's supported.
+     */
+    X11_PRIME_POLICY_ALWAYS,
+
+    /**
+     * Avoid the PRIME path, even if that means that the server has to do a
+     * blit.
+     */
+    X11_PRIME_POLICY_AVOID,
+} X11PrimePolicy;
+
+/**
+ * Which synchronization method to use.
+ */
+typedef enum
+{
+    /**
+     * Use explicit sync if it's available, and implicit sync otherwise.
+     */
+    X11_SYNC_POLICY_AUTO,
+
+    /**
+     * Don't use explicit sync, even if the server supports it.
+     */
+    X11_SYNC_POLICY_IMPLICIT,
+
+    /**
+     * Prefer explicit sync, and only fall back to implicit sync if the
+     * server or driver can't do explicit sync for the window.
+     *
+     * This currently picks the same as \c X11_SYNC_POLICY_AUTO, but it
+     * keeps an application on explicit sync even if the automatic choice
+     * changes later.
+     */
+    X11_SYNC_POLICY_EXPLICIT,
+} X11SyncPolicy;
+
+/**
+ * How to respond when the server reports that a format modifier is
+ * suboptimal.
+ */
+typedef enum
+{
+    /**
+     * Reallocate the color buffers with a better modifier.
+     */
+    X11_MODIFIER_POLICY_OPTIMAL,
+
+    /**
+     * Keep using whatever modifier we picked when we created the surface.
+     */
+    X11_MODIFIER_POLICY_FIXED,
+} X11ModifierPolicy;
+
+/**
+ * The presentation settings for a window.
+ */
+typedef struct
+{
+    /**
+     * The maximum number of color buffers to allocate for the window.
+     */
+    int max_color_buffers;
+
+    /**
+     * The maximum number of outstanding PresentPixmap requests before
+     * eglSwapBuffers waits for one to complete.
+     */
+    uint32_t max_pending_frames;
+
+    X11PrimePolicy prime;
+    X11SyncPolicy sync;
+    X11ModifierPolicy modifiers;
+
+    /**
+     * If non-zero, then free any idle color buffer that hasn't been presented
+     * in this many frames.
+     */
+    uint32_t trim_idle_frames;
+
+    /**
+     * The initial swap interval for the window.
+     */
+    EGLint swap_interval;
+
+    /**
+     * If non-zero, then eglSwapBuffers limits the window to this many frames
+     * per second.
+     */
+    uint32_t max_fps;
+
+    /**
+     * If non-zero, then track whether the window is visible, and while it
+     * isn't, skip presenting entirely and limit eglSwapBuffers to this many
+     * frames per second.
+     */
+    uint32_t hidden_fps;
+
+    /**
+     * If true, then mark the window as supporting variable refresh, and
+     * present frames as soon as they're ready instead of targeting an MSC.
+     */
+    EGLBoolean vrr;
+} X11PresentPolicy;
+
+/**
+ * Applies any profiles that match the current process and a window.
+ *
+ * The caller should fill in \p policy with the default settings. This will
+ * then override whatever settings the matching profiles specify.
+ *
+ * The config files are only read the first time this is called. After that,
+ * the profiles are kept in an immutable table for the rest of the process.
+ *
+ * \param conn The connection to use to look up the window's WM_CLASS.
+ * \param xwin The window.
+ * \param[in,out] policy The presentation settings to update.
+ */
+void eplX11ApplyPresentProfiles(xcb_connection_t *conn, xcb_window_t xwin,
+        X11PresentPolicy *policy);
+
+#endif // X11_PROFILE_H
@@ -0,0 +1,236 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Profiling for X protocol round trips.
+ */
+
+#include "x11-roundtrip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "platform-utils.h"
+
+static const char *ROUNDTRIP_PROFILE_ENV = "__NV_X11_EGL_ROUNDTRIP_PROFILE";
+
+/**
+ * The name to use for round trips outside of any known entry point.
+ */
+static const char *OTHER_ENTRY_NAME = "(other)";
+
+/**
+ * The maximum number of distinct entry points that we keep totals for. Any
+ * others get lumped in with OTHER_ENTRY_NAME.
+ */
+#define MAX_PROFILE_ENTRIES 32
+
+typedef struct
+{
+    const char *name;
+    uint64_t calls;
+    uint64_t round_trips;
+    uint64_t blocked_time;
+} X11RoundTripEntry;
+
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *profile_output = NULL;
+static X11RoundTripEntry profile_entries[MAX_PROFILE_ENTRIES];
+static int profile_entry_count = 0;
+
+static __thread const char *current_entry = NULL;
+
+static void WriteProfile(void) __attribute__((destructor));
+
+static void InitProfile(void)
+{
+    const char *env = getenv(ROUNDTRIP_PROFILE_ENV);
+    if (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0)
+    {
+        profile_output = env;
+    }
+}
+
+static int ProfileEnabled(void)
+{
+    pthread_once(&profile_once, InitProfile);
+    return (profile_output != NULL);
+}
+
+/**
+ * Finds or adds the totals for an entry point.
+ *
+ * The caller must hold \c profile_mutex.
+ */
+static X11RoundTripEntry *LookupEntry(const char *name)
+{
+    int i;
+
+    if (name == NULL)
+    {
+        name = OTHER_ENTRY_NAME;
+    }
+
+    for (i=0; i<profile_entry_count; i++)
+    {
+        if (strcmp(profile_entries[i].name, name) == 0)
+        {
+            return &profile_entries[i];
+        }
+    }
+
+    if (profile_entry_count < MAX_PROFILE_ENTRIES)
+    {
+        X11RoundTripEntry *entry = &profile_entries[profile_entry_count++];
+        entry->name = name;
+        return entry;
+    }
+
+    if (name != OTHER_ENTRY_NAME)
+    {
+        return LookupEntry(OTHER_ENTRY_NAME);
+    }
+
+    // The table is full, and there's no room for the catch-all entry. This
+    // can't happen unless we have more than MAX_PROFILE_ENTRIES entry points.
+    return &profile_entries[MAX_PROFILE_ENTRIES - 1];
+}
+
+const char *eplX11RoundTripEnter(const char *name)
+{
+    const char *prev = current_entry;
+
+    if (!ProfileEnabled())
+    {
+        return prev;
+    }
+
+    // Only count the outermost entry point, so that an EGL function that
+    // calls another one internally only counts once.
+    if (prev == NULL)
+    {
+        current_entry = name;
+
+        pthread_mutex_lock(&profile_mutex);
+        LookupEntry(name)->calls++;
+        pthread_mutex_unlock(&profile_mutex);
+    }
+
+    return prev;
+}
+
+void eplX11RoundTripLeave(const char **prev)
+{
+    current_entry = *prev;
+}
+
+uint64_t eplX11RoundTripBegin(void)
+{
+    if (!ProfileEnabled())
+    {
+        return 0;
+    }
+    return eplGetMonotonicTime();
+}
+
+void eplX11RoundTripEnd(uint64_t start)
+{
+    X11RoundTripEntry *entry;
+    uint64_t elapsed;
+
+    if (start == 0)
+    {
+        return;
+    }
+
+    elapsed = eplGetMonotonicTime() - start;
+
+    pthread_mutex_lock(&profile_mutex);
+    entry = LookupEntry(current_entry);
+    entry->round_trips++;
+    entry->blocked_time += elapsed;
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+static int CompareEntries(const void *p1, const void *p2)
+{
+    const X11RoundTripEntry *e1 = p1;
+    const X11RoundTripEntry *e2 = p2;
+
+    if (e1->blocked_time > e2->blocked_time)
+    {
+        return -1;
+    }
+    else if (e1->blocked_time < e2->blocked_time)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+static void WriteProfile(void)
+{
+    FILE *out;
+    int i;
+
+    if (profile_output == NULL)
+    {
+        return;
+    }
+
+    if (strcmp(profile_output, "1") == 0)
+    {
+        out = stderr;
+    }
+    else
+    {
+        out = fopen(profile_output, "we");
+        if (out == NULL)
+        {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&profile_mutex);
+    qsort(profile_entries, profile_entry_count, sizeof(X11RoundTripEntry), CompareEntries);
+
+    fprintf(out, "egl-x11 round trips (pid %d):\n", (int) getpid());
+    fprintf(out, "%-32s %10s %12s %14s %12s\n",
+            "entry point", "calls", "round trips", "blocked (ms)", "ms/call");
+    for (i=0; i<profile_entry_count; i++)
+    {
+        const X11RoundTripEntry *entry = &profile_entries[i];
+        double blocked = entry->blocked_time / 1000000.0;
+
+        fprintf(out, "%-32s %10llu %12llu %14.3f %12.3f\n", entry->name,
+                (unsigned long long) entry->calls,
+                (unsigned long long) entry->round_trips,
+                blocked, (entry->calls > 0 ? blocked / entry->calls : 0.0));
+    }
+    pthread_mutex_unlock(&profile_mutex);
+
+    if (out != stderr)
+    {
+        fclose(out);
+    }
+}
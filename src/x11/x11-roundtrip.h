@@ -0,0 +1,83 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef X11_ROUNDTRIP_H
+#define X11_ROUNDTRIP_H
+
+/**
+ * \file
+ *
+ * Profiling for X protocol round trips.
+ *
+ * If the __NV_X11_EGL_ROUNDTRIP_PROFILE environment variable is set, then we
+ * count every time that we block waiting for a reply or an error check from
+ * the server, along with how long we waited, and attribute it to the EGL
+ * entry point that we were in at the time. The totals are written out when
+ * the process exits, either to stderr if the variable is "1", or else to the
+ * file that it names.
+ *
+ * Entry points are marked with X11_ROUNDTRIP_ENTRY, and each blocking call is
+ * wrapped in X11_ROUNDTRIP.
+ */
+
+#include <stdint.h>
+
+/**
+ * Marks the start of an EGL entry point or a callback from the driver.
+ *
+ * This must go at the end of the function's declarations. The entry point
+ * ends when the enclosing block does.
+ */
+#define X11_ROUNDTRIP_ENTRY(name) \
+    const char *_x11RoundTripPrev __attribute__((cleanup(eplX11RoundTripLeave))) \
+        = eplX11RoundTripEnter(name)
+
+/**
+ * Wraps an expression that waits for a reply from the server, such as an
+ * xcb_*_reply or xcb_request_check call, and returns its value.
+ */
+#define X11_ROUNDTRIP(expr) \
+    ({ \
+        uint64_t _x11RoundTripStart = eplX11RoundTripBegin(); \
+        __typeof__(expr) _x11RoundTripRet = (expr); \
+        eplX11RoundTripEnd(_x11RoundTripStart); \
+        _x11RoundTripRet; \
+    })
+
+/**
+ * Sets the current thread's entry point, and returns the previous one.
+ *
+ * Use X11_ROUNDTRIP_ENTRY instead of calling this directly.
+ */
+const char *eplX11RoundTripEnter(const char *name);
+
+/**
+ * Restores the previous entry point.
+ */
+void eplX11RoundTripLeave(const char **prev);
+
+/**
+ * Returns the start time for a blocking call, or 0 if profiling is disabled.
+ */
+uint64_t eplX11RoundTripBegin(void);
+
+/**
+ * Records a round trip that started at \p start.
+ */
+void eplX11RoundTripEnd(uint64_t start);
+
+#endif // X11_ROUNDTRIP_H
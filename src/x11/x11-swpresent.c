@@ -0,0 +1,425 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Software presentation using MIT-SHM or plain PutImage requests.
+ */
+
+#include "x11-swpresent.h"
+#include "x11-roundtrip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <xcb/shm.h>
+
+/**
+ * The number of image segments for each window.
+ *
+ * While the server is still reading one segment, we can fill in the next one.
+ */
+#define SOFTWARE_PRESENT_SEGMENTS 2
+
+/**
+ * The size of a PutImage request header, in bytes.
+ */
+static const uint32_t PUT_IMAGE_HEADER_SIZE = 24;
+
+/**
+ * A buffer that we copy an image into before sending it to the server.
+ */
+typedef struct
+{
+    /**
+     * The MIT-SHM segment, or zero if this is a malloc'ed buffer for plain
+     * PutImage requests.
+     */
+    xcb_shm_seg_t shmseg;
+
+    uint8_t *data;
+    size_t size;
+
+    /**
+     * If true, then the server might still be reading from this segment.
+     *
+     * In that case, \c fence is a GetInputFocus request that we sent after
+     * the last PutImage request that used it. The server processes requests
+     * in order, so once we get the reply, it's done with the segment.
+     */
+    EGLBoolean busy;
+    xcb_get_input_focus_cookie_t fence;
+} X11ImageSegment;
+
+struct _X11SoftwarePresent
+{
+    X11DisplayInstance *inst;
+    xcb_window_t xwin;
+    xcb_gcontext_t gc;
+    uint8_t depth;
+
+    uint32_t bytes_per_pixel;
+
+    /**
+     * The scanline padding for the window's depth, in bytes.
+     */
+    uint32_t scanline_pad;
+
+    /**
+     * The maximum size of a request, in bytes.
+     */
+    uint32_t max_request_size;
+
+    EGLBoolean use_shm;
+
+    X11ImageSegment segments[SOFTWARE_PRESENT_SEGMENTS];
+    int next_segment;
+};
+
+EGLBoolean eplX11CheckSoftwarePresentSHM(xcb_connection_t *conn)
+{
+    const xcb_query_extension_reply_t *extReply;
+    xcb_shm_query_version_reply_t *reply;
+    EGLBoolean ret = EGL_FALSE;
+
+    extReply = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (extReply == NULL || !extReply->present)
+    {
+        return EGL_FALSE;
+    }
+
+    reply = X11_ROUNDTRIP(xcb_shm_query_version_reply(conn, xcb_shm_query_version(conn), NULL));
+    if (reply != NULL)
+    {
+        ret = EGL_TRUE;
+        free(reply);
+    }
+    return ret;
+}
+
+static void FreeSegment(X11SoftwarePresent *sw, X11ImageSegment *seg)
+{
+    xcb_connection_t *conn = sw->inst->present_conn;
+
+    if (seg->busy)
+    {
+        if (conn != NULL)
+        {
+            xcb_discard_reply(conn, seg->fence.sequence);
+        }
+        seg->busy = EGL_FALSE;
+    }
+    if (seg->shmseg != 0)
+    {
+        if (conn != NULL)
+        {
+            xcb_shm_detach(conn, seg->shmseg);
+        }
+        shmdt(seg->data);
+        seg->shmseg = 0;
+    }
+    else
+    {
+        free(seg->data);
+    }
+    seg->data = NULL;
+    seg->size = 0;
+}
+
+static void WaitForSegment(X11SoftwarePresent *sw, X11ImageSegment *seg)
+{
+    if (seg->busy)
+    {
+        free(X11_ROUNDTRIP(xcb_get_input_focus_reply(sw->inst->present_conn, seg->fence, NULL)));
+        seg->busy = EGL_FALSE;
+    }
+}
+
+/**
+ * Allocates a shared memory segment and attaches it in the server.
+ */
+static EGLBoolean AllocSHMSegment(X11SoftwarePresent *sw, X11ImageSegment *seg, size_t size)
+{
+    xcb_void_cookie_t cookie;
+    xcb_generic_error_t *error;
+    void *data;
+    int shmid;
+
+    shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shmid < 0)
+    {
+        return EGL_FALSE;
+    }
+
+    data = shmat(shmid, NULL, 0);
+    if (data == (void *) -1)
+    {
+        shmctl(shmid, IPC_RMID, NULL);
+        return EGL_FALSE;
+    }
+
+    seg->shmseg = xcb_generate_id(sw->inst->present_conn);
+    cookie = xcb_shm_attach_checked(sw->inst->present_conn, seg->shmseg, shmid, 0);
+    error = X11_ROUNDTRIP(xcb_request_check(sw->inst->present_conn, cookie));
+
+    // The segment sticks around until both we and the server detach it, so
+    // we can mark it for deletion now.
+    shmctl(shmid, IPC_RMID, NULL);
+
+    if (error != NULL)
+    {
+        free(error);
+        shmdt(data);
+        seg->shmseg = 0;
+        return EGL_FALSE;
+    }
+
+    seg->data = data;
+    seg->size = size;
+    return EGL_TRUE;
+}
+
+static EGLBoolean AllocSegment(X11SoftwarePresent *sw, X11ImageSegment *seg, size_t size)
+{
+    if (seg->size >= size)
+    {
+        return EGL_TRUE;
+    }
+
+    FreeSegment(sw, seg);
+
+    if (sw->use_shm)
+    {
+        if (AllocSHMSegment(sw, seg, size))
+        {
+            return EGL_TRUE;
+        }
+
+        // If the server can't attach the segment (for example, if it's
+        // running on a different machine than we are), then stop trying and
+        // just use PutImage for this window.
+        sw->use_shm = EGL_FALSE;
+    }
+
+    seg->data = malloc(size);
+    if (seg->data == NULL)
+    {
+        return EGL_FALSE;
+    }
+    seg->size = size;
+    return EGL_TRUE;
+}
+
+X11SoftwarePresent *eplX11SoftwarePresentCreate(X11DisplayInstance *inst,
+        xcb_window_t xwin, uint8_t depth, const EplFormatInfo *fmt)
+{
+    const xcb_setup_t *setup = xcb_get_setup(inst->present_conn);
+    xcb_format_iterator_t formatIter;
+    X11SoftwarePresent *sw;
+    uint32_t scanlinePad = 0;
+    uint32_t maxRequest;
+
+    // Find the image format that the server uses for this depth. Our linear
+    // buffers have to match it, since we don't do any conversion.
+    for (formatIter = xcb_setup_pixmap_formats_iterator(setup);
+            formatIter.rem > 0;
+            xcb_format_next(&formatIter))
+    {
+        if (formatIter.data->depth == depth)
+        {
+            if (formatIter.data->bits_per_pixel == fmt->bpp)
+            {
+                scanlinePad = formatIter.data->scanline_pad / 8;
+            }
+            break;
+        }
+    }
+    if (scanlinePad == 0)
+    {
+        return NULL;
+    }
+
+    sw = calloc(1, sizeof(X11SoftwarePresent));
+    if (sw == NULL)
+    {
+        return NULL;
+    }
+
+    sw->inst = inst;
+    sw->xwin = xwin;
+    sw->depth = depth;
+    sw->bytes_per_pixel = fmt->bpp / 8;
+    sw->scanline_pad = scanlinePad;
+    sw->use_shm = inst->supports_shm;
+
+    maxRequest = xcb_get_maximum_request_length(inst->present_conn);
+    if (maxRequest > UINT32_MAX / 4)
+    {
+        maxRequest = UINT32_MAX / 4;
+    }
+    sw->max_request_size = maxRequest * 4;
+
+    sw->gc = xcb_generate_id(inst->present_conn);
+    xcb_create_gc(inst->present_conn, sw->gc, xwin, 0, NULL);
+
+    return sw;
+}
+
+void eplX11SoftwarePresentDestroy(X11SoftwarePresent *sw)
+{
+    if (sw != NULL)
+    {
+        int i;
+
+        for (i=0; i<SOFTWARE_PRESENT_SEGMENTS; i++)
+        {
+            FreeSegment(sw, &sw->segments[i]);
+        }
+        if (sw->inst->present_conn != NULL)
+        {
+            xcb_free_gc(sw->inst->present_conn, sw->gc);
+            xcb_flush(sw->inst->present_conn);
+        }
+        free(sw);
+    }
+}
+
+static void CopyRows(uint8_t *dst, uint32_t dst_stride,
+        const uint8_t *src, uint32_t src_stride,
+        uint32_t row_size, uint32_t rows)
+{
+    uint32_t i;
+
+    if (dst_stride == src_stride)
+    {
+        memcpy(dst, src, (size_t) src_stride * (rows - 1) + row_size);
+        return;
+    }
+
+    for (i=0; i<rows; i++)
+    {
+        memcpy(dst + (size_t) i * dst_stride, src + (size_t) i * src_stride, row_size);
+    }
+}
+
+EGLBoolean eplX11SoftwarePresentBuffer(X11SoftwarePresent *sw,
+        struct gbm_bo *gbo, const xcb_rectangle_t *rect)
+{
+    xcb_connection_t *conn = sw->inst->present_conn;
+    X11ImageSegment *seg;
+    uint32_t rowSize;
+    uint32_t dstStride;
+    uint32_t srcStride = 0;
+    uint32_t rowsPerRequest;
+    uint8_t *src;
+    void *mapData = NULL;
+    uint32_t row;
+    xcb_rectangle_t clipped = *rect;
+
+    // Clip the update region to the buffer, in case the window was resized
+    // since the caller computed it.
+    if (clipped.x >= gbm_bo_get_width(gbo) || clipped.y >= gbm_bo_get_height(gbo))
+    {
+        return EGL_TRUE;
+    }
+    if (clipped.x + clipped.width > gbm_bo_get_width(gbo))
+    {
+        clipped.width = gbm_bo_get_width(gbo) - clipped.x;
+    }
+    if (clipped.y + clipped.height > gbm_bo_get_height(gbo))
+    {
+        clipped.height = gbm_bo_get_height(gbo) - clipped.y;
+    }
+    rect = &clipped;
+
+    if (rect->width == 0 || rect->height == 0)
+    {
+        return EGL_TRUE;
+    }
+
+    rowSize = rect->width * sw->bytes_per_pixel;
+    dstStride = (rowSize + sw->scanline_pad - 1) & ~(sw->scanline_pad - 1);
+
+    // Figure out how many rows fit in a single PutImage request, in case we
+    // can't use MIT-SHM.
+    rowsPerRequest = (sw->max_request_size - PUT_IMAGE_HEADER_SIZE) / dstStride;
+    if (rowsPerRequest == 0)
+    {
+        rowsPerRequest = 1;
+    }
+    else if (rowsPerRequest > rect->height)
+    {
+        rowsPerRequest = rect->height;
+    }
+
+    seg = &sw->segments[sw->next_segment];
+    sw->next_segment = (sw->next_segment + 1) % SOFTWARE_PRESENT_SEGMENTS;
+    WaitForSegment(sw, seg);
+
+    if (!AllocSegment(sw, seg, (size_t) dstStride
+                * (sw->use_shm ? rect->height : rowsPerRequest)))
+    {
+        return EGL_FALSE;
+    }
+
+    src = gbm_bo_map(gbo, rect->x, rect->y, rect->width, rect->height,
+            GBM_BO_TRANSFER_READ, &srcStride, &mapData);
+    if (src == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    if (seg->shmseg != 0)
+    {
+        CopyRows(seg->data, dstStride, src, srcStride, rowSize, rect->height);
+        xcb_shm_put_image(conn, sw->xwin, sw->gc,
+                rect->width, rect->height, 0, 0, rect->width, rect->height,
+                rect->x, rect->y, sw->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                0, seg->shmseg, 0);
+    }
+    else
+    {
+        for (row = 0; row < rect->height; row += rowsPerRequest)
+        {
+            uint32_t rows = rect->height - row;
+            if (rows > rowsPerRequest)
+            {
+                rows = rowsPerRequest;
+            }
+
+            // Note that XCB has either copied or written out the data by the
+            // time xcb_put_image returns, so we can reuse the buffer right
+            // away.
+            CopyRows(seg->data, dstStride, src + (size_t) row * srcStride, srcStride,
+                    rowSize, rows);
+            xcb_put_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, sw->xwin, sw->gc,
+                    rect->width, rows, rect->x, rect->y + row, 0, sw->depth,
+                    dstStride * rows, seg->data);
+        }
+    }
+
+    gbm_bo_unmap(gbo, mapData);
+
+    seg->fence = xcb_get_input_focus(conn);
+    seg->busy = EGL_TRUE;
+    xcb_flush(conn);
+
+    return EGL_TRUE;
+}
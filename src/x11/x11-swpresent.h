@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef X11_SWPRESENT_H
+#define X11_SWPRESENT_H
+
+/**
+ * \file
+ *
+ * Software presentation for servers that don't support DRI3 and Present.
+ *
+ * In this mode, we still render into driver color buffers, and the normal
+ * PRIME path copies each frame into a pitch linear buffer. Instead of sharing
+ * that buffer with the server, though, we map it and upload the damaged part
+ * of it to the window with a PutImage request.
+ *
+ * If the server supports MIT-SHM and we're on a local connection, then the
+ * image goes through a small ring of shared memory segments. Otherwise, it
+ * goes through plain PutImage requests, split up as needed to fit within the
+ * server's maximum request size.
+ */
+
+#include <EGL/egl.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+#include <gbm.h>
+
+#include "x11-platform.h"
+
+typedef struct _X11SoftwarePresent X11SoftwarePresent;
+
+/**
+ * Checks whether the server supports MIT-SHM, and whether we can use it.
+ *
+ * This only checks the extension. Each window still falls back to plain
+ * PutImage requests if attaching a segment fails.
+ */
+EGLBoolean eplX11CheckSoftwarePresentSHM(xcb_connection_t *conn);
+
+/**
+ * Sets up software presentation for a window.
+ *
+ * \param inst The display instance.
+ * \param xwin The window.
+ * \param depth The depth of the window.
+ * \param fmt The format of the linear buffers that we'll present from.
+ * \return The new X11SoftwarePresent struct, or NULL on failure.
+ */
+X11SoftwarePresent *eplX11SoftwarePresentCreate(X11DisplayInstance *inst,
+        xcb_window_t xwin, uint8_t depth, const EplFormatInfo *fmt);
+
+void eplX11SoftwarePresentDestroy(X11SoftwarePresent *sw);
+
+/**
+ * Copies part of a linear buffer to the window.
+ *
+ * Rendering to \p gbo must already be finished. This returns once the image
+ * has been copied out of \p gbo, so the caller can reuse the buffer right
+ * away. The server may still be reading from the shared memory segment, but
+ * we'll wait for that before we reuse the segment.
+ *
+ * \param sw The X11SoftwarePresent struct.
+ * \param gbo The linear buffer to present from.
+ * \param rect The region to update, in window coordinates.
+ * \return EGL_TRUE on success, or EGL_FALSE if we couldn't map the buffer.
+ */
+EGLBoolean eplX11SoftwarePresentBuffer(X11SoftwarePresent *sw,
+        struct gbm_bo *gbo, const xcb_rectangle_t *rect);
+
+#endif // X11_SWPRESENT_H
@@ -54,10 +54,10 @@ EGLBoolean eplX11TimelineInit(X11DisplayInstance *inst, X11Timeline *timeline)
         return EGL_FALSE;
     }
 
-    timeline->xid = xcb_generate_id(inst->conn);
+    timeline->xid = xcb_generate_id(inst->present_conn);
     // Note that libxcb will close the file descriptor after it sends the
     // request, so we do *not* close it here.
-    inst->platform->priv->xcb.dri3_import_syncobj(inst->conn,
+    inst->platform->priv->xcb.dri3_import_syncobj(inst->present_conn,
             timeline->xid, inst->xscreen->root, fd);
     return EGL_TRUE;
 }
@@ -68,7 +68,7 @@ void eplX11TimelineDestroy(X11DisplayInstance *inst, X11Timeline *timeline)
     // called.
     if (timeline->xid != 0)
     {
-        inst->platform->priv->xcb.dri3_free_syncobj(inst->conn, timeline->xid);
+        inst->platform->priv->xcb.dri3_free_syncobj(inst->present_conn, timeline->xid);
         timeline->xid = 0;
 
         inst->platform->priv->drm.SyncobjDestroy(
@@ -148,3 +148,31 @@ done:
             tempobj);
     return success;
 }
+
+EGLBoolean eplX11TimelineSignalRendering(X11DisplayInstance *inst, X11Timeline *timeline)
+{
+    if (inst->platform->priv->egl.PlatformSignalSyncobjNVX == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    if (!inst->platform->priv->egl.PlatformSignalSyncobjNVX(inst->internal_display->edpy,
+                gbm_device_get_fd(inst->gbmdev), timeline->handle, timeline->point + 1))
+    {
+        return EGL_FALSE;
+    }
+
+    timeline->point++;
+    return EGL_TRUE;
+}
+
+EGLBoolean eplX11TimelineWaitGPU(X11DisplayInstance *inst, X11Timeline *timeline)
+{
+    if (inst->platform->priv->egl.PlatformWaitSyncobjNVX == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    return inst->platform->priv->egl.PlatformWaitSyncobjNVX(inst->internal_display->edpy,
+            gbm_device_get_fd(inst->gbmdev), timeline->handle, timeline->point);
+}
@@ -57,4 +57,25 @@ EGLBoolean eplX11TimelineAttachSyncFD(X11DisplayInstance *inst, X11Timeline *tim
  */
 int eplX11TimelinePointToSyncFD(X11DisplayInstance *inst, X11Timeline *timeline);
 
+/**
+ * Has the driver signal the next timeline point when the current context's
+ * rendering finishes, without going through a sync FD.
+ *
+ * On a successful return, \c timeline->point will be the new timeline point.
+ *
+ * \return EGL_TRUE on success, or EGL_FALSE if the driver doesn't support
+ *      eglPlatformSignalSyncobjNVX or if it failed. In that case, the caller
+ *      should fall back to eplX11TimelineAttachSyncFD.
+ */
+EGLBoolean eplX11TimelineSignalRendering(X11DisplayInstance *inst, X11Timeline *timeline);
+
+/**
+ * Makes the current context wait on the GPU for the current timeline point,
+ * without going through a sync FD.
+ *
+ * \return EGL_TRUE on success, or EGL_FALSE if the driver doesn't support
+ *      eglPlatformWaitSyncobjNVX or if it failed.
+ */
+EGLBoolean eplX11TimelineWaitGPU(X11DisplayInstance *inst, X11Timeline *timeline);
+
 #endif // X11_TIMELINE_H
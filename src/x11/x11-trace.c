@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Recording presentation traces.
+ */
+
+#include "x11-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "platform-utils.h"
+
+static const char *PRESENT_TRACE_ENV = "__NV_X11_EGL_PRESENT_TRACE";
+
+/**
+ * The size of the stdio buffer for the trace file.
+ *
+ * Records are small, so a large buffer keeps the tracing overhead down to a
+ * memcpy for most calls.
+ */
+static const size_t TRACE_BUFFER_SIZE = 64 * 1024;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+
+static void CloseTraceFile(void) __attribute__((destructor));
+
+/**
+ * Expands any "%p" in the trace file name to the process ID, so that each
+ * process in a multi-process app gets its own file.
+ */
+static char *ExpandTraceFileName(const char *name)
+{
+    size_t len = strlen(name);
+    char pid[32];
+    size_t pidLen;
+    char *ret;
+    size_t i, j;
+
+    pidLen = snprintf(pid, sizeof(pid), "%d", (int) getpid());
+
+    ret = malloc(len * pidLen + 1);
+    if (ret == NULL)
+    {
+        return NULL;
+    }
+
+    for (i=0, j=0; i<len; i++)
+    {
+        if (name[i] == '%' && name[i + 1] == 'p')
+        {
+            memcpy(ret + j, pid, pidLen);
+            j += pidLen;
+            i++;
+        }
+        else
+        {
+            ret[j++] = name[i];
+        }
+    }
+    ret[j] = '\0';
+
+    return ret;
+}
+
+static void OpenTraceFile(void)
+{
+    X11TraceHeader header;
+    const char *env;
+    char *name;
+
+    env = getenv(PRESENT_TRACE_ENV);
+    if (env == NULL || env[0] == '\0')
+    {
+        return;
+    }
+
+    name = ExpandTraceFileName(env);
+    if (name == NULL)
+    {
+        return;
+    }
+
+    trace_file = fopen(name, "wbe");
+    free(name);
+    if (trace_file == NULL)
+    {
+        return;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, X11_TRACE_MAGIC, sizeof(header.magic));
+    header.version = X11_TRACE_VERSION;
+    header.byte_order = 0x01020304;
+    if (fwrite(&header, sizeof(header), 1, trace_file) != 1)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+static void CloseTraceFile(void)
+{
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+int eplX11TraceEnabled(void)
+{
+    pthread_once(&trace_once, OpenTraceFile);
+    return (trace_file != NULL);
+}
+
+void eplX11TraceRecord(X11TraceType type, uint32_t window,
+        uint32_t serial, uint32_t value, uint64_t msc, uint16_t flags)
+{
+    if (!eplX11TraceEnabled())
+    {
+        return;
+    }
+
+    eplX11TraceRecordAt(eplGetMonotonicTime(), type, window, serial, value, msc, 0, flags);
+}
+
+void eplX11TraceRecordAt(uint64_t timestamp, X11TraceType type, uint32_t window,
+        uint32_t serial, uint32_t value, uint64_t msc, uint64_t duration, uint16_t flags)
+{
+    X11TraceRecord rec;
+
+    if (!eplX11TraceEnabled())
+    {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp = timestamp;
+    rec.msc = msc;
+    rec.duration = duration;
+    rec.window = window;
+    rec.serial = serial;
+    rec.value = value;
+    rec.type = type;
+    rec.flags = flags;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL)
+    {
+        fwrite(&rec, sizeof(rec), 1, trace_file);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
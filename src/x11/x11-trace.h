@@ -0,0 +1,216 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef X11_TRACE_H
+#define X11_TRACE_H
+
+/**
+ * \file
+ *
+ * Recording presentation traces.
+ *
+ * If the __NV_X11_EGL_PRESENT_TRACE environment variable is set to a file
+ * name, then we write a record for every present request, every Present event
+ * that we handle, and every time eglSwapBuffers has to wait for something.
+ * Any "%p" in the file name is replaced with the process ID.
+ *
+ * The file starts with an X11TraceHeader, followed by any number of
+ * X11TraceRecord structs. Everything is in the host's byte order, which the
+ * header's \c byte_order field records.
+ *
+ * The timestamps all come from CLOCK_MONOTONIC, so the records can be
+ * replayed with the same relative timing that they were captured with.
+ */
+
+#include <stdint.h>
+
+#define X11_TRACE_MAGIC "EGLX11TR"
+#define X11_TRACE_VERSION 2
+
+typedef enum
+{
+    /**
+     * The start of an eglSwapBuffers call.
+     */
+    X11_TRACE_SWAP_BEGIN = 1,
+
+    /**
+     * The end of an eglSwapBuffers call. \c value is 1 on success, or 0 on
+     * failure.
+     */
+    X11_TRACE_SWAP_END,
+
+    /**
+     * We sent a PresentPixmap request, or a PutImage request with software
+     * presentation.
+     *
+     * \c serial is the serial number, \c value is the Present options, and
+     * \c msc is the target MSC.
+     */
+    X11_TRACE_PRESENT,
+
+    /**
+     * A PresentConfigureNotify event. \c value is the width in the high 16
+     * bits and the height in the low 16 bits. \c flags is the pixmap_flags
+     * field.
+     */
+    X11_TRACE_CONFIGURE_NOTIFY,
+
+    /**
+     * A PresentIdleNotify event. \c serial is the serial number, and \c value
+     * is the pixmap XID.
+     */
+    X11_TRACE_IDLE_NOTIFY,
+
+    /**
+     * A PresentCompleteNotify event. \c serial is the serial number, \c msc is
+     * the MSC, and \c value is the completion mode.
+     */
+    X11_TRACE_COMPLETE_NOTIFY,
+
+    /**
+     * eglSwapBuffers started waiting for a free color buffer. \c value is
+     * the number of buffers in the list that it's waiting on.
+     *
+     * In the matching X11_TRACE_BUFFER_WAIT_END record, \c serial is the
+     * last present serial of the buffer that freed up.
+     */
+    X11_TRACE_BUFFER_WAIT_BEGIN,
+    X11_TRACE_BUFFER_WAIT_END,
+
+    /**
+     * eglSwapBuffers started waiting for pending frames to complete. \c value
+     * is the number of pending frames.
+     */
+    X11_TRACE_FRAME_WAIT_BEGIN,
+    X11_TRACE_FRAME_WAIT_END,
+
+    /**
+     * Rendering for a frame finished on the GPU.
+     *
+     * The timestamp is the time that the frame's acquire fence signaled,
+     * which we read from the sync file afterward, so this record can show up
+     * in the file after later records. \c serial is the present serial, and
+     * \c duration is how long after the start of eglSwapBuffers rendering
+     * finished, or 0 if it finished before then.
+     */
+    X11_TRACE_RENDER_DONE,
+
+    /**
+     * The server released the buffer for a frame.
+     *
+     * The timestamp is the time that the buffer's release fence signaled.
+     * Like X11_TRACE_RENDER_DONE, it's written after the fact. \c serial is
+     * the present serial, and \c duration is the time from when we sent the
+     * present request until the release fence signaled.
+     */
+    X11_TRACE_RELEASE,
+
+    /**
+     * eglSwapBuffers finished waiting for the frame rate limiter.
+     *
+     * \c serial is the serial number that the next present will use,
+     * \c value is the achieved frame rate in millihertz, and \c duration is
+     * the jitter in the frame interval. Both are running averages.
+     */
+    X11_TRACE_FRAME_LIMIT,
+
+    /**
+     * eglSwapBuffers skipped presenting a frame because the window isn't
+     * visible. \c serial is the serial number of the last present.
+     */
+    X11_TRACE_HIDDEN_SKIP,
+
+    /**
+     * A PresentCompleteNotify event didn't fit the window's MSC history,
+     * most likely because the window moved to a different CRTC, so we threw
+     * out the measured refresh period.
+     *
+     * \c serial is the event's serial number, \c msc is its MSC, and
+     * \c value is the old refresh period in microseconds.
+     */
+    X11_TRACE_MSC_REBASE,
+} X11TraceType;
+
+/**
+ * Flags for X11_TRACE_PRESENT records.
+ */
+#define X11_TRACE_FLAG_EXPLICIT_SYNC (1 << 0)
+#define X11_TRACE_FLAG_PRIME (1 << 1)
+#define X11_TRACE_FLAG_SOFTWARE (1 << 2)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+
+    /**
+     * 0x01020304, written in the host's byte order.
+     */
+    uint32_t byte_order;
+} X11TraceHeader;
+
+typedef struct
+{
+    /**
+     * The CLOCK_MONOTONIC time in nanoseconds.
+     */
+    uint64_t timestamp;
+
+    /**
+     * The MSC value, if the record has one.
+     */
+    uint64_t msc;
+
+    /**
+     * A time interval in nanoseconds, if the record has one.
+     */
+    uint64_t duration;
+
+    /**
+     * The window XID.
+     */
+    uint32_t window;
+    uint32_t serial;
+    uint32_t value;
+    uint16_t type;
+    uint16_t flags;
+} X11TraceRecord;
+
+/**
+ * Writes a trace record, if tracing is enabled.
+ *
+ * This is cheap to call if tracing is disabled.
+ */
+void eplX11TraceRecord(X11TraceType type, uint32_t window,
+        uint32_t serial, uint32_t value, uint64_t msc, uint16_t flags);
+
+/**
+ * Writes a trace record with a timestamp and duration that the caller
+ * supplies.
+ */
+void eplX11TraceRecordAt(uint64_t timestamp, X11TraceType type, uint32_t window,
+        uint32_t serial, uint32_t value, uint64_t msc, uint64_t duration, uint16_t flags);
+
+/**
+ * Returns true if tracing is enabled.
+ *
+ * This lets callers skip collecting data that's only needed for the trace.
+ */
+int eplX11TraceEnabled(void);
+
+#endif // X11_TRACE_H
@@ -32,14 +32,21 @@
 #include <GL/gl.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/sync.h>
 
+#include <X11/xshmfence.h>
 #include <xf86drm.h>
 
 #include "x11-platform.h"
 #include "x11-timeline.h"
+#include "x11-profile.h"
+#include "x11-swpresent.h"
+#include "x11-trace.h"
+#include "x11-roundtrip.h"
 #include "glvnd_list.h"
 #include "dma-buf.h"
 
@@ -51,9 +58,21 @@
 #define PRESENT_WINDOW_DESTROYED_FLAG (1 << 0)
 
 /**
- * The maximum number of color buffers to allocate for a window.
+ * The default maximum number of color buffers to allocate for a window.
+ *
+ * This can be overridden with a profile. See x11-profile.h.
+ */
+static const int DEFAULT_MAX_COLOR_BUFFERS = 4;
+
+/**
+ * The default maximum number of color buffers for a window that uses idle
+ * fences instead of implicit or explicit sync.
+ *
+ * With an idle fence, we know exactly when the server is finished with a
+ * buffer, so we don't need an extra buffer in flight to make it less likely
+ * that we start rendering to one that's still in use.
  */
-static const int MAX_COLOR_BUFFERS = 4;
+static const int IDLE_FENCE_MAX_COLOR_BUFFERS = 3;
 
 /**
  * The maximum number of linear buffers for PRIME presentation.
@@ -61,8 +80,58 @@ static const int MAX_COLOR_BUFFERS = 4;
 static const int MAX_PRIME_BUFFERS = 2;
 
 /**
- * The maximum number of outstanding PresentPixmap requests that we can have
- * before we wait for one to complete in eglSwapBuffers.
+ * The maximum number of color buffers to keep in a display's buffer pool.
+ *
+ * Most windows free two buffers when they're destroyed, so this is enough to
+ * cover a couple of short-lived windows at a time.
+ */
+static const int MAX_POOLED_BUFFERS = 4;
+
+/**
+ * The range of refresh periods that we'll accept when we measure the refresh
+ * rate from PresentCompleteNotify events, in nanoseconds. Anything outside of
+ * this is most likely a timing glitch.
+ */
+static const uint64_t MIN_REFRESH_PERIOD = 1000000ULL;
+static const uint64_t MAX_REFRESH_PERIOD = 100000000ULL;
+
+/**
+ * The refresh period to assume, in nanoseconds, before we've measured the
+ * real one.
+ */
+static const uint64_t DEFAULT_REFRESH_PERIOD = 16666667ULL;
+
+/**
+ * How often to check whether a window is viewable, in nanoseconds, if the
+ * window has a frame rate for when it's hidden.
+ */
+static const uint64_t VISIBILITY_POLL_INTERVAL = 250000000ULL;
+
+/**
+ * The number of recent frames to keep GPU timestamps for.
+ */
+#define FRAME_TIMING_HISTORY 8
+
+/**
+ * The number of outstanding present IDs that we keep track of. This only
+ * needs to cover the frames that can be in flight at once.
+ */
+#define PRESENT_ID_HISTORY 16
+
+/**
+ * The longest that eglWaitForPresentNVX will sleep before checking for events
+ * again, in nanoseconds.
+ *
+ * Another thread might read our events off of the connection, in which case
+ * polling the socket won't wake us up, so we need an upper bound here.
+ */
+static const uint64_t PRESENT_WAIT_POLL_INTERVAL = 2000000ULL;
+
+/**
+ * The default maximum number of outstanding PresentPixmap requests that we
+ * can have before we wait for one to complete in eglSwapBuffers.
+ *
+ * This can be overridden with a profile. See x11-profile.h.
  */
 static const uint32_t MAX_PENDING_FRAMES = 1;
 
@@ -148,9 +217,93 @@ typedef struct
      */
     X11Timeline timeline;
 
+    /**
+     * An idle fence for the pixmap, which the server triggers once it's
+     * finished with the buffer.
+     *
+     * This is only used if we don't have explicit or implicit sync. In that
+     * case, we reset the fence and send it along with each PresentPixmap
+     * request, and then wait for it before we reuse the buffer.
+     */
+    struct xshmfence *idle_fence;
+    xcb_sync_fence_t idle_fence_xid;
+
+    /**
+     * The shared memory file for \c idle_fence, or -1.
+     *
+     * CheckBufferReleaseNoSync maps its own copy of the fence from this, so
+     * that the fence stays valid while it waits without the window locked,
+     * even if another thread frees the buffer in the meantime.
+     */
+    int idle_fence_fd;
+
+    /**
+     * The format and usage that the buffer was allocated with.
+     *
+     * This is only set for the color buffers that we render to, not for
+     * PRIME buffers. It's used to match buffers in the display's buffer pool
+     * against new windows.
+     */
+    const EplFormatInfo *fmt;
+    EGLBoolean scanout;
+
+    /**
+     * The serial number of the last present that used this buffer, for
+     * looking up its entry in X11Window::frame_timings.
+     *
+     * Unlike \c last_present_serial, this doesn't get cleared when the
+     * buffer goes idle.
+     */
+    uint32_t timing_serial;
+
     struct glvnd_list entry;
 } X11ColorBuffer;
 
+/**
+ * Timestamps for one frame that we've presented.
+ *
+ * The render and release times come from the signal timestamps of the
+ * frame's acquire and release fences. We hold on to the sync files and read
+ * them once they've signaled, so collecting these doesn't need any extra
+ * waits or GL timer queries.
+ */
+typedef struct
+{
+    /**
+     * The present serial number, or 0 if this entry is unused.
+     */
+    uint32_t serial;
+
+    /**
+     * The times that eglSwapBuffers was called and that we sent the present
+     * request to the server. The trace records for the render and release
+     * times are relative to these. See X11_TRACE_RENDER_DONE and
+     * X11_TRACE_RELEASE.
+     */
+    uint64_t swap_time;
+    uint64_t present_time;
+
+    /**
+     * The times that rendering finished and that the server released the
+     * buffer, or 0 if we don't know yet.
+     */
+    uint64_t render_done_time;
+    uint64_t release_time;
+
+    /**
+     * The sync files for the acquire and release fences, or -1 if we've
+     * already read them or don't have them.
+     */
+    int acquire_fd;
+    int release_fd;
+
+    /**
+     * True once the buffer has been released, even if we couldn't get a
+     * release fence for it.
+     */
+    EGLBoolean released;
+} X11FrameTiming;
+
 /**
  * Data that we need to keep track of for an X window.
  */
@@ -182,6 +335,12 @@ typedef struct
      */
     pthread_mutex_t mutex;
 
+    /**
+     * The presentation settings for this window, which come from the defaults
+     * and any matching profiles.
+     */
+    X11PresentPolicy policy;
+
     /**
      * The capabilities of the window, as reported by PresentQueryCapabilities.
      */
@@ -231,6 +390,7 @@ typedef struct
      */
     EGLBoolean needs_modifier_check;
 
+
     /**
      * If this is non-zero, then ignore the update callback.
      *
@@ -295,16 +455,291 @@ typedef struct
      */
     uint64_t last_complete_msc;
 
+    /**
+     * The UST value (in microseconds) from the last PresentCompleteNotify
+     * event that we received.
+     */
+    uint64_t last_complete_ust;
+
+    /**
+     * The measured refresh period in nanoseconds, or 0 if we don't know it
+     * yet.
+     *
+     * This is a running average of the UST difference between
+     * PresentCompleteNotify events, divided by the MSC difference.
+     */
+    uint64_t refresh_period;
+
+    /**
+     * If true, then the window is using variable refresh presentation. See
+     * SetVariableRefresh.
+     */
+    EGLBoolean vrr;
+
+    /**
+     * The shortest refresh period that we've seen, in nanoseconds, or 0 if
+     * we don't know it yet.
+     *
+     * With variable refresh, the refresh period follows the frame rate, so
+     * the average doesn't tell us much. The shortest one is our best guess
+     * for the display's maximum refresh rate.
+     */
+    uint64_t min_refresh_period;
+
     /**
      * Set to true if the native window was destroyed.
      *
      * This requires a fairly recent version of the X server.
      */
     EGLBoolean native_destroyed;
+
+    /**
+     * State for software presentation, or NULL if we're using Present.
+     *
+     * With software presentation, we don't get any Present events, so
+     * \c present_event is NULL, and a frame counts as complete as soon as
+     * we've sent the image to the server.
+     */
+    X11SoftwarePresent *software;
+
+    /**
+     * The region of the window to update in the next software present.
+     */
+    xcb_rectangle_t software_damage;
+
+    /**
+     * Set when the color buffers are reallocated, so that the next software
+     * present updates the whole window regardless of the damage region.
+     */
+    EGLBoolean software_full_damage;
+
+    /**
+     * Without PresentConfigureNotify events, we have to poll for the window
+     * size. We send a GetGeometry request in each eglSwapBuffers call, and
+     * then pick up the reply in the next one, so that we don't need a round
+     * trip for every frame.
+     */
+    xcb_get_geometry_cookie_t software_geom_cookie;
+    EGLBoolean software_geom_pending;
+
+    /**
+     * State for deferred presentation.
+     *
+     * If the driver doesn't support EGL_ANDROID_native_fence_sync, then we
+     * don't have any way to pass a fence to the server. Rather than calling
+     * glFinish in eglSwapBuffers, we create an EGL_KHR_fence_sync object, and
+     * then a helper thread waits for the fence and sends the PresentPixmap
+     * request. That way, the application can start on the next frame while
+     * the GPU is still finishing the current one.
+     *
+     * The same thread also sends coalesced front buffer presents. See
+     * WindowDamageCallback.
+     *
+     * The fields in here are protected by \c deferred.mutex, not by the
+     * window's mutex, except for \c thread_started, which is only accessed
+     * with the window's mutex held, or during teardown.
+     *
+     * The helper thread takes the window's mutex to send the PresentPixmap
+     * request, so it must not call into the driver or GBM while holding it.
+     * It waits for fences before taking the mutex, and software presents are
+     * never deferred, since those have to map the buffer through GBM. See
+     * SyncRendering.
+     */
+    struct
+    {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        pthread_t thread;
+        EGLBoolean thread_started;
+        EGLBoolean quit;
+
+        /**
+         * The fence for the pending present, or EGL_NO_SYNC if there isn't
+         * one.
+         */
+        EGLSync sync;
+        X11ColorBuffer *buffer;
+        uint32_t options;
+
+        /**
+         * If true, then the window's buffers were reallocated while a
+         * present was pending, so the helper thread owns \c buffer and must
+         * free it once it's done.
+         */
+        EGLBoolean free_buffer;
+        uint64_t present_id;
+
+        /**
+         * The time to send the next coalesced front buffer present, or 0 if
+         * there isn't one scheduled.
+         */
+        uint64_t front_deadline;
+    } deferred;
+
+    /**
+     * State for coalescing front buffer presents.
+     *
+     * With front buffer rendering, the driver calls WindowDamageCallback on
+     * every flush. Rather than sending a copy of the whole window for each
+     * one, we send at most one present per refresh, and merge any flushes
+     * that happen in between into the next one.
+     *
+     * These fields are protected by the window's mutex.
+     */
+    struct
+    {
+        /**
+         * True if there's damage that we haven't sent to the server yet.
+         */
+        EGLBoolean pending;
+
+        /**
+         * The fence from the latest flush, or -1. Rendering from the same
+         * context finishes in order, so the latest fence covers all of the
+         * earlier ones.
+         *
+         * This is only used without explicit sync. With explicit sync, the
+         * fence is attached to the buffer's timeline in WindowDamageCallback
+         * instead.
+         */
+        int syncfd;
+
+        /**
+         * Incremented each time \c syncfd is replaced, so that the deferred
+         * present thread can tell whether the fence that it waited for is
+         * still the latest one.
+         */
+        unsigned int syncfd_serial;
+
+        /**
+         * The serial number and time of the last front buffer present.
+         */
+        uint32_t last_serial;
+        uint64_t last_time;
+    } front;
+
+    /**
+     * Timestamps for recently presented frames, in a ring buffer.
+     *
+     * These are only collected when tracing is enabled, and each entry is
+     * written to the trace once all of its timestamps are known. See
+     * x11-trace.h.
+     */
+    X11FrameTiming frame_timings[FRAME_TIMING_HISTORY];
+    int frame_timing_next;
+
+    /**
+     * Present IDs for EGL_NVX_present_wait.
+     *
+     * Every eglSwapBuffers call that presents a frame gets the next ID, and
+     * \c pending maps the IDs of frames that haven't completed yet to their
+     * present serial numbers, in a ring buffer.
+     */
+    struct
+    {
+        /**
+         * The ID of the last frame that eglSwapBuffers presented, or 0.
+         */
+        uint64_t last;
+
+        /**
+         * The ID of the last frame that's completed.
+         */
+        uint64_t complete;
+
+        struct
+        {
+            uint64_t id;
+            uint32_t serial;
+        } pending[PRESENT_ID_HISTORY];
+        unsigned int first;
+        unsigned int count;
+    } present_ids;
+
+    /**
+     * The acquire fence from SyncRendering for the frame that's about to be
+     * presented, or -1.
+     */
+    int timing_acquire_fd;
+
+    /**
+     * The time that the current eglSwapBuffers call started.
+     */
+    uint64_t swap_time;
+
+    /**
+     * State for the frame rate limiter. See LimitFrameRate.
+     */
+    struct
+    {
+        /**
+         * The ideal time for the next frame, or 0 if we haven't started
+         * yet.
+         */
+        uint64_t next_deadline;
+
+        /**
+         * The time that the last frame went out.
+         */
+        uint64_t last_frame;
+
+        /**
+         * Running averages of the frame interval and of its deviation, in
+         * nanoseconds.
+         */
+        uint64_t avg_interval;
+        uint64_t jitter;
+    } limiter;
+
+    /**
+     * Visibility tracking, for windows that have a hidden frame rate. See
+     * CheckWindowVisible.
+     */
+    struct
+    {
+        /**
+         * Whether the window was viewable (mapped, along with all of its
+         * ancestors) as of the last GetWindowAttributes reply from
+         * CheckWindowVisible. This starts out as true, so that we never skip
+         * a frame until we've actually heard from the server.
+         */
+        EGLBoolean viewable;
+
+        /**
+         * The state from the last VisibilityNotify event. This is protected
+         * by X11DisplayInstance::visibility_mutex.
+         */
+        uint8_t state;
+
+        /**
+         * True if the window is in X11DisplayInstance::visibility_windows.
+         */
+        EGLBoolean tracking_events;
+        struct glvnd_list entry;
+
+        xcb_get_window_attributes_cookie_t attrib_cookie;
+        EGLBoolean attrib_pending;
+        uint64_t last_poll;
+
+        /**
+         * Whether the last eglSwapBuffers call skipped presenting.
+         */
+        EGLBoolean hidden;
+    } visibility;
 } X11Window;
 
 static void FreeColorBuffer(X11DisplayInstance *inst, X11ColorBuffer *buffer)
 {
+    if (buffer != NULL && inst->platform->exiting)
+    {
+        // The process is exiting, so the kernel and the server will free
+        // everything else, and the driver has already torn down the internal
+        // display. Don't bother sending a pile of FreePixmap and
+        // FreeSyncobj requests or destroying each BO.
+        free(buffer);
+        return;
+    }
+
     if (buffer != NULL)
     {
         if (buffer->gbo != NULL)
@@ -318,12 +753,24 @@ static void FreeColorBuffer(X11DisplayInstance *inst, X11ColorBuffer *buffer)
         }
         if (buffer->xpix != 0)
         {
-            if (inst->conn != NULL)
+            if (inst->present_conn != NULL)
             {
                 // TODO: Is it safe to call into xcb if this happens during teardown?
-                xcb_free_pixmap(inst->conn, buffer->xpix);
+                xcb_free_pixmap(inst->present_conn, buffer->xpix);
             }
         }
+        if (buffer->idle_fence_xid != 0 && inst->present_conn != NULL)
+        {
+            xcb_sync_destroy_fence(inst->present_conn, buffer->idle_fence_xid);
+        }
+        if (buffer->idle_fence != NULL)
+        {
+            xshmfence_unmap_shm(buffer->idle_fence);
+        }
+        if (buffer->idle_fence_fd >= 0)
+        {
+            close(buffer->idle_fence_fd);
+        }
         eplX11TimelineDestroy(inst, &buffer->timeline);
         if (buffer->fd >= 0)
         {
@@ -361,6 +808,7 @@ static X11ColorBuffer *AllocOneColorBuffer(X11DisplayInstance *inst,
 
     glvnd_list_init(&buffer->entry);
     buffer->fd = -1;
+    buffer->idle_fence_fd = -1;
 
     buffer->gbo = gbm_bo_create_with_modifiers2(inst->gbmdev,
             width, height, fmt->fourcc, modifiers, num_modifiers, flags);
@@ -386,6 +834,9 @@ static X11ColorBuffer *AllocOneColorBuffer(X11DisplayInstance *inst,
         goto done;
     }
 
+    buffer->fmt = fmt;
+    buffer->scanout = scanout;
+
 done:
     if (fd >= 0)
     {
@@ -420,6 +871,7 @@ static X11ColorBuffer *AllocatePrimeBuffer(X11DisplayInstance *inst,
 
     glvnd_list_init(&buffer->entry);
     buffer->fd = -1;
+    buffer->idle_fence_fd = -1;
 
     buffer->buffer = inst->platform->priv->egl.PlatformAllocColorBufferNVX(inst->internal_display->edpy,
                 width, height, fourcc, DRM_FORMAT_MOD_LINEAR, EGL_TRUE);
@@ -464,71 +916,325 @@ done:
     return buffer;
 }
 
-static void FreeWindowBuffers(EplSurface *surf)
+/**
+ * Checks if a buffer is waiting in the deferred present thread. If it is, then
+ * the thread takes ownership of the buffer, and will free it after it sends
+ * the PresentPixmap request.
+ *
+ * \return EGL_TRUE if the deferred present thread now owns the buffer.
+ */
+static EGLBoolean DetachDeferredBuffer(X11Window *pwin, X11ColorBuffer *buffer)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
+    EGLBoolean detached = EGL_FALSE;
 
-    while (!glvnd_list_is_empty(&pwin->color_buffers))
+    if (pwin->deferred.thread_started)
     {
-        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->color_buffers, X11ColorBuffer, entry);
-        glvnd_list_del(&buffer->entry);
-        FreeColorBuffer(pwin->inst, buffer);
+        pthread_mutex_lock(&pwin->deferred.mutex);
+        if (pwin->deferred.sync != EGL_NO_SYNC && pwin->deferred.buffer == buffer)
+        {
+            pwin->deferred.free_buffer = EGL_TRUE;
+            detached = EGL_TRUE;
+        }
+        pthread_mutex_unlock(&pwin->deferred.mutex);
     }
-    while (!glvnd_list_is_empty(&pwin->prime_buffers))
+
+    return detached;
+}
+
+/**
+ * Checks whether the server is finished with a buffer, without waiting.
+ */
+static EGLBoolean IsBufferReleased(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    if (buffer->status == BUFFER_STATUS_IDLE)
     {
-        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->prime_buffers, X11ColorBuffer, entry);
-        glvnd_list_del(&buffer->entry);
-        FreeColorBuffer(pwin->inst, buffer);
+        return EGL_TRUE;
     }
-    pwin->current_front = NULL;
-    pwin->current_back = NULL;
-    pwin->current_prime = NULL;
+
+    if (pwin->use_explicit_sync)
+    {
+        // The buffer's current timeline point is the release point for the
+        // last PresentPixmapSynced request.
+        return (pwin->inst->platform->priv->drm.SyncobjTimelineWait(
+                    gbm_device_get_fd(pwin->inst->gbmdev),
+                    &buffer->timeline.handle, &buffer->timeline.point, 1,
+                    0, 0, NULL) == 0);
+    }
+    else if (buffer->idle_fence != NULL)
+    {
+        return (xshmfence_query(buffer->idle_fence) != 0);
+    }
+
+    // With implicit sync, we'd need a PresentIdleNotify event to know that
+    // the buffer is free, and we won't get one now.
+    return EGL_FALSE;
 }
 
-static EGLBoolean AllocWindowBuffers(EplSurface *surf,
-        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime)
+/**
+ * Adds a color buffer from a window that's being destroyed to the display's
+ * buffer pool. If the pool is full, then this frees the oldest buffer in it.
+ *
+ * \return EGL_TRUE if the pool took the buffer, or EGL_FALSE if the caller
+ *      should free it.
+ */
+static EGLBoolean PoolColorBuffer(X11Window *pwin, X11ColorBuffer *buffer)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    uint64_t modifier;
-    X11ColorBuffer *front = NULL;
-    X11ColorBuffer *back = NULL;
-    X11ColorBuffer *shared = NULL;
-    EGLPlatformColorBufferNVX sharedBuf = NULL;
-    EGLBoolean success = EGL_TRUE;
+    X11DisplayInstance *inst = pwin->inst;
+    X11ColorBuffer *evict = NULL;
 
-    front = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
-            modifiers, num_modifiers, !prime);
-    if (front == NULL)
+    if (buffer->fmt == NULL || inst->present_conn == NULL || !IsBufferReleased(pwin, buffer))
     {
-        goto done;
+        return EGL_FALSE;
     }
 
-    // We let the driver pick the modifier when we allocate the front buffer,
-    // and then we'll just re-use that same modifier for everything after that.
-    modifier = gbm_bo_get_modifier(front->gbo);
+    buffer->status = BUFFER_STATUS_IDLE;
+    buffer->last_present_serial = 0;
+    buffer->timing_serial = 0;
 
-    back = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
-            &modifier, 1, !prime);
-    if (back == NULL)
+    pthread_mutex_lock(&inst->buffer_pool_mutex);
+    glvnd_list_add(&buffer->entry, &inst->buffer_pool);
+    if (inst->buffer_pool_count < MAX_POOLED_BUFFERS)
     {
-        goto done;
+        inst->buffer_pool_count++;
+    }
+    else
+    {
+        evict = glvnd_list_last_entry(&inst->buffer_pool, X11ColorBuffer, entry);
+        glvnd_list_del(&evict->entry);
     }
+    pthread_mutex_unlock(&inst->buffer_pool_mutex);
 
-    if (prime)
+    FreeColorBuffer(inst, evict);
+    return EGL_TRUE;
+}
+
+/**
+ * Looks for a buffer in the display's buffer pool that a window can use.
+ *
+ * Besides the size, format, and modifier, a buffer that already has a shared
+ * pixmap also needs whatever sync objects the window will use with it, since
+ * CreateSharedPixmap only sets those up for new pixmaps.
+ */
+static X11ColorBuffer *TakePooledColorBuffer(X11Window *pwin,
+        const EplFormatInfo *fmt, uint32_t width, uint32_t height,
+        const uint64_t *modifiers, int num_modifiers,
+        EGLBoolean scanout)
+{
+    X11DisplayInstance *inst = pwin->inst;
+    X11ColorBuffer *buffer;
+    X11ColorBuffer *found = NULL;
+
+    pthread_mutex_lock(&inst->buffer_pool_mutex);
+    glvnd_list_for_each_entry(buffer, &inst->buffer_pool, entry)
     {
-        /*
-         * For PRIME, we need to allocate one linear buffer so that we can
-         * attach it as the blit target.
-         */
-        shared = AllocatePrimeBuffer(pwin->inst, pwin->format->fmt->fourcc, pwin->pending_width, pwin->pending_height);
-        if (shared == NULL)
+        uint64_t modifier;
+        int i;
+
+        if (buffer->fmt != fmt || buffer->scanout != scanout
+                || gbm_bo_get_width(buffer->gbo) != width
+                || gbm_bo_get_height(buffer->gbo) != height)
         {
-            goto done;
+            continue;
         }
-        sharedBuf = shared->buffer;
-    }
 
-    if (surf->internal_surface != EGL_NO_SURFACE)
+        if (buffer->xpix != 0)
+        {
+            if (pwin->use_explicit_sync && buffer->timeline.xid == 0)
+            {
+                continue;
+            }
+            if (!pwin->use_explicit_sync && !inst->supports_implicit_sync
+                    && buffer->idle_fence == NULL)
+            {
+                continue;
+            }
+        }
+
+        modifier = gbm_bo_get_modifier(buffer->gbo);
+        for (i=0; i<num_modifiers; i++)
+        {
+            if (modifiers[i] == modifier)
+            {
+                found = buffer;
+                break;
+            }
+        }
+        if (found != NULL)
+        {
+            glvnd_list_del(&found->entry);
+            inst->buffer_pool_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&inst->buffer_pool_mutex);
+
+    return found;
+}
+
+/**
+ * Returns a color buffer for a window, either from the display's buffer pool
+ * or by allocating a new one.
+ */
+static X11ColorBuffer *AcquireColorBuffer(X11Window *pwin,
+        const EplFormatInfo *fmt, uint32_t width, uint32_t height,
+        const uint64_t *modifiers, int num_modifiers,
+        EGLBoolean scanout)
+{
+    X11ColorBuffer *buffer = TakePooledColorBuffer(pwin, fmt, width, height,
+            modifiers, num_modifiers, scanout);
+    if (buffer != NULL)
+    {
+        return buffer;
+    }
+
+    return AllocOneColorBuffer(pwin->inst, fmt, width, height,
+            modifiers, num_modifiers, scanout);
+}
+
+void eplX11FreeBufferPool(X11DisplayInstance *inst)
+{
+    pthread_mutex_lock(&inst->buffer_pool_mutex);
+    while (!glvnd_list_is_empty(&inst->buffer_pool))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&inst->buffer_pool, X11ColorBuffer, entry);
+        glvnd_list_del(&buffer->entry);
+        FreeColorBuffer(inst, buffer);
+    }
+    inst->buffer_pool_count = 0;
+    pthread_mutex_unlock(&inst->buffer_pool_mutex);
+}
+
+/**
+ * Frees all of a window's buffers.
+ *
+ * \param surf The surface.
+ * \param pool If true, then add any idle color buffers to the display's
+ *      buffer pool instead of freeing them.
+ */
+static void FreeWindowBuffers(EplSurface *surf, EGLBoolean pool)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    while (!glvnd_list_is_empty(&pwin->color_buffers))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->color_buffers, X11ColorBuffer, entry);
+        glvnd_list_del(&buffer->entry);
+        if (DetachDeferredBuffer(pwin, buffer))
+        {
+            continue;
+        }
+        if (!pool || !PoolColorBuffer(pwin, buffer))
+        {
+            FreeColorBuffer(pwin->inst, buffer);
+        }
+    }
+    while (!glvnd_list_is_empty(&pwin->prime_buffers))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->prime_buffers, X11ColorBuffer, entry);
+        glvnd_list_del(&buffer->entry);
+        if (!DetachDeferredBuffer(pwin, buffer))
+        {
+            FreeColorBuffer(pwin->inst, buffer);
+        }
+    }
+    pwin->current_front = NULL;
+    pwin->current_back = NULL;
+    pwin->current_prime = NULL;
+}
+
+/**
+ * Allocates the PRIME linear buffer for a window and attaches it as the blit
+ * target, if the window doesn't have one yet.
+ *
+ * eglCreateWindowSurface doesn't allocate one, so this gets called from the
+ * update callback instead. If eglSwapBuffers gets there first, then it
+ * allocates one through GetFreeBuffer.
+ */
+static EGLBoolean AttachPrimeBuffer(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11ColorBuffer *shared;
+
+    if (!pwin->prime || pwin->current_prime != NULL
+            || surf->internal_surface == EGL_NO_SURFACE)
+    {
+        return EGL_TRUE;
+    }
+
+    shared = AllocatePrimeBuffer(pwin->inst, pwin->format->fmt->fourcc, pwin->width, pwin->height);
+    if (shared == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    {
+        EGLAttrib buffers[] =
+        {
+            GL_FRONT, (EGLAttrib) pwin->current_front->buffer,
+            GL_BACK,  (EGLAttrib) pwin->current_back->buffer,
+            EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX, (EGLAttrib) shared->buffer,
+            EGL_NONE
+        };
+        if (!pwin->inst->platform->priv->egl.PlatformSetColorBuffersNVX(pwin->inst->internal_display->edpy,
+                surf->internal_surface, buffers))
+        {
+            FreeColorBuffer(pwin->inst, shared);
+            return EGL_FALSE;
+        }
+    }
+
+    glvnd_list_append(&shared->entry, &pwin->prime_buffers);
+    pwin->current_prime = shared;
+    return EGL_TRUE;
+}
+
+static EGLBoolean AllocWindowBuffers(EplSurface *surf,
+        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t modifier;
+    X11ColorBuffer *front = NULL;
+    X11ColorBuffer *back = NULL;
+    X11ColorBuffer *shared = NULL;
+    EGLPlatformColorBufferNVX sharedBuf = NULL;
+    EGLBoolean success = EGL_TRUE;
+
+    front = AcquireColorBuffer(pwin, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
+            modifiers, num_modifiers, !prime);
+    if (front == NULL)
+    {
+        goto done;
+    }
+
+    // We let the driver pick the modifier when we allocate the front buffer,
+    // and then we'll just re-use that same modifier for everything after that.
+    modifier = gbm_bo_get_modifier(front->gbo);
+
+    back = AcquireColorBuffer(pwin, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
+            &modifier, 1, !prime);
+    if (back == NULL)
+    {
+        goto done;
+    }
+
+    if (prime && surf->internal_surface != EGL_NO_SURFACE)
+    {
+        /*
+         * For PRIME, we need to allocate one linear buffer so that we can
+         * attach it as the blit target.
+         *
+         * When we're creating the surface, we leave that for later, since a
+         * lot of windows never get rendered to. See AttachPrimeBuffer.
+         */
+        shared = AllocatePrimeBuffer(pwin->inst, pwin->format->fmt->fourcc, pwin->pending_width, pwin->pending_height);
+        if (shared == NULL)
+        {
+            goto done;
+        }
+        sharedBuf = shared->buffer;
+    }
+
+    if (surf->internal_surface != EGL_NO_SURFACE)
     {
         EGLAttrib buffers[] =
         {
@@ -544,7 +1250,9 @@ static EGLBoolean AllocWindowBuffers(EplSurface *surf,
         }
     }
 
-    FreeWindowBuffers(surf);
+    // Keep any idle buffers that we're replacing in the pool, so that going
+    // back to the old size doesn't need a new allocation.
+    FreeWindowBuffers(surf, EGL_TRUE);
 
     glvnd_list_add(&front->entry, &pwin->color_buffers);
     glvnd_list_add(&back->entry, &pwin->color_buffers);
@@ -559,6 +1267,7 @@ static EGLBoolean AllocWindowBuffers(EplSurface *surf,
     pwin->height = pwin->pending_height;
     pwin->modifier = modifier;
     pwin->prime = prime;
+    pwin->software_full_damage = EGL_TRUE;
     success = EGL_TRUE;
 
 done:
@@ -622,6 +1331,7 @@ static int GetModifierIntersection(uint64_t *mods,
  */
 static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
         const X11DriverFormat *format, xcb_window_t xwin,
+        X11PrimePolicy prime_policy,
         uint64_t **ret_modifiers, int *ret_num_modifiers,
         EGLBoolean *ret_prime)
 {
@@ -648,12 +1358,13 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
         return EGL_FALSE;
     }
 
-    if (!inst->force_prime)
+    if (!inst->force_prime
+            && !(prime_policy == X11_PRIME_POLICY_ALWAYS && inst->supports_prime))
     {
-        cookie = xcb_dri3_get_supported_modifiers(inst->conn, xwin,
+        cookie = xcb_dri3_get_supported_modifiers(inst->present_conn, xwin,
                 eplFormatInfoDepth(format->fmt), format->fmt->bpp);
 
-        reply = xcb_dri3_get_supported_modifiers_reply(inst->conn, cookie, &error);
+        reply = X11_ROUNDTRIP(xcb_dri3_get_supported_modifiers_reply(inst->present_conn, cookie, &error));
         if (reply == NULL)
         {
             free(error);
@@ -680,12 +1391,14 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
              * have a separate per-window modifier list, so look for something
              * in the screen list instead.
              *
-             * Likewise, if we can't support PRIME in the client, then try to
-             * find something that the server supports, even if that means
-             * letting the server do a blit.
+             * Likewise, if we can't support PRIME in the client, or if the
+             * profile says to avoid it, then try to find something that the
+             * server supports, even if that means letting the server do a
+             * blit.
              */
             if (xcb_dri3_get_supported_modifiers_window_modifiers_length(reply) == 0
-                        || !inst->supports_prime)
+                        || !inst->supports_prime
+                        || prime_policy == X11_PRIME_POLICY_AVOID)
             {
                 numMods = GetModifierIntersection(mods,
                         driverFmt->modifiers, driverFmt->num_modifiers,
@@ -728,154 +1441,564 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
     return EGL_TRUE;
 }
 
-void eplX11FreeWindow(EplSurface *surf)
+/**
+ * Writes a frame's timestamps to the trace and clears its entry.
+ *
+ * If the fences haven't signaled yet, then this just drops them.
+ */
+static void FinishFrameTiming(X11Window *pwin, X11FrameTiming *timing)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-
-    FreeWindowBuffers(surf);
-
-    if (pwin->inst->conn != NULL && pwin->present_event != NULL)
+    if (timing->render_done_time != 0)
     {
-        // Unregister for events. It's possible that the window has already
-        // been destroyed since the last time we checked for events, so
-        // ignore any errors.
-        if (!pwin->native_destroyed)
+        uint64_t latency = 0;
+        if (timing->render_done_time > timing->swap_time)
         {
-            xcb_void_cookie_t cookie = xcb_present_select_input_checked(pwin->inst->conn,
-                    pwin->present_event_id, pwin->xwin, 0);
-            xcb_discard_reply(pwin->inst->conn, cookie.sequence);
+            latency = timing->render_done_time - timing->swap_time;
         }
-        xcb_unregister_for_special_event(pwin->inst->conn, pwin->present_event);
+        eplX11TraceRecordAt(timing->render_done_time, X11_TRACE_RENDER_DONE,
+                pwin->xwin, timing->serial, 0, 0, latency, 0);
     }
-
-    surf->priv = NULL;
-    pthread_mutex_destroy(&pwin->mutex);
-    eplX11DisplayInstanceUnref(pwin->inst);
-    free(pwin);
-}
-
-static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
-{
-    X11Window *pwin = (X11Window *) surf->priv;
-    xcb_present_generic_event_t *ge = (xcb_present_generic_event_t *) xcbevt;
-
-    if (ge->evtype == XCB_PRESENT_CONFIGURE_NOTIFY)
+    if (timing->release_time != 0)
     {
-        xcb_present_configure_notify_event_t *evt = (xcb_present_configure_notify_event_t *) xcbevt;
-        pwin->pending_width = evt->width;
-        pwin->pending_height = evt->height;
-
-        if (evt->pixmap_flags & PRESENT_WINDOW_DESTROYED_FLAG)
+        uint64_t held = 0;
+        if (timing->release_time > timing->present_time)
         {
-            pwin->native_destroyed = EGL_TRUE;
+            held = timing->release_time - timing->present_time;
         }
+        eplX11TraceRecordAt(timing->release_time, X11_TRACE_RELEASE,
+                pwin->xwin, timing->serial, 0, 0, held, 0);
     }
-    else if (ge->evtype == XCB_PRESENT_IDLE_NOTIFY)
-    {
-        // With explicit sync, we don't care about PresentIdleNotify events.
-        if (!pwin->use_explicit_sync)
-        {
-            X11ColorBuffer *buffer;
-            xcb_present_idle_notify_event_t *evt = (xcb_present_idle_notify_event_t *) xcbevt;
-            struct glvnd_list *buffers = pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers;
-
-            glvnd_list_for_each_entry(buffer, buffers, entry)
-            {
-                if (buffer->xpix == evt->pixmap && buffer->last_present_serial == evt->serial)
-                {
-                    assert(buffer->status == BUFFER_STATUS_IN_USE);
-                    if (buffer->status == BUFFER_STATUS_IN_USE)
-                    {
-                        buffer->status = BUFFER_STATUS_IDLE_NOTIFIED;
-                    }
-                    buffer->last_present_serial = 0;
-
-                    /*
-                     * Move the buffer to the end of the list. If we don't have any
-                     * server -> client synchronization, then this ensures that
-                     * we'll reuse the oldest buffers first, so we'll have the best
-                     * chance that the buffer really is idle.
-                     */
-                    glvnd_list_del(&buffer->entry);
-                    glvnd_list_append(&buffer->entry, buffers);
 
-                    break;
-                }
-            }
-        }
-    }
-    else if (ge->evtype == XCB_PRESENT_COMPLETE_NOTIFY)
+    if (timing->acquire_fd >= 0)
     {
-        xcb_present_complete_notify_event_t *evt = (xcb_present_complete_notify_event_t *) xcbevt;
-        uint32_t age = pwin->last_present_serial - evt->serial;
-        uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
-        if (age < pending)
-        {
-            pwin->last_complete_serial = evt->serial;
-            pwin->last_complete_msc = evt->msc;
-        }
-
-        if (!pwin->inst->force_prime && evt->mode == XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY)
-        {
-            /*
-             * If the server tells us that this is a suboptimal format, then we
-             * should check for supported format modifiers during the next
-             * swap.
-             */
-            pwin->needs_modifier_check = EGL_TRUE;
-        }
+        close(timing->acquire_fd);
     }
-    else
+    if (timing->release_fd >= 0)
     {
-        // We shouldn't get here.
-        assert(!"Invalid present event");
+        close(timing->release_fd);
     }
+    memset(timing, 0, sizeof(*timing));
+    timing->acquire_fd = -1;
+    timing->release_fd = -1;
 }
 
 /**
- * Checks if we need to reallocate the buffers for a window, and if so,
- * reallocates them.
+ * Adds an entry to the frame timing history for a frame that we just sent to
+ * the server.
  *
- * \param surf The surface to check.
- * \param allow_modifier_change If true, then allow reallocating the buffers to
- *      deal with a format modifier change.
- * \param[out] was_resized Optionally returns EGL_TRUE if the window has new
- *      buffers.
- * \return EGL_TRUE on success, or EGL_FALSE if there was an error.
+ * This takes ownership of the acquire fence that SyncRendering saved.
  */
-static EGLBoolean CheckReallocWindow(EplSurface *surf,
-        EGLBoolean allow_modifier_change, EGLBoolean *was_resized)
+static void AddFrameTiming(X11Window *pwin)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    EGLBoolean need_realloc = EGL_FALSE;
+    X11FrameTiming *timing = &pwin->frame_timings[pwin->frame_timing_next];
 
-    if (was_resized)
+    if (pwin->timing_acquire_fd < 0)
     {
-        *was_resized = EGL_FALSE;
+        return;
     }
 
-    if (surf->deleted || pwin->native_destroyed)
+    if (timing->serial != 0)
     {
-        return EGL_TRUE;
+        // The history is full, so give up on the oldest frame.
+        FinishFrameTiming(pwin, timing);
     }
 
-    if (pwin->pending_width != pwin->width
-            || pwin->pending_height != pwin->height)
+    timing->serial = pwin->last_present_serial;
+    timing->swap_time = pwin->swap_time;
+    timing->present_time = eplGetMonotonicTime();
+    timing->acquire_fd = pwin->timing_acquire_fd;
+    pwin->timing_acquire_fd = -1;
+
+    pwin->frame_timing_next = (pwin->frame_timing_next + 1) % FRAME_TIMING_HISTORY;
+}
+
+/**
+ * Records that the server has released a buffer, and grabs a sync file for
+ * its release fence.
+ *
+ * This is called when we pick the buffer to render to again, so the release
+ * point is available, but it might not have signaled yet.
+ */
+static void RecordBufferRelease(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    int i;
+
+    if (buffer->timing_serial == 0)
     {
-        need_realloc = EGL_TRUE;
+        return;
     }
 
-    if (need_realloc || (allow_modifier_change && pwin->needs_modifier_check))
+    for (i=0; i<FRAME_TIMING_HISTORY; i++)
     {
-        uint64_t currentModifier = pwin->modifier;
-        const uint64_t *mods = NULL;
-        uint64_t *modsBuffer = NULL;
-        int numMods = 0;
+        X11FrameTiming *timing = &pwin->frame_timings[i];
+        if (timing->serial == buffer->timing_serial && !timing->released)
+        {
+            timing->released = EGL_TRUE;
+            if (pwin->use_explicit_sync)
+            {
+                timing->release_fd = eplX11TimelinePointToSyncFD(pwin->inst, &buffer->timeline);
+            }
+            else if (buffer->fd >= 0)
+            {
+                timing->release_fd = eplX11ExportDmaBufSyncFile(pwin->inst, buffer->fd);
+            }
+            break;
+        }
+    }
+    buffer->timing_serial = 0;
+}
+
+/**
+ * Reads the timestamps from any fences that have signaled, and writes out any
+ * frames that are complete.
+ */
+static void UpdateFrameTimings(X11Window *pwin)
+{
+    int i;
+
+    for (i=0; i<FRAME_TIMING_HISTORY; i++)
+    {
+        X11FrameTiming *timing = &pwin->frame_timings[i];
+        if (timing->serial == 0)
+        {
+            continue;
+        }
+
+        if (timing->acquire_fd >= 0
+                && eplX11GetSyncFDTimestamp(timing->acquire_fd, &timing->render_done_time))
+        {
+            close(timing->acquire_fd);
+            timing->acquire_fd = -1;
+        }
+        if (timing->release_fd >= 0
+                && eplX11GetSyncFDTimestamp(timing->release_fd, &timing->release_time))
+        {
+            close(timing->release_fd);
+            timing->release_fd = -1;
+        }
+
+        if (timing->released && timing->acquire_fd < 0 && timing->release_fd < 0)
+        {
+            FinishFrameTiming(pwin, timing);
+        }
+    }
+}
+
+/**
+ * Sets or removes the _VARIABLE_REFRESH property on a window.
+ *
+ * The server's DDX only turns on variable refresh for a CRTC while a window
+ * with this property set is flipping on it.
+ *
+ * \return EGL_TRUE on success, or EGL_FALSE if we couldn't look up the atom.
+ */
+static EGLBoolean SetVariableRefresh(X11Window *pwin, EGLBoolean enable)
+{
+    static const char VARIABLE_REFRESH_NAME[] = "_VARIABLE_REFRESH";
+    xcb_intern_atom_cookie_t atomCookie;
+    xcb_intern_atom_reply_t *atomReply;
+
+    atomCookie = xcb_intern_atom(pwin->inst->present_conn, !enable,
+            sizeof(VARIABLE_REFRESH_NAME) - 1, VARIABLE_REFRESH_NAME);
+    atomReply = X11_ROUNDTRIP(xcb_intern_atom_reply(pwin->inst->present_conn, atomCookie, NULL));
+    if (atomReply == NULL || atomReply->atom == XCB_ATOM_NONE)
+    {
+        free(atomReply);
+        return EGL_FALSE;
+    }
+
+    if (enable)
+    {
+        uint32_t value = 1;
+        xcb_change_property(pwin->inst->present_conn, XCB_PROP_MODE_REPLACE, pwin->xwin,
+                atomReply->atom, XCB_ATOM_CARDINAL, 32, 1, &value);
+    }
+    else
+    {
+        xcb_void_cookie_t cookie = xcb_delete_property_checked(pwin->inst->present_conn,
+                pwin->xwin, atomReply->atom);
+        xcb_discard_reply(pwin->inst->present_conn, cookie.sequence);
+    }
+
+    free(atomReply);
+    return EGL_TRUE;
+}
+
+void eplX11FreeWindow(EplSurface *surf)
+{
+    int i;
+
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    if (pwin->deferred.thread_started)
+    {
+        // Shut down the deferred present thread. The surface has already
+        // been destroyed by this point, so the thread will just discard any
+        // pending present.
+        pthread_mutex_lock(&pwin->deferred.mutex);
+        pwin->deferred.quit = EGL_TRUE;
+        pthread_cond_broadcast(&pwin->deferred.cond);
+        pthread_mutex_unlock(&pwin->deferred.mutex);
+
+        pthread_join(pwin->deferred.thread, NULL);
+        pwin->deferred.thread_started = EGL_FALSE;
+    }
+    pthread_cond_destroy(&pwin->deferred.cond);
+    pthread_mutex_destroy(&pwin->deferred.mutex);
+
+    // Don't bother pooling anything if the process is exiting.
+    FreeWindowBuffers(surf, !pwin->inst->platform->exiting);
+
+    for (i=0; i<FRAME_TIMING_HISTORY; i++)
+    {
+        if (pwin->frame_timings[i].serial != 0)
+        {
+            FinishFrameTiming(pwin, &pwin->frame_timings[i]);
+        }
+    }
+    if (pwin->timing_acquire_fd >= 0)
+    {
+        close(pwin->timing_acquire_fd);
+        pwin->timing_acquire_fd = -1;
+    }
+    if (pwin->front.syncfd >= 0)
+    {
+        close(pwin->front.syncfd);
+        pwin->front.syncfd = -1;
+    }
+
+    if (pwin->vrr && pwin->inst->present_conn != NULL && !pwin->native_destroyed)
+    {
+        SetVariableRefresh(pwin, EGL_FALSE);
+        pwin->vrr = EGL_FALSE;
+    }
+
+    if (pwin->visibility.tracking_events)
+    {
+        pthread_mutex_lock(&pwin->inst->visibility_mutex);
+        glvnd_list_del(&pwin->visibility.entry);
+        pthread_mutex_unlock(&pwin->inst->visibility_mutex);
+        pwin->visibility.tracking_events = EGL_FALSE;
+
+        if (pwin->inst->present_conn != NULL && !pwin->native_destroyed
+                && !pwin->inst->platform->exiting)
+        {
+            uint32_t mask = 0;
+            xcb_void_cookie_t cookie = xcb_change_window_attributes_checked(pwin->inst->present_conn,
+                    pwin->xwin, XCB_CW_EVENT_MASK, &mask);
+            xcb_discard_reply(pwin->inst->present_conn, cookie.sequence);
+        }
+    }
+    if (pwin->inst->present_conn != NULL && pwin->visibility.attrib_pending)
+    {
+        xcb_discard_reply(pwin->inst->present_conn, pwin->visibility.attrib_cookie.sequence);
+        pwin->visibility.attrib_pending = EGL_FALSE;
+    }
+
+    if (pwin->inst->present_conn != NULL && pwin->software_geom_pending)
+    {
+        xcb_discard_reply(pwin->inst->present_conn, pwin->software_geom_cookie.sequence);
+        pwin->software_geom_pending = EGL_FALSE;
+    }
+    eplX11SoftwarePresentDestroy(pwin->software);
+    pwin->software = NULL;
+
+    if (pwin->inst->present_conn != NULL && pwin->present_event != NULL)
+    {
+        // Unregister for events. It's possible that the window has already
+        // been destroyed since the last time we checked for events, so
+        // ignore any errors. Event selections go away with the connection,
+        // so there's no need to do that if the process is exiting.
+        if (!pwin->native_destroyed && !pwin->inst->platform->exiting)
+        {
+            xcb_void_cookie_t cookie = xcb_present_select_input_checked(pwin->inst->present_conn,
+                    pwin->present_event_id, pwin->xwin, 0);
+            xcb_discard_reply(pwin->inst->present_conn, cookie.sequence);
+        }
+        xcb_unregister_for_special_event(pwin->inst->present_conn, pwin->present_event);
+    }
+
+    surf->priv = NULL;
+    pthread_mutex_destroy(&pwin->mutex);
+    eplX11DisplayInstanceUnref(pwin->inst);
+    free(pwin);
+}
+
+/**
+ * Checks whether the MSC from a PresentCompleteNotify event is consistent with
+ * the previous one.
+ *
+ * When a window moves to a different CRTC, the MSC can jump, and if the new
+ * CRTC has a different refresh rate, then it also starts counting at a
+ * different speed. Either way, the MSC stops matching the time that's passed
+ * since the last event, given the refresh period that we've measured so far.
+ */
+static EGLBoolean IsMSCDiscontinuity(X11Window *pwin, uint64_t msc, uint64_t ust)
+{
+    uint64_t expected;
+    uint64_t actual;
+    uint64_t tolerance;
+
+    if (pwin->last_complete_ust == 0)
+    {
+        return EGL_FALSE;
+    }
+
+    if (msc < pwin->last_complete_msc)
+    {
+        return EGL_TRUE;
+    }
+
+    // With variable refresh, the MSC is supposed to change speed.
+    if (pwin->vrr || pwin->refresh_period == 0 || ust <= pwin->last_complete_ust)
+    {
+        return EGL_FALSE;
+    }
+
+    expected = ((ust - pwin->last_complete_ust) * 1000 + pwin->refresh_period / 2)
+        / pwin->refresh_period;
+    actual = msc - pwin->last_complete_msc;
+
+    // Allow for some timing noise, plus a bit more over longer gaps.
+    tolerance = 2 + expected / 4;
+    if (actual > expected + tolerance || actual + tolerance < expected)
+    {
+        return EGL_TRUE;
+    }
+
+    return EGL_FALSE;
+}
+
+/**
+ * Throws out the MSC-based timing state after a discontinuity.
+ *
+ * The next target MSC comes from the new last_complete_msc anyway, but the
+ * refresh period that we measured belongs to the old CRTC, so measure it
+ * again from scratch rather than averaging the two. The frame rate limiter's
+ * deadlines are based on the old refresh cycle, so start those over too.
+ */
+static void RebaseMSC(X11Window *pwin)
+{
+    pwin->refresh_period = 0;
+    pwin->min_refresh_period = 0;
+    pwin->limiter.next_deadline = 0;
+}
+
+/**
+ * Records the present ID for the PresentPixmap request that we just sent.
+ *
+ * \param present_id The present ID, or 0 if this present didn't come from
+ *      eglSwapBuffers.
+ */
+static void AddPresentId(X11Window *pwin, uint64_t present_id)
+{
+    unsigned int index;
+
+    if (present_id == 0)
+    {
+        return;
+    }
+
+    if (pwin->present_ids.count == PRESENT_ID_HISTORY)
+    {
+        // This shouldn't happen unless a profile allows a lot of pending
+        // frames. Treat the oldest frame as complete, so that nothing waits
+        // on it forever.
+        pwin->present_ids.complete = pwin->present_ids.pending[pwin->present_ids.first].id;
+        pwin->present_ids.first = (pwin->present_ids.first + 1) % PRESENT_ID_HISTORY;
+        pwin->present_ids.count--;
+    }
+
+    index = (pwin->present_ids.first + pwin->present_ids.count) % PRESENT_ID_HISTORY;
+    pwin->present_ids.pending[index].id = present_id;
+    pwin->present_ids.pending[index].serial = pwin->last_present_serial;
+    pwin->present_ids.count++;
+}
+
+/**
+ * Updates the completed present ID after the PresentCompleteNotify event for
+ * \p serial.
+ *
+ * Presents complete in order, so everything up to \p serial is done.
+ */
+static void CompletePresentIds(X11Window *pwin, uint32_t serial)
+{
+    while (pwin->present_ids.count > 0)
+    {
+        unsigned int index = pwin->present_ids.first;
+        if ((int32_t) (serial - pwin->present_ids.pending[index].serial) < 0)
+        {
+            break;
+        }
+
+        pwin->present_ids.complete = pwin->present_ids.pending[index].id;
+        pwin->present_ids.first = (index + 1) % PRESENT_ID_HISTORY;
+        pwin->present_ids.count--;
+    }
+}
+
+static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    xcb_present_generic_event_t *ge = (xcb_present_generic_event_t *) xcbevt;
+
+    if (ge->evtype == XCB_PRESENT_CONFIGURE_NOTIFY)
+    {
+        xcb_present_configure_notify_event_t *evt = (xcb_present_configure_notify_event_t *) xcbevt;
+        eplX11TraceRecord(X11_TRACE_CONFIGURE_NOTIFY, pwin->xwin, 0,
+                (((uint32_t) evt->width) << 16) | evt->height, 0, evt->pixmap_flags);
+        pwin->pending_width = evt->width;
+        pwin->pending_height = evt->height;
+
+        if (evt->pixmap_flags & PRESENT_WINDOW_DESTROYED_FLAG)
+        {
+            pwin->native_destroyed = EGL_TRUE;
+        }
+    }
+    else if (ge->evtype == XCB_PRESENT_IDLE_NOTIFY)
+    {
+        xcb_present_idle_notify_event_t *idle = (xcb_present_idle_notify_event_t *) xcbevt;
+        eplX11TraceRecord(X11_TRACE_IDLE_NOTIFY, pwin->xwin, idle->serial, idle->pixmap, 0, 0);
+
+        // With explicit sync, we don't care about PresentIdleNotify events.
+        if (!pwin->use_explicit_sync)
+        {
+            X11ColorBuffer *buffer;
+            xcb_present_idle_notify_event_t *evt = (xcb_present_idle_notify_event_t *) xcbevt;
+            struct glvnd_list *buffers = pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers;
+
+            glvnd_list_for_each_entry(buffer, buffers, entry)
+            {
+                if (buffer->xpix == evt->pixmap && buffer->last_present_serial == evt->serial)
+                {
+                    assert(buffer->status == BUFFER_STATUS_IN_USE);
+                    if (buffer->status == BUFFER_STATUS_IN_USE)
+                    {
+                        buffer->status = BUFFER_STATUS_IDLE_NOTIFIED;
+                    }
+                    buffer->last_present_serial = 0;
+
+                    /*
+                     * Move the buffer to the end of the list. If we don't have any
+                     * server -> client synchronization, then this ensures that
+                     * we'll reuse the oldest buffers first, so we'll have the best
+                     * chance that the buffer really is idle.
+                     */
+                    glvnd_list_del(&buffer->entry);
+                    glvnd_list_append(&buffer->entry, buffers);
+
+                    break;
+                }
+            }
+        }
+    }
+    else if (ge->evtype == XCB_PRESENT_COMPLETE_NOTIFY)
+    {
+        xcb_present_complete_notify_event_t *evt = (xcb_present_complete_notify_event_t *) xcbevt;
+        uint32_t age = pwin->last_present_serial - evt->serial;
+        uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
+
+        eplX11TraceRecord(X11_TRACE_COMPLETE_NOTIFY, pwin->xwin, evt->serial, evt->mode, evt->msc, 0);
+        if (age < pending)
+        {
+            if (IsMSCDiscontinuity(pwin, evt->msc, evt->ust))
+            {
+                eplX11TraceRecord(X11_TRACE_MSC_REBASE, pwin->xwin, evt->serial,
+                        pwin->refresh_period / 1000, evt->msc, 0);
+                RebaseMSC(pwin);
+            }
+            else if (evt->msc > pwin->last_complete_msc && pwin->last_complete_ust != 0
+                    && evt->ust > pwin->last_complete_ust)
+            {
+                uint64_t period = (evt->ust - pwin->last_complete_ust) * 1000
+                    / (evt->msc - pwin->last_complete_msc);
+                if (period >= MIN_REFRESH_PERIOD && period <= MAX_REFRESH_PERIOD)
+                {
+                    if (pwin->min_refresh_period == 0 || period < pwin->min_refresh_period)
+                    {
+                        pwin->min_refresh_period = period;
+                    }
+
+                    if (pwin->refresh_period == 0)
+                    {
+                        pwin->refresh_period = period;
+                    }
+                    else
+                    {
+                        pwin->refresh_period = (pwin->refresh_period * 7 + period) / 8;
+                    }
+                }
+            }
+
+            pwin->last_complete_serial = evt->serial;
+            CompletePresentIds(pwin, evt->serial);
+            pwin->last_complete_msc = evt->msc;
+            pwin->last_complete_ust = evt->ust;
+        }
+
+        if (!pwin->inst->force_prime && pwin->policy.modifiers == X11_MODIFIER_POLICY_OPTIMAL
+                && evt->mode == XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY)
+        {
+            /*
+             * If the server tells us that this is a suboptimal format, then we
+             * should check for supported format modifiers during the next
+             * swap.
+             */
+            pwin->needs_modifier_check = EGL_TRUE;
+        }
+    }
+    else
+    {
+        // We shouldn't get here.
+        assert(!"Invalid present event");
+    }
+}
+
+/**
+ * Checks if we need to reallocate the buffers for a window, and if so,
+ * reallocates them.
+ *
+ * \param surf The surface to check.
+ * \param allow_modifier_change If true, then allow reallocating the buffers to
+ *      deal with a format modifier change.
+ * \param[out] was_resized Optionally returns EGL_TRUE if the window has new
+ *      buffers.
+ * \return EGL_TRUE on success, or EGL_FALSE if there was an error.
+ */
+static EGLBoolean CheckReallocWindow(EplSurface *surf,
+        EGLBoolean allow_modifier_change, EGLBoolean *was_resized)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    EGLBoolean need_realloc = EGL_FALSE;
+
+    if (was_resized)
+    {
+        *was_resized = EGL_FALSE;
+    }
+
+    if (surf->deleted || pwin->native_destroyed)
+    {
+        return EGL_TRUE;
+    }
+
+    if (pwin->pending_width != pwin->width
+            || pwin->pending_height != pwin->height)
+    {
+        need_realloc = EGL_TRUE;
+    }
+
+    if (need_realloc || (allow_modifier_change && pwin->needs_modifier_check))
+    {
+        uint64_t currentModifier = pwin->modifier;
+        const uint64_t *mods = NULL;
+        uint64_t *modsBuffer = NULL;
+        int numMods = 0;
         EGLBoolean prime = EGL_FALSE;
 
         if (pwin->needs_modifier_check)
         {
-            if (!FindSupportedModifiers(pwin->inst, pwin->format, pwin->xwin, &modsBuffer, &numMods, &prime))
+            if (!FindSupportedModifiers(pwin->inst, pwin->format, pwin->xwin,
+                        pwin->policy.prime, &modsBuffer, &numMods, &prime))
             {
                 return EGL_FALSE;
             }
@@ -944,9 +2067,15 @@ static void PollForWindowEvents(EplSurface *surf)
 {
     X11Window *pwin = (X11Window *) surf->priv;
 
+    if (pwin->present_event == NULL)
+    {
+        // We're using software presentation, so there aren't any events.
+        return;
+    }
+
     while (!pwin->native_destroyed && !surf->deleted)
     {
-        xcb_generic_event_t *xcbevt = xcb_poll_for_special_event(pwin->inst->conn, pwin->present_event);
+        xcb_generic_event_t *xcbevt = xcb_poll_for_special_event(pwin->inst->present_conn, pwin->present_event);
         if (xcbevt == NULL)
         {
             break;
@@ -961,6 +2090,7 @@ static void WindowUpdateCallback(void *param)
 {
     EplSurface *surf = param;
     X11Window *pwin = (X11Window *) surf->priv;
+    X11_ROUNDTRIP_ENTRY("window update callback");
 
     /*
      * Here, we lock the window mutex, but *not* the display mutex.
@@ -985,25 +2115,77 @@ static void WindowUpdateCallback(void *param)
     }
 
     PollForWindowEvents(surf);
-    CheckReallocWindow(surf, EGL_FALSE, NULL);
+    if (CheckReallocWindow(surf, EGL_FALSE, NULL))
+    {
+        AttachPrimeBuffer(surf);
+    }
 
     pthread_mutex_unlock(&pwin->mutex);
 }
 
+/**
+ * Sends an image to the server for software presentation.
+ *
+ * The image goes out with a PutImage request rather than a PresentPixmap, so
+ * there's no PresentCompleteNotify event to wait for. As soon as the request
+ * is sent, we treat the frame as complete and the linear buffer as idle.
+ */
+static void SendSoftwarePresent(EplSurface *surf, X11ColorBuffer *buffer, uint64_t present_id)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    xcb_rectangle_t rect = pwin->software_damage;
+
+    // If this buffer was queued before a resize, then it's still the old
+    // size, so leave the full update for the first frame at the new size.
+    if (pwin->software_full_damage
+            && gbm_bo_get_width(buffer->gbo) == (uint32_t) pwin->width
+            && gbm_bo_get_height(buffer->gbo) == (uint32_t) pwin->height)
+    {
+        rect.x = rect.y = 0;
+        rect.width = pwin->width;
+        rect.height = pwin->height;
+        pwin->software_full_damage = EGL_FALSE;
+    }
+
+    pwin->last_present_serial++;
+
+    // SendPresentPixmap doesn't report errors either, so if this fails, we
+    // just drop the frame.
+    eplX11SoftwarePresentBuffer(pwin->software, buffer->gbo, &rect);
+    eplX11TraceRecord(X11_TRACE_PRESENT, pwin->xwin, pwin->last_present_serial,
+            0, 0, X11_TRACE_FLAG_SOFTWARE);
+
+    pwin->last_complete_serial = pwin->last_present_serial;
+    AddPresentId(pwin, present_id);
+    CompletePresentIds(pwin, pwin->last_present_serial);
+    buffer->status = BUFFER_STATUS_IDLE;
+    buffer->last_present_serial = pwin->last_present_serial;
+}
+
 /**
  * A common helper function to send a PresentPixmap or PresentPixmapSynced
  * request.
  *
  * If explicit sync is supported, then the pixmap's current timeline point must
  * already be set up to the correct acquire fence.
+ *
+ * \param present_id The present ID for eglSwapBuffers, or 0 for a front
+ *      buffer present.
  */
-static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, uint32_t options)
+static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap,
+        uint32_t options, uint64_t present_id)
 {
     X11Window *pwin = (X11Window *) surf->priv;
     uint32_t numPending = pwin->last_present_serial - pwin->last_complete_serial;
     uint32_t targetMSC = 0;
     uint64_t divisor = 1;
 
+    if (pwin->software != NULL)
+    {
+        SendSoftwarePresent(surf, sharedPixmap, present_id);
+        return;
+    }
+
     if (pwin->swap_interval <= 0)
     {
         options |= XCB_PRESENT_OPTION_ASYNC;
@@ -1052,14 +2234,24 @@ static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, ui
          *   server.
          */
 
-        targetMSC = pwin->last_complete_msc + ((numPending + 1) * pwin->swap_interval);
+        if (pwin->vrr)
+        {
+            // With variable refresh, the display refreshes when the frame
+            // arrives, so just present on the next refresh. eglSwapBuffers
+            // paces the frames instead, in LimitFrameRate.
+            targetMSC = 0;
+        }
+        else
+        {
+            targetMSC = pwin->last_complete_msc + ((numPending + 1) * pwin->swap_interval);
+        }
     }
 
     pwin->last_present_serial++;
 
     if (pwin->use_explicit_sync)
     {
-        pwin->inst->platform->priv->xcb.present_pixmap_synced(pwin->inst->conn, pwin->xwin,
+        pwin->inst->platform->priv->xcb.present_pixmap_synced(pwin->inst->present_conn, pwin->xwin,
                 sharedPixmap->xpix, pwin->last_present_serial,
                 0, 0, 0, 0, 0,
                 sharedPixmap->timeline.xid, sharedPixmap->timeline.xid,
@@ -1071,21 +2263,85 @@ static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, ui
     }
     else
     {
-        xcb_present_pixmap(pwin->inst->conn,
+        if (sharedPixmap->idle_fence != NULL)
+        {
+            // The server will trigger the idle fence when it's finished with
+            // the pixmap.
+            xshmfence_reset(sharedPixmap->idle_fence);
+        }
+
+        xcb_present_pixmap(pwin->inst->present_conn,
                 pwin->xwin,
                 sharedPixmap->xpix,
                 pwin->last_present_serial,
                 0, 0, // No update regions
                 0, 0, // No offset -- update the whole window
-                0, 0, 0, // No CRTC or fences
+                0, 0, // No CRTC or wait fence
+                sharedPixmap->idle_fence_xid,
                 options, targetMSC, divisor, 0, 0, NULL);
     }
 
-    xcb_flush(pwin->inst->conn);
+    xcb_flush(pwin->inst->present_conn);
+    eplX11TraceRecord(X11_TRACE_PRESENT, pwin->xwin, pwin->last_present_serial,
+            options, targetMSC,
+            (pwin->use_explicit_sync ? X11_TRACE_FLAG_EXPLICIT_SYNC : 0)
+            | (pwin->prime ? X11_TRACE_FLAG_PRIME : 0));
+    sharedPixmap->timing_serial = pwin->last_present_serial;
+    AddFrameTiming(pwin);
+    AddPresentId(pwin, present_id);
     sharedPixmap->status = BUFFER_STATUS_IN_USE;
     sharedPixmap->last_present_serial = pwin->last_present_serial;
 }
 
+/**
+ * Creates an xshmfence and a corresponding SyncFence in the server, to use as
+ * an idle fence for a shared pixmap.
+ *
+ * The fence starts out triggered, and SendPresentPixmap resets it before each
+ * PresentPixmap request.
+ */
+static EGLBoolean CreateIdleFence(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    int fd;
+
+    assert(buffer->xpix != 0);
+    assert(buffer->idle_fence == NULL);
+
+    fd = xshmfence_alloc_shm();
+    if (fd < 0)
+    {
+        return EGL_FALSE;
+    }
+
+    buffer->idle_fence = xshmfence_map_shm(fd);
+    if (buffer->idle_fence == NULL)
+    {
+        close(fd);
+        return EGL_FALSE;
+    }
+
+    // Note that XCB will close the file descriptor after it sends the
+    // request, so send a duplicate and keep the original for
+    // CheckBufferReleaseNoSync.
+    buffer->idle_fence_fd = fd;
+    fd = dup(buffer->idle_fence_fd);
+    if (fd < 0)
+    {
+        xshmfence_unmap_shm(buffer->idle_fence);
+        buffer->idle_fence = NULL;
+        close(buffer->idle_fence_fd);
+        buffer->idle_fence_fd = -1;
+        return EGL_FALSE;
+    }
+
+    buffer->idle_fence_xid = xcb_generate_id(pwin->inst->present_conn);
+    xcb_dri3_fence_from_fd(pwin->inst->present_conn, buffer->xpix,
+            buffer->idle_fence_xid, 1, fd);
+    xshmfence_trigger(buffer->idle_fence);
+
+    return EGL_TRUE;
+}
+
 /**
  * Allocates a shared Pixmap for a color buffer.
  */
@@ -1126,8 +2382,8 @@ static EGLBoolean CreateSharedPixmap(EplSurface *psurf, X11ColorBuffer *buffer,
 
     // Temporary hack: Send the PixmapFromBuffers request synchronously to
     // check for errors.
-    buffer->xpix = xcb_generate_id(pwin->inst->conn);
-    cookie = xcb_dri3_pixmap_from_buffers_checked(pwin->inst->conn, buffer->xpix,
+    buffer->xpix = xcb_generate_id(pwin->inst->present_conn);
+    cookie = xcb_dri3_pixmap_from_buffers_checked(pwin->inst->present_conn, buffer->xpix,
             pwin->inst->xscreen->root, 1,
             gbm_bo_get_width(buffer->gbo),
             gbm_bo_get_height(buffer->gbo),
@@ -1137,7 +2393,7 @@ static EGLBoolean CreateSharedPixmap(EplSurface *psurf, X11ColorBuffer *buffer,
             eplFormatInfoDepth(fmt), fmt->bpp,
             gbm_bo_get_modifier(buffer->gbo), &fd);
 
-    error = xcb_request_check(pwin->inst->conn, cookie);
+    error = X11_ROUNDTRIP(xcb_request_check(pwin->inst->present_conn, cookie));
     if (error != NULL)
     {
         buffer->xpix = 0;
@@ -1145,14 +2401,287 @@ static EGLBoolean CreateSharedPixmap(EplSurface *psurf, X11ColorBuffer *buffer,
         return EGL_FALSE;
     }
 
+    if (!pwin->use_explicit_sync && !pwin->inst->supports_implicit_sync
+            && buffer->idle_fence == NULL)
+    {
+        /*
+         * Without explicit or implicit sync, a PresentIdleNotify event alone
+         * doesn't tell us that the server is really finished with the buffer.
+         * So, create an idle fence that we can send with PresentPixmap.
+         *
+         * If this fails, then we'll just go back to relying on
+         * PresentIdleNotify.
+         */
+        CreateIdleFence(pwin, buffer);
+    }
+
     return EGL_TRUE;
 }
 
+static void *DeferredPresentThread(void *param);
+
+/**
+ * Starts the deferred present thread, if it isn't already running.
+ *
+ * The caller must hold the window's mutex.
+ */
+static EGLBoolean StartDeferredPresentThread(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    if (!pwin->deferred.thread_started)
+    {
+        if (pthread_create(&pwin->deferred.thread, NULL, DeferredPresentThread, surf) != 0)
+        {
+            return EGL_FALSE;
+        }
+        pwin->deferred.thread_started = EGL_TRUE;
+    }
+    return EGL_TRUE;
+}
+
+/**
+ * Returns true if the last front buffer present hasn't completed yet.
+ */
+static EGLBoolean IsFrontPresentPending(X11Window *pwin)
+{
+    uint32_t age = pwin->last_present_serial - pwin->front.last_serial;
+    uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
+
+    return (pwin->front.last_serial != 0 && age < pending);
+}
+
+/**
+ * Sends a present for any front buffer damage that we've collected.
+ *
+ * If there's still a fence in \c front.syncfd, then this will do a CPU wait
+ * for it, so this must only be called from the thread where the surface is
+ * current. The deferred present thread waits for the fence itself, without
+ * the window's mutex, before calling this.
+ *
+ * The caller must hold the window's mutex.
+ */
+static void FlushFrontBufferPresent(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11ColorBuffer *sharedPixmap = NULL;
+    int syncfd = pwin->front.syncfd;
+
+    if (!pwin->front.pending)
+    {
+        return;
+    }
+
+    pwin->front.pending = EGL_FALSE;
+    pwin->front.syncfd = -1;
+
+    if (pwin->native_destroyed || surf->deleted)
+    {
+        goto done;
+    }
+
+    if (pwin->prime)
+    {
+        sharedPixmap = pwin->current_prime;
+    }
+    else
+    {
+        sharedPixmap = pwin->current_front;
+    }
+
+    if (sharedPixmap == NULL)
+    {
+        // A PRIME window doesn't get a blit target until the update callback
+        // or eglSwapBuffers attaches one, so until then, the driver doesn't
+        // have anywhere to copy the front buffer to. See AttachPrimeBuffer.
+        goto done;
+    }
+
+    if (pwin->software != NULL)
+    {
+        // We don't know which part of the front buffer changed, so update
+        // the whole window.
+        pwin->software_damage.x = pwin->software_damage.y = 0;
+        pwin->software_damage.width = pwin->width;
+        pwin->software_damage.height = pwin->height;
+    }
+    else if (sharedPixmap->xpix == 0)
+    {
+        // WindowDamageCallback creates the pixmap, so if we don't have one,
+        // then the buffers were reallocated since the damage happened, and
+        // there's nothing in the new buffer to show yet.
+        goto done;
+    }
+
+    if (!eplX11WaitForFD(syncfd))
+    {
+        goto done;
+    }
+
+    SendPresentPixmap(surf, sharedPixmap, XCB_PRESENT_OPTION_ASYNC | XCB_PRESENT_OPTION_COPY, 0);
+    pwin->front.last_serial = pwin->last_present_serial;
+    pwin->front.last_time = eplGetMonotonicTime();
+
+done:
+    if (syncfd >= 0)
+    {
+        close(syncfd);
+    }
+}
+
+/**
+ * Returns the time when we can send the next front buffer present, or zero
+ * if we can send it now.
+ *
+ * We only send a front buffer present if the last one has completed and at
+ * least one refresh period has gone by since we sent it. Anything before
+ * that gets merged into the next present.
+ *
+ * The caller must hold the window's mutex.
+ */
+static uint64_t GetFrontBufferPresentDeadline(X11Window *pwin)
+{
+    uint64_t period = pwin->refresh_period;
+    uint64_t now = eplGetMonotonicTime();
+    uint64_t deadline;
+
+    if (period == 0)
+    {
+        period = DEFAULT_REFRESH_PERIOD;
+    }
+
+    deadline = pwin->front.last_time + period;
+    if (IsFrontPresentPending(pwin))
+    {
+        // Check again in a little while. We'll usually get the
+        // PresentCompleteNotify event before then.
+        if (deadline < now + period / 4)
+        {
+            deadline = now + period / 4;
+        }
+        return deadline;
+    }
+    else if (deadline <= now)
+    {
+        return 0;
+    }
+    return deadline;
+}
+
+/**
+ * Sets the time when the deferred present thread should check for pending
+ * front buffer damage next.
+ */
+static void SetFrontBufferPresentDeadline(X11Window *pwin, uint64_t deadline)
+{
+    pthread_mutex_lock(&pwin->deferred.mutex);
+    if (pwin->deferred.front_deadline == 0 || deadline < pwin->deferred.front_deadline)
+    {
+        pwin->deferred.front_deadline = deadline;
+        pthread_cond_broadcast(&pwin->deferred.cond);
+    }
+    pthread_mutex_unlock(&pwin->deferred.mutex);
+}
+
+/**
+ * Sends the pending front buffer damage now if we can, or else schedules the
+ * deferred present thread to send it later.
+ *
+ * This must only be called from the thread where the surface is current.
+ *
+ * The caller must hold the window's mutex.
+ */
+static void ScheduleFrontBufferPresent(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t deadline = GetFrontBufferPresentDeadline(pwin);
+
+    if (deadline == 0)
+    {
+        FlushFrontBufferPresent(surf);
+        return;
+    }
+
+    if (!StartDeferredPresentThread(surf))
+    {
+        // If we can't start the thread, then just send it now.
+        FlushFrontBufferPresent(surf);
+        return;
+    }
+
+    SetFrontBufferPresentDeadline(pwin, deadline);
+}
+
+/**
+ * Sends pending front buffer damage from the deferred present thread.
+ *
+ * Unlike ScheduleFrontBufferPresent, this never waits for a fence or calls
+ * into the driver while holding the window's mutex. If there's a fence that
+ * we haven't waited for yet, then we drop the mutex to wait for it, and then
+ * only send the request once we've got the mutex back.
+ *
+ * The caller must hold the window's mutex.
+ */
+static void DeferredFrontBufferPresent(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t deadline;
+
+    // If eglSwapBuffers is in progress, then leave the damage for it. It
+    // sends or re-schedules anything that's still pending before it
+    // returns.
+    while (pwin->front.pending && !pwin->skip_update_callback
+            && !pwin->native_destroyed && !surf->deleted)
+    {
+        unsigned int serial;
+        int syncfd;
+
+        PollForWindowEvents(surf);
+        deadline = GetFrontBufferPresentDeadline(pwin);
+        if (deadline != 0)
+        {
+            SetFrontBufferPresentDeadline(pwin, deadline);
+            return;
+        }
+
+        if (pwin->front.syncfd < 0)
+        {
+            FlushFrontBufferPresent(surf);
+            return;
+        }
+
+        // Wait for our own copy of the fence, since WindowDamageCallback
+        // might replace the original while we're waiting.
+        syncfd = dup(pwin->front.syncfd);
+        if (syncfd < 0)
+        {
+            SetFrontBufferPresentDeadline(pwin, eplGetMonotonicTime() + DEFAULT_REFRESH_PERIOD / 4);
+            return;
+        }
+        serial = pwin->front.syncfd_serial;
+
+        pthread_mutex_unlock(&pwin->mutex);
+        eplX11WaitForFD(syncfd);
+        close(syncfd);
+        pthread_mutex_lock(&pwin->mutex);
+
+        if (pwin->front.syncfd >= 0 && pwin->front.syncfd_serial == serial)
+        {
+            close(pwin->front.syncfd);
+            pwin->front.syncfd = -1;
+        }
+
+        // If a newer flush came in while we were waiting, then go around
+        // again and wait for that one, too.
+    }
+}
+
 static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
 {
     EplSurface *surf = param;
     X11Window *pwin = (X11Window *) surf->priv;
-    X11ColorBuffer *sharedPixmap = NULL;
+    X11ColorBuffer *sharedPixmap;
+    X11_ROUNDTRIP_ENTRY("window damage callback");
 
     pthread_mutex_lock(&pwin->mutex);
 
@@ -1170,6 +2699,22 @@ static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
         goto done;
     }
 
+    if (pwin->software != NULL)
+    {
+        // Sending a software present means mapping the buffer through GBM,
+        // which the deferred present thread can't do while it's holding the
+        // window's mutex. So, just send it now.
+        if (!eplX11WaitForFD(syncfd))
+        {
+            goto done;
+        }
+        pwin->front.pending = EGL_TRUE;
+        FlushFrontBufferPresent(surf);
+        goto done;
+    }
+
+    // Do anything that needs X round trips or the driver here, so that the
+    // deferred present thread only has to send the PresentPixmap request.
     if (pwin->prime)
     {
         sharedPixmap = pwin->current_prime;
@@ -1178,8 +2723,11 @@ static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
     {
         sharedPixmap = pwin->current_front;
     }
-
-    assert(sharedPixmap != NULL);
+    if (sharedPixmap == NULL)
+    {
+        // There's no blit target yet. See FlushFrontBufferPresent.
+        goto done;
+    }
 
     if (sharedPixmap->xpix == 0)
     {
@@ -1226,16 +2774,35 @@ static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
     }
     else
     {
-        // If we don't have explicit sync, then just do a CPU wait.
+        // If we don't have explicit sync, then we'll have to do a CPU wait
+        // before sending the present. The driver keeps ownership of syncfd,
+        // so we need our own copy of it. Rendering from the same context
+        // finishes in order, so the newest fence replaces any older one that
+        // we haven't sent yet.
         // TODO: Is there a way that we can reliably use implicit sync if
         // the server supports it?
-        if (!eplX11WaitForFD(syncfd))
+        if (pwin->front.syncfd >= 0)
         {
-            goto done;
+            close(pwin->front.syncfd);
+            pwin->front.syncfd = -1;
+        }
+        if (syncfd >= 0)
+        {
+            pwin->front.syncfd = dup(syncfd);
+            if (pwin->front.syncfd < 0)
+            {
+                // If we can't hold onto the fence, then wait for it here instead.
+                if (!eplX11WaitForFD(syncfd))
+                {
+                    goto done;
+                }
+            }
+            pwin->front.syncfd_serial++;
         }
     }
+    pwin->front.pending = EGL_TRUE;
 
-    SendPresentPixmap(surf, sharedPixmap, XCB_PRESENT_OPTION_ASYNC | XCB_PRESENT_OPTION_COPY);
+    ScheduleFrontBufferPresent(surf);
 
 done:
     pthread_mutex_unlock(&pwin->mutex);
@@ -1285,6 +2852,9 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     EGLAttrib platformAttribs[15];
     EGLAttrib *internalAttribs = NULL;
     uint32_t eventMask;
+    pthread_condattr_t condAttr;
+    int i;
+    X11_ROUNDTRIP_ENTRY("eglCreateWindowSurface");
 
     if (xwin == 0)
     {
@@ -1330,63 +2900,119 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         pwin = NULL;
         goto done;
     }
+    pthread_mutex_init(&pwin->deferred.mutex, NULL);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pwin->deferred.cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
     glvnd_list_init(&pwin->color_buffers);
     glvnd_list_init(&pwin->prime_buffers);
+    for (i=0; i<FRAME_TIMING_HISTORY; i++)
+    {
+        pwin->frame_timings[i].acquire_fd = -1;
+        pwin->frame_timings[i].release_fd = -1;
+    }
+    pwin->timing_acquire_fd = -1;
+    pwin->front.syncfd = -1;
     surf->priv = (EplImplSurface *) pwin;
     pwin->inst = eplX11DisplayInstanceRef(inst);
     pwin->xwin = xwin;
     pwin->format = fmt;
     pwin->modifier = DRM_FORMAT_MOD_INVALID;
-    pwin->swap_interval = 1;
 
-    if (!FindSupportedModifiers(inst, fmt, xwin, &mods, &numMods, &prime))
+    if (inst->present_conn != inst->conn)
+    {
+        /*
+         * If we're using a separate connection for presentation, then the
+         * server might not have processed the request that created the window
+         * yet. Do a round-trip on the application's connection to make sure
+         * the window exists before we try to use it from ours.
+         */
+        xcb_get_input_focus_reply_t *focusReply = X11_ROUNDTRIP(xcb_get_input_focus_reply(inst->conn,
+                xcb_get_input_focus(inst->conn), NULL));
+        free(focusReply);
+    }
+
+    // This is set below once we know how we're going to synchronize with the
+    // server, unless a profile overrides it.
+    pwin->policy.max_color_buffers = -1;
+    pwin->policy.max_pending_frames = MAX_PENDING_FRAMES;
+    pwin->policy.prime = X11_PRIME_POLICY_AUTO;
+    pwin->policy.sync = X11_SYNC_POLICY_AUTO;
+    pwin->policy.modifiers = X11_MODIFIER_POLICY_OPTIMAL;
+    pwin->policy.trim_idle_frames = 0;
+    pwin->policy.swap_interval = 1;
+    pwin->policy.max_fps = inst->max_fps;
+    pwin->policy.hidden_fps = inst->hidden_fps;
+    pwin->policy.vrr = inst->vrr;
+    eplX11ApplyPresentProfiles(inst->present_conn, xwin, &pwin->policy);
+    pwin->swap_interval = pwin->policy.swap_interval;
+
+    if (!FindSupportedModifiers(inst, fmt, xwin, pwin->policy.prime, &mods, &numMods, &prime))
     {
         eplSetError(plat, EGL_BAD_CONFIG, "No matching format modifiers for window");
         goto done;
     }
 
-    presentCapsCookie = xcb_present_query_capabilities(inst->conn, xwin);
-    presentCapsReply = xcb_present_query_capabilities_reply(inst->conn, presentCapsCookie, &error);
-    if (presentCapsReply == NULL)
+    if (!inst->software_present)
     {
-        eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Failed to query present capabilities for window 0x%x", xwin);
-        goto done;
-    }
-    pwin->present_capabilities = presentCapsReply->capabilities;
-    if ((pwin->present_capabilities & XCB_PRESENT_CAPABILITY_SYNCOBJ) && inst->supports_explicit_sync)
-    {
-        pwin->use_explicit_sync = EGL_TRUE;
-    }
+        presentCapsCookie = xcb_present_query_capabilities(inst->present_conn, xwin);
+        presentCapsReply = X11_ROUNDTRIP(xcb_present_query_capabilities_reply(inst->present_conn, presentCapsCookie, &error));
+        if (presentCapsReply == NULL)
+        {
+            eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Failed to query present capabilities for window 0x%x", xwin);
+            goto done;
+        }
+        pwin->present_capabilities = presentCapsReply->capabilities;
+        if ((pwin->present_capabilities & XCB_PRESENT_CAPABILITY_SYNCOBJ) && inst->supports_explicit_sync
+                && pwin->policy.sync != X11_SYNC_POLICY_IMPLICIT)
+        {
+            pwin->use_explicit_sync = EGL_TRUE;
+        }
 
-    /*
-     * Send the PresentSelectInput event first. If we sent the
-     * XGetWindowAttributes request first, then it would be possible for the
-     * window to be resized after the XGetWindowAttributes and before the
-     * PresentSelectInput, and we wouldn't see the new size.
-     *
-     * Note that if we have explicit sync support, then we'll wait on the
-     * timeline sync objects to know when a buffer frees up. Otherwise, we need
-     * to keep track of PresentIdleNotify events.
-     */
-    eventMask = XCB_PRESENT_EVENT_MASK_CONFIGURE_NOTIFY | XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY;
-    if (!pwin->use_explicit_sync)
-    {
-        eventMask |= XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY;
+        /*
+         * Send the PresentSelectInput event first. If we sent the
+         * XGetWindowAttributes request first, then it would be possible for the
+         * window to be resized after the XGetWindowAttributes and before the
+         * PresentSelectInput, and we wouldn't see the new size.
+         *
+         * Note that if we have explicit sync support, then we'll wait on the
+         * timeline sync objects to know when a buffer frees up. Otherwise, we need
+         * to keep track of PresentIdleNotify events.
+         */
+        eventMask = XCB_PRESENT_EVENT_MASK_CONFIGURE_NOTIFY | XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY;
+        if (!pwin->use_explicit_sync)
+        {
+            eventMask |= XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY;
+        }
+        pwin->present_event_id = xcb_generate_id(inst->present_conn);
+        pwin->present_event = xcb_register_for_special_xge(inst->present_conn,
+                &xcb_present_id, pwin->present_event_id, &pwin->present_event_stamp);
+        presentSelectCookie = xcb_present_select_input_checked(inst->present_conn,
+                pwin->present_event_id, xwin, eventMask);
+        error = X11_ROUNDTRIP(xcb_request_check(inst->present_conn, presentSelectCookie));
+        if (error != NULL)
+        {
+            eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Invalid window 0x%x", xwin);
+            goto done;
+        }
     }
-    pwin->present_event_id = xcb_generate_id(inst->conn);
-    pwin->present_event = xcb_register_for_special_xge(inst->conn,
-            &xcb_present_id, pwin->present_event_id, &pwin->present_event_stamp);
-    presentSelectCookie = xcb_present_select_input_checked(inst->conn,
-            pwin->present_event_id, xwin, eventMask);
-    error = xcb_request_check(inst->conn, presentSelectCookie);
-    if (error != NULL)
+
+    if (pwin->policy.max_color_buffers < 0)
     {
-        eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Invalid window 0x%x", xwin);
-        goto done;
+        if (!inst->software_present && !pwin->use_explicit_sync && !inst->supports_implicit_sync)
+        {
+            // We'll use idle fences, so we don't need as many buffers.
+            pwin->policy.max_color_buffers = IDLE_FENCE_MAX_COLOR_BUFFERS;
+        }
+        else
+        {
+            pwin->policy.max_color_buffers = DEFAULT_MAX_COLOR_BUFFERS;
+        }
     }
 
-    winodwAttribCookie = xcb_get_window_attributes(inst->conn, xwin);
-    windowAttribReply = xcb_get_window_attributes_reply(inst->conn, winodwAttribCookie, &error);
+    winodwAttribCookie = xcb_get_window_attributes(inst->present_conn, xwin);
+    windowAttribReply = X11_ROUNDTRIP(xcb_get_window_attributes_reply(inst->present_conn, winodwAttribCookie, &error));
     if (windowAttribReply == NULL)
     {
         eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Invalid window 0x%x", xwin);
@@ -1399,8 +3025,36 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         goto done;
     }
 
-    geomCookie = xcb_get_geometry(inst->conn, xwin);
-    geomReply = xcb_get_geometry_reply(inst->conn, geomCookie, &error);
+    if (pwin->policy.vrr && !inst->software_present)
+    {
+        pwin->vrr = SetVariableRefresh(pwin, EGL_TRUE);
+    }
+
+    // Applications often create the surface before they map the window, so
+    // the map state from here is usually stale by the first eglSwapBuffers
+    // call. Treat the window as visible until CheckWindowVisible gets a
+    // reply or a VisibilityNotify event says otherwise.
+    pwin->visibility.viewable = EGL_TRUE;
+    pwin->visibility.state = XCB_VISIBILITY_UNOBSCURED;
+    if (pwin->policy.hidden_fps != 0 && inst->present_conn != inst->conn)
+    {
+        /*
+         * With a private connection, we can also select for VisibilityNotify
+         * events to find out when the window is completely covered. Event
+         * masks are per-client, so this doesn't affect the application's
+         * own event mask.
+         */
+        uint32_t mask = XCB_EVENT_MASK_VISIBILITY_CHANGE;
+        xcb_change_window_attributes(inst->present_conn, xwin, XCB_CW_EVENT_MASK, &mask);
+
+        pthread_mutex_lock(&inst->visibility_mutex);
+        glvnd_list_add(&pwin->visibility.entry, &inst->visibility_windows);
+        pthread_mutex_unlock(&inst->visibility_mutex);
+        pwin->visibility.tracking_events = EGL_TRUE;
+    }
+
+    geomCookie = xcb_get_geometry(inst->present_conn, xwin);
+    geomReply = X11_ROUNDTRIP(xcb_get_geometry_reply(inst->present_conn, geomCookie, &error));
     if (geomReply == NULL)
     {
         eplSetError(plat, EGL_BAD_NATIVE_WINDOW, "Invalid window 0x%x", xwin);
@@ -1415,6 +3069,17 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     pwin->pending_width = geomReply->width;
     pwin->pending_height = geomReply->height;
 
+    if (inst->software_present)
+    {
+        assert(prime);
+        pwin->software = eplX11SoftwarePresentCreate(inst, xwin, geomReply->depth, fmt->fmt);
+        if (pwin->software == NULL)
+        {
+            eplSetError(plat, EGL_BAD_MATCH, "Unsupported image format for window 0x%x", xwin);
+            goto done;
+        }
+    }
+
     if (!AllocWindowBuffers(surf, mods, numMods, prime))
     {
         eplSetError(plat, EGL_BAD_ALLOC, "Can't allocate color buffers");
@@ -1492,7 +3157,7 @@ void eplX11DestroyWindow(EplSurface *surf)
      * implementation would try to take the driver's mutex, which would lead to
      * a deadlock.
      */
-    if (internalSurf != EGL_NO_SURFACE)
+    if (internalSurf != EGL_NO_SURFACE && !pwin->inst->platform->exiting)
     {
         pwin->inst->platform->egl.DestroySurface(pwin->inst->internal_display->edpy, internalSurf);
     }
@@ -1547,7 +3212,7 @@ static EGLBoolean WaitForWindowEvents(EplDisplay *pdpy, EplSurface *surf)
     pthread_mutex_unlock(&pwin->mutex);
     eplDisplayUnlock(pdpy);
 
-    xcbevt = xcb_wait_for_special_event(pwin->inst->conn, pwin->present_event);
+    xcbevt = xcb_wait_for_special_event(pwin->inst->present_conn, pwin->present_event);
 
     eplDisplayLock(pdpy);
     pthread_mutex_lock(&pwin->mutex);
@@ -1583,6 +3248,180 @@ static EGLBoolean WaitForWindowEvents(EplDisplay *pdpy, EplSurface *surf)
     return EGL_TRUE;
 }
 
+/**
+ * The helper thread for deferred presentation.
+ *
+ * This waits for the fence from eglSwapBuffers, and then sends the
+ * PresentPixmap request. It also sends coalesced front buffer presents once
+ * \c deferred.front_deadline passes.
+ */
+static void *DeferredPresentThread(void *param)
+{
+    EplSurface *surf = param;
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11DisplayInstance *inst = pwin->inst;
+
+    pthread_mutex_lock(&pwin->deferred.mutex);
+    while (1)
+    {
+        EGLSync sync;
+        X11ColorBuffer *buffer;
+        uint32_t options;
+        EGLBoolean freeBuffer;
+        uint64_t presentId;
+
+        while (pwin->deferred.sync == EGL_NO_SYNC && !pwin->deferred.quit)
+        {
+            if (pwin->deferred.front_deadline == 0)
+            {
+                pthread_cond_wait(&pwin->deferred.cond, &pwin->deferred.mutex);
+            }
+            else if (eplGetMonotonicTime() < pwin->deferred.front_deadline)
+            {
+                struct timespec ts;
+                ts.tv_sec = pwin->deferred.front_deadline / 1000000000ULL;
+                ts.tv_nsec = pwin->deferred.front_deadline % 1000000000ULL;
+                pthread_cond_timedwait(&pwin->deferred.cond, &pwin->deferred.mutex, &ts);
+            }
+            else
+            {
+                pwin->deferred.front_deadline = 0;
+                pthread_mutex_unlock(&pwin->deferred.mutex);
+
+                pthread_mutex_lock(&pwin->mutex);
+                DeferredFrontBufferPresent(surf);
+                pthread_mutex_unlock(&pwin->mutex);
+
+                pthread_mutex_lock(&pwin->deferred.mutex);
+            }
+        }
+        if (pwin->deferred.sync == EGL_NO_SYNC)
+        {
+            break;
+        }
+
+        sync = pwin->deferred.sync;
+        buffer = pwin->deferred.buffer;
+        options = pwin->deferred.options;
+        presentId = pwin->deferred.present_id;
+        pthread_mutex_unlock(&pwin->deferred.mutex);
+
+        // Note that we have to call into the driver without holding the
+        // window mutex. See the comment on X11Window::mutex.
+        inst->platform->priv->egl.ClientWaitSync(inst->internal_display->edpy,
+                sync, 0, EGL_FOREVER);
+        inst->platform->priv->egl.DestroySync(inst->internal_display->edpy, sync);
+
+        pthread_mutex_lock(&pwin->mutex);
+        if (!surf->deleted && !pwin->native_destroyed)
+        {
+            // Software presents are never deferred. See SyncRendering.
+            assert(pwin->software == NULL);
+            SendPresentPixmap(surf, buffer, options, presentId);
+        }
+
+        pthread_mutex_lock(&pwin->deferred.mutex);
+        freeBuffer = pwin->deferred.free_buffer;
+        pwin->deferred.sync = EGL_NO_SYNC;
+        pwin->deferred.buffer = NULL;
+        pwin->deferred.free_buffer = EGL_FALSE;
+        pthread_cond_broadcast(&pwin->deferred.cond);
+        pthread_mutex_unlock(&pwin->deferred.mutex);
+
+        pthread_mutex_unlock(&pwin->mutex);
+
+        if (freeBuffer)
+        {
+            // The window's buffers were reallocated while this one was
+            // waiting, so nothing else refers to it anymore.
+            FreeColorBuffer(inst, buffer);
+        }
+
+        pthread_mutex_lock(&pwin->deferred.mutex);
+    }
+    pthread_mutex_unlock(&pwin->deferred.mutex);
+
+    return NULL;
+}
+
+/**
+ * Hands off a PresentPixmap request to the deferred present thread.
+ *
+ * The thread will wait for \p sync, send the request, and then destroy
+ * \p sync.
+ *
+ * The caller must have already waited for any previous deferred present
+ * using WaitForDeferredPresent.
+ */
+static void QueueDeferredPresent(EplSurface *surf, X11ColorBuffer *buffer,
+        uint32_t options, uint64_t present_id, EGLSync sync)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    if (!StartDeferredPresentThread(surf))
+    {
+        // If we can't start the thread, then just wait for the fence here.
+        pwin->inst->platform->priv->egl.ClientWaitSync(pwin->inst->internal_display->edpy,
+                sync, 0, EGL_FOREVER);
+        pwin->inst->platform->priv->egl.DestroySync(pwin->inst->internal_display->edpy, sync);
+        SendPresentPixmap(surf, buffer, options, present_id);
+        return;
+    }
+
+    // Mark the buffer as in use now, so that nothing else tries to grab it
+    // before the helper thread gets around to presenting it.
+    buffer->status = BUFFER_STATUS_IN_USE;
+
+    pthread_mutex_lock(&pwin->deferred.mutex);
+    assert(pwin->deferred.sync == EGL_NO_SYNC);
+    pwin->deferred.sync = sync;
+    pwin->deferred.buffer = buffer;
+    pwin->deferred.options = options;
+    pwin->deferred.present_id = present_id;
+    pthread_cond_broadcast(&pwin->deferred.cond);
+    pthread_mutex_unlock(&pwin->deferred.mutex);
+}
+
+/**
+ * Waits for the deferred present thread to send any pending PresentPixmap
+ * request.
+ *
+ * Like WaitForWindowEvents, this will unlock the surface and the display while
+ * waiting, so the caller must check the EplSurface::deleted flag afterward.
+ */
+static void WaitForDeferredPresent(EplDisplay *pdpy, EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    EGLBoolean pending;
+
+    if (!pwin->deferred.thread_started)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pwin->deferred.mutex);
+    pending = (pwin->deferred.sync != EGL_NO_SYNC);
+    pthread_mutex_unlock(&pwin->deferred.mutex);
+
+    if (!pending)
+    {
+        return;
+    }
+
+    pthread_mutex_unlock(&pwin->mutex);
+    eplDisplayUnlock(pdpy);
+
+    pthread_mutex_lock(&pwin->deferred.mutex);
+    while (pwin->deferred.sync != EGL_NO_SYNC)
+    {
+        pthread_cond_wait(&pwin->deferred.cond, &pwin->deferred.mutex);
+    }
+    pthread_mutex_unlock(&pwin->deferred.mutex);
+
+    eplDisplayLock(pdpy);
+    pthread_mutex_lock(&pwin->mutex);
+}
+
 /**
  * Flush the command stream, and set up synchronization.
  *
@@ -1591,28 +3430,66 @@ static EGLBoolean WaitForWindowEvents(EplDisplay *pdpy, EplSurface *surf)
  * Otherwise, this will fall back to using implicit sync if it's available, or
  * a simple glFinish if it's not.
  *
+ * If we don't have EGL_ANDROID_native_fence_sync, but we do have
+ * EGL_KHR_fence_sync, then this will return a fence in \p ret_deferred_sync
+ * instead of calling glFinish. In that case, the caller must wait for the
+ * fence before it sends the PresentPixmap request.
+ *
  * \param surf The window surface
  * \param buffer The shared buffer (either a render or a pitch linear buffer)
+ * \param[out] ret_deferred_sync Returns a fence to wait on before presenting,
+ *      or EGL_NO_SYNC if the buffer can be presented right away.
  * \return EGL_TRUE on success, or EGL_FALSE on failure.
  */
-static EGLBoolean SyncRendering(EplDisplay *pdpy, EplSurface *surf, X11ColorBuffer *buffer)
+static EGLBoolean SyncRendering(EplDisplay *pdpy, EplSurface *surf, X11ColorBuffer *buffer,
+        EGLSync *ret_deferred_sync)
 {
     X11Window *pwin = (X11Window *) surf->priv;
     int syncFd = -1;
     EGLSync sync = EGL_NO_SYNC;
     EGLBoolean success = EGL_FALSE;
 
-    if (!pwin->inst->supports_EGL_ANDROID_native_fence_sync)
+    *ret_deferred_sync = EGL_NO_SYNC;
+
+    if (!pwin->inst->supports_EGL_ANDROID_native_fence_sync || pwin->software != NULL)
     {
-        // If we don't have EGL_ANDROID_native_fence_sync, then we can't do
-        // anything other than a glFinish here.
+        // If we don't have EGL_ANDROID_native_fence_sync, then we can't pass
+        // a fence to the server. If we can, then create a regular fence so
+        // that a helper thread can wait for rendering to finish. Otherwise,
+        // we can't do anything other than a glFinish here.
+        //
+        // With software presentation, we have to read the buffer back on the
+        // CPU, so a fence for the server wouldn't help anyway. We also can't
+        // hand the present off to the helper thread, because reading the
+        // buffer back means mapping it through GBM, and the helper thread
+        // would have to do that while holding the window's mutex.
         assert(!pwin->use_explicit_sync);
+        if (pwin->inst->supports_EGL_KHR_fence_sync && pwin->software == NULL)
+        {
+            pwin->inst->platform->priv->egl.Flush();
+            sync = pwin->inst->platform->priv->egl.CreateSync(pwin->inst->internal_display->edpy,
+                    EGL_SYNC_FENCE, NULL);
+            if (sync != EGL_NO_SYNC)
+            {
+                *ret_deferred_sync = sync;
+                return EGL_TRUE;
+            }
+        }
         pwin->inst->platform->priv->egl.Finish();
         return EGL_TRUE;
     }
 
     pwin->inst->platform->priv->egl.Flush();
 
+    // If the driver can signal the timeline point directly, then we don't
+    // need a sync FD at all. We still need one for traces, though, to find
+    // out when rendering finished.
+    if (pwin->use_explicit_sync && !eplX11TraceEnabled()
+            && eplX11TimelineSignalRendering(pwin->inst, &buffer->timeline))
+    {
+        return EGL_TRUE;
+    }
+
     sync = pwin->inst->platform->priv->egl.CreateSync(pwin->inst->internal_display->edpy,
             EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
     if (sync == EGL_NO_SYNC)
@@ -1626,6 +3503,17 @@ static EGLBoolean SyncRendering(EplDisplay *pdpy, EplSurface *surf, X11ColorBuff
         goto done;
     }
 
+    if (eplX11TraceEnabled())
+    {
+        // Hang on to the fence so that we can read the time that rendering
+        // finished later on.
+        if (pwin->timing_acquire_fd >= 0)
+        {
+            close(pwin->timing_acquire_fd);
+        }
+        pwin->timing_acquire_fd = dup(syncFd);
+    }
+
     if (pwin->use_explicit_sync)
     {
         // If we support explicit sync, then always use that.
@@ -1668,37 +3556,6 @@ done:
     return success;
 }
 
-/**
- * Waits for a sync FD using eglWaitSync.
- *
- * Using eglWaitSync means that the GPU will wait for the fence, without
- * doing a CPU stall.
- *
- * \param inst The X11DisplayInstance
- * \param syncfd The sync file descriptor. This must be a regular fence.
- */
-static EGLBoolean WaitForSyncFDGPU(X11DisplayInstance *inst, int syncfd)
-{
-    EGLBoolean success = EGL_FALSE;
-
-    if (syncfd >= 0)
-    {
-        const EGLAttrib syncAttribs[] =
-        {
-            EGL_SYNC_NATIVE_FENCE_FD_ANDROID, syncfd,
-            EGL_NONE
-        };
-        EGLSync sync = inst->platform->priv->egl.CreateSync(inst->internal_display->edpy,
-                EGL_SYNC_NATIVE_FENCE_ANDROID, syncAttribs);
-        if (sync != EGL_NO_SYNC)
-        {
-            success = inst->platform->priv->egl.WaitSync(inst->internal_display->edpy, sync, 0);
-            inst->platform->priv->egl.DestroySync(inst->internal_display->edpy, sync);
-        }
-    }
-    return success;
-}
-
 static EGLBoolean WaitImplicitFence(EplDisplay *pdpy, X11ColorBuffer *buffer)
 {
     EGLBoolean success = EGL_FALSE;
@@ -1709,7 +3566,7 @@ static EGLBoolean WaitImplicitFence(EplDisplay *pdpy, X11ColorBuffer *buffer)
     fd = eplX11ExportDmaBufSyncFile(pdpy->priv->inst, buffer->fd);
     if (fd >= 0)
     {
-        success = WaitForSyncFDGPU(pdpy->priv->inst, fd);
+        success = eplX11WaitForSyncFDGPU(pdpy->priv->inst, fd);
         close(fd);
     }
 
@@ -1834,16 +3691,91 @@ static int CheckBufferReleaseImplicit(EplDisplay *pdpy, EplSurface *surf,
 }
 
 /**
- * Checks for a free buffer, without any sort of server -> client sync.
+ * Waits for an idle fence to be triggered, with a timeout.
+ *
+ * xshmfence doesn't have a way to wait with a timeout, so this just polls.
+ * We only get here if the fence was still untriggered when the
+ * PresentIdleNotify event arrived, which means that the server's driver is
+ * holding the trigger until its own rendering with the buffer finishes, so we
+ * don't expect to wait very long.
+ *
+ * \return EGL_TRUE if the fence was triggered, or EGL_FALSE on timeout.
+ */
+static EGLBoolean WaitForIdleFence(struct xshmfence *fence, int timeout_ms)
+{
+    static const struct timespec POLL_INTERVAL = { 0, 250000 };
+    uint64_t deadline = eplGetMonotonicTime() + ((uint64_t) timeout_ms) * 1000000ULL;
+
+    while (!xshmfence_query(fence))
+    {
+        if (eplGetMonotonicTime() >= deadline)
+        {
+            return EGL_FALSE;
+        }
+        nanosleep(&POLL_INTERVAL, NULL);
+    }
+    return EGL_TRUE;
+}
+
+/**
+ * Marks every buffer that we've received a PresentIdleNotify event for as
+ * idle, without checking for an idle fence.
+ *
+ * Without an idle fence, the best we can do is to hope that the buffer really
+ * is idle by the time we start rendering to it again.
+ *
+ * \return The number of buffers that are now idle.
+ */
+static int ReleaseIdleNotifiedBuffers(struct glvnd_list *buffer_list, X11ColorBuffer *skip)
+{
+    X11ColorBuffer *buffer;
+    int numReleased = 0;
+
+    glvnd_list_for_each_entry(buffer, buffer_list, entry)
+    {
+        if (buffer != skip && buffer->status == BUFFER_STATUS_IDLE_NOTIFIED)
+        {
+            buffer->status = BUFFER_STATUS_IDLE;
+            numReleased++;
+        }
+    }
+    return numReleased;
+}
+
+/**
+ * Checks for a free buffer, without any sort of implicit or explicit sync.
+ *
+ * In this case, we wait for a PresentIdleNotify event, and then check the
+ * buffer's idle fence. The server triggers the fence just before it sends the
+ * event, unless its driver holds the trigger until it's finished rendering
+ * with the buffer, so normally the fence is already triggered by the time we
+ * get here.
+ *
+ * A buffer without an idle fence is treated as idle as soon as the
+ * PresentIdleNotify event arrives.
+ *
+ * \param pdpy The EplDisplay pointer.
+ * \param surf The EplSurface pointer.
+ * \param buffer_list The list of buffers to check.
+ * \param skip If not NULL, then ignore this buffer when checking the rest.
+ * \param timeout_ms The number of milliseconds to wait for an idle fence.
+ *      Zero to poll without blocking.
  *
- * Without any server -> client synchronization, the best we can do is to
- * wait for a PresentIdleNotify event, and then hope that the buffer really is
- * idle by the time we start rendering to it again.
+ * \return The number of buffers that are now idle or still waiting on an
+ *      idle fence, or -1 if we couldn't wait for an idle fence or it wasn't
+ *      triggered before the timeout. In that case, any buffers that are
+ *      waiting on an idle fence are left in BUFFER_STATUS_IDLE_NOTIFIED, and
+ *      the caller can fall back to ReleaseIdleNotifiedBuffers.
  */
 static int CheckBufferReleaseNoSync(EplDisplay *pdpy, EplSurface *surf,
-        struct glvnd_list *buffer_list, X11ColorBuffer *skip)
+        struct glvnd_list *buffer_list, X11ColorBuffer *skip, int timeout_ms)
 {
+    X11Window *pwin = (X11Window *) surf->priv;
     X11ColorBuffer *buffer;
+    struct xshmfence *fence = NULL;
+    EGLBoolean triggered = EGL_FALSE;
+    int waitFd = -1;
+    int numReleased = 0;
     int numPending = 0;
 
     PollForWindowEvents(surf);
@@ -1852,12 +3784,83 @@ static int CheckBufferReleaseNoSync(EplDisplay *pdpy, EplSurface *surf,
     {
         if (buffer != skip && buffer->status == BUFFER_STATUS_IDLE_NOTIFIED)
         {
-            buffer->status = BUFFER_STATUS_IDLE;
-            numPending++;
+            if (buffer->idle_fence == NULL || xshmfence_query(buffer->idle_fence))
+            {
+                buffer->status = BUFFER_STATUS_IDLE;
+                numReleased++;
+            }
+            else
+            {
+                if (waitFd < 0)
+                {
+                    waitFd = buffer->idle_fence_fd;
+                }
+                numPending++;
+            }
+        }
+    }
+
+    if (numReleased > 0 || numPending == 0 || timeout_ms == 0)
+    {
+        return (numReleased > 0 ? numReleased : numPending);
+    }
+
+    /*
+     * Every buffer that the server has released is still waiting on its idle
+     * fence. Map our own copy of one of those fences, so that it stays valid
+     * even if another thread frees the buffer while we've got the window
+     * unlocked, and then wait for it.
+     */
+    if (waitFd >= 0)
+    {
+        int fd = dup(waitFd);
+        if (fd >= 0)
+        {
+            fence = xshmfence_map_shm(fd);
+            close(fd);
+        }
+    }
+
+    if (fence == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_unlock(&pwin->mutex);
+    eplDisplayUnlock(pdpy);
+
+    triggered = WaitForIdleFence(fence, timeout_ms);
+    xshmfence_unmap_shm(fence);
+
+    eplDisplayLock(pdpy);
+    pthread_mutex_lock(&pwin->mutex);
+
+    if (surf->deleted)
+    {
+        return numPending;
+    }
+    if (!triggered)
+    {
+        return -1;
+    }
+
+    /*
+     * Check the buffer list again, since any of the buffers could have been
+     * freed or replaced while we didn't have the window locked.
+     */
+    glvnd_list_for_each_entry(buffer, buffer_list, entry)
+    {
+        if (buffer != skip && buffer->status == BUFFER_STATUS_IDLE_NOTIFIED)
+        {
+            if (buffer->idle_fence == NULL || xshmfence_query(buffer->idle_fence))
+            {
+                buffer->status = BUFFER_STATUS_IDLE;
+                numReleased++;
+            }
         }
     }
 
-    return numPending;
+    return (numReleased > 0 ? numReleased : numPending);
 }
 
 /**
@@ -1868,12 +3871,18 @@ static int CheckBufferReleaseNoSync(EplDisplay *pdpy, EplSurface *surf,
  */
 static EGLBoolean WaitTimelinePoint(X11DisplayInstance *inst, X11Timeline *timeline)
 {
-    int syncfd = eplX11TimelinePointToSyncFD(inst, timeline);
+    int syncfd;
     EGLBoolean success = EGL_FALSE;
 
+    if (eplX11TimelineWaitGPU(inst, timeline))
+    {
+        return EGL_TRUE;
+    }
+
+    syncfd = eplX11TimelinePointToSyncFD(inst, timeline);
     if (syncfd >= 0)
     {
-        success = WaitForSyncFDGPU(inst, syncfd);
+        success = eplX11WaitForSyncFDGPU(inst, syncfd);
     }
 
     if (!success)
@@ -2035,6 +4044,7 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
     X11Window *pwin = (X11Window *) surf->priv;
     struct glvnd_list *buffers;
     int maxBuffers;
+    EGLBoolean waited = EGL_FALSE;
 
     if (prime)
     {
@@ -2045,7 +4055,7 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
     else
     {
         buffers = &pwin->color_buffers;
-        maxBuffers = MAX_COLOR_BUFFERS;
+        maxBuffers = pwin->policy.max_color_buffers;
     }
 
     /*
@@ -2068,120 +4078,540 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
     }
     else
     {
-        if (CheckBufferReleaseNoSync(pdpy, surf, buffers, skip) < 0)
+        CheckBufferReleaseNoSync(pdpy, surf, buffers, skip, 0);
+    }
+
+    while (!surf->deleted && !pwin->native_destroyed)
+    {
+        X11ColorBuffer *buffer = NULL;
+        int numBuffers = 0;
+
+        // Look to see if a buffer is already free.
+        glvnd_list_for_each_entry(buffer, buffers, entry)
         {
-            return NULL;
+            if (buffer->status == BUFFER_STATUS_IDLE && buffer != skip)
+            {
+                if (waited)
+                {
+                    eplX11TraceRecord(X11_TRACE_BUFFER_WAIT_END, pwin->xwin,
+                            buffer->timing_serial, numBuffers, 0, 0);
+                }
+                RecordBufferRelease(pwin, buffer);
+                return buffer;
+            }
+            numBuffers++;
+        }
+
+        if (numBuffers < maxBuffers)
+        {
+            // We didn't find a free buffer, but we don't have our maximum
+            // number of buffers yet, so allocate a new one.
+            if (prime)
+            {
+                buffer = AllocatePrimeBuffer(pwin->inst, pwin->format->fourcc, pwin->width, pwin->height);
+            }
+            else
+            {
+                buffer = AcquireColorBuffer(pwin, pwin->format->fmt, pwin->width, pwin->height,
+                        &pwin->modifier, 1, !pwin->prime);
+            }
+            if (buffer == NULL)
+            {
+                return NULL;
+            }
+            glvnd_list_add(&buffer->entry, buffers);
+            return buffer;
+        }
+
+        // Otherwise, we have to wait for a buffer to free up.
+        if (!waited)
+        {
+            eplX11TraceRecord(X11_TRACE_BUFFER_WAIT_BEGIN, pwin->xwin, 0, numBuffers, 0, 0);
+            waited = EGL_TRUE;
+        }
+
+        if (pwin->use_explicit_sync)
+        {
+            /*
+             * With explicit sync, we can just wait on every buffer, even if we
+             * haven't gotten a PresentIdleNotify event.
+             *
+             * We do still poll for window events, though, in case the native
+             * window gets destroyed while we're waiting.
+             */
+            if (CheckBufferReleaseExplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT) <= 0)
+            {
+                return NULL;
+            }
+
+            PollForWindowEvents(surf);
+        }
+        else
+        {
+            int numChecked;
+
+            if (pwin->inst->supports_implicit_sync)
+            {
+                numChecked = CheckBufferReleaseImplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT);
+            }
+            else
+            {
+                numChecked = CheckBufferReleaseNoSync(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT);
+                if (numChecked < 0)
+                {
+                    /*
+                     * We couldn't wait for an idle fence, so fall back to
+                     * trusting the PresentIdleNotify events, rather than
+                     * blocking eglSwapBuffers indefinitely.
+                     */
+                    numChecked = ReleaseIdleNotifiedBuffers(buffers, skip);
+                }
+            }
+            if (numChecked < 0)
+            {
+                return NULL;
+            }
+            else if (numChecked == 0)
+            {
+                /*
+                 * There weren't any buffers to wait on yet, so wait for a
+                 * present event.
+                 *
+                 * If we receieve a PresentIdleNotify event, then HandlePresentEvent
+                 * will mark the corresponding buffer as ready to wait on, and then
+                 * CheckBufferReleaseImplicit/NoSync will find it on the next pass
+                 * through this loop.
+                 */
+                if (!WaitForWindowEvents(pdpy, surf))
+                {
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Releases any idle buffers that haven't been presented in a while.
+ *
+ * This only does anything if a profile sets \c trim-idle-frames. It lets a
+ * window that only needed extra buffers for a short time give them back.
+ *
+ * \param pwin The window.
+ * \param buffers The list of buffers to trim.
+ * \param pool If true, then add the trimmed buffers to the display's buffer
+ *      pool instead of freeing them, like FreeWindowBuffers does.
+ */
+static void TrimIdleBuffers(X11Window *pwin, struct glvnd_list *buffers, EGLBoolean pool)
+{
+    X11ColorBuffer *buffer, *tmp;
+
+    if (pwin->policy.trim_idle_frames == 0)
+    {
+        return;
+    }
+
+    glvnd_list_for_each_entry_safe(buffer, tmp, buffers, entry)
+    {
+        if (buffer->status != BUFFER_STATUS_IDLE
+                || buffer == pwin->current_front
+                || buffer == pwin->current_back
+                || buffer == pwin->current_prime)
+        {
+            continue;
+        }
+
+        if (pwin->last_present_serial - buffer->last_present_serial > pwin->policy.trim_idle_frames)
+        {
+            glvnd_list_del(&buffer->entry);
+            if (!pool || !PoolColorBuffer(pwin, buffer))
+            {
+                FreeColorBuffer(pwin->inst, buffer);
+            }
+        }
+    }
+}
+
+/**
+ * Checks for a window resize with software presentation.
+ *
+ * This picks up the reply to the GetGeometry request from the previous frame,
+ * and then sends a new one for the next frame.
+ */
+static void CheckSoftwareWindowSize(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    if (pwin->software_geom_pending)
+    {
+        xcb_generic_error_t *error = NULL;
+        xcb_get_geometry_reply_t *reply = X11_ROUNDTRIP(xcb_get_geometry_reply(pwin->inst->present_conn,
+                pwin->software_geom_cookie, &error));
+
+        pwin->software_geom_pending = EGL_FALSE;
+        if (reply == NULL)
+        {
+            // GetGeometry can only fail if the window is gone.
+            pwin->native_destroyed = EGL_TRUE;
+            free(error);
+            return;
+        }
+
+        pwin->pending_width = reply->width;
+        pwin->pending_height = reply->height;
+        free(reply);
+    }
+
+    pwin->software_geom_cookie = xcb_get_geometry(pwin->inst->present_conn, pwin->xwin);
+    pwin->software_geom_pending = EGL_TRUE;
+}
+
+/**
+ * Sets the region to update for a software present, using the damage rects
+ * from eglSwapBuffersWithDamageKHR.
+ *
+ * We only upload the bounding box of the damage rects, which keeps things
+ * simple and still avoids the biggest cost for apps that only redraw a small
+ * part of the window.
+ */
+static void SetSoftwareDamage(X11Window *pwin, const EGLint *rects, EGLint n_rects)
+{
+    EGLint x1 = pwin->width;
+    EGLint y1 = pwin->height;
+    EGLint x2 = 0;
+    EGLint y2 = 0;
+    EGLint i;
+
+    if (rects == NULL || n_rects <= 0)
+    {
+        pwin->software_damage.x = pwin->software_damage.y = 0;
+        pwin->software_damage.width = pwin->width;
+        pwin->software_damage.height = pwin->height;
+        return;
+    }
+
+    for (i=0; i<n_rects; i++)
+    {
+        const EGLint *rect = &rects[i * 4];
+
+        // EGL uses a bottom-left origin, but X11 uses a top-left origin.
+        EGLint left = rect[0];
+        EGLint right = rect[0] + rect[2];
+        EGLint top = pwin->height - (rect[1] + rect[3]);
+        EGLint bottom = pwin->height - rect[1];
+
+        x1 = (left < x1 ? left : x1);
+        y1 = (top < y1 ? top : y1);
+        x2 = (right > x2 ? right : x2);
+        y2 = (bottom > y2 ? bottom : y2);
+    }
+
+    x1 = (x1 > 0 ? x1 : 0);
+    y1 = (y1 > 0 ? y1 : 0);
+    x2 = (x2 < pwin->width ? x2 : pwin->width);
+    y2 = (y2 < pwin->height ? y2 : pwin->height);
+
+    if (x2 > x1 && y2 > y1)
+    {
+        pwin->software_damage.x = x1;
+        pwin->software_damage.y = y1;
+        pwin->software_damage.width = x2 - x1;
+        pwin->software_damage.height = y2 - y1;
+    }
+    else
+    {
+        memset(&pwin->software_damage, 0, sizeof(pwin->software_damage));
+    }
+}
+
+static EGLBoolean CheckWindowDeleted(EplSurface *surf, EGLBoolean *ret_success)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    if (surf->deleted)
+    {
+        *ret_success = EGL_TRUE;
+        return EGL_TRUE;
+    }
+    else if (pwin->native_destroyed)
+    {
+        *ret_success = EGL_FALSE;
+        eplSetError(pwin->inst->platform, EGL_BAD_NATIVE_WINDOW, "The X11 window has been destroyed");
+        return EGL_TRUE;
+    }
+
+    return EGL_FALSE;
+}
+
+/**
+ * Waits until it's time to send the next frame, if the window has a frame
+ * rate limit.
+ *
+ * The deadlines advance by a fixed interval from one frame to the next, so
+ * the average frame rate matches the limit even if individual sleeps run
+ * long. If we know the refresh period, then each deadline is also moved to
+ * the middle of the nearest refresh cycle, using the UST of the last
+ * PresentCompleteNotify event as the reference. That way, frames land on
+ * consistent vblanks instead of drifting against them.
+ *
+ * This releases the window and display locks while it sleeps, so the caller
+ * has to check whether the surface was destroyed afterward.
+ *
+ * With variable refresh, there's no fixed refresh cycle to line up with, so
+ * the deadlines are used as they are.
+ *
+ * \param pdpy The display.
+ * \param surf The window surface.
+ * \param interval The minimum time between frames in nanoseconds, or 0 for
+ *      no limit.
+ */
+static void LimitFrameRate(EplDisplay *pdpy, EplSurface *surf, uint64_t interval)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t now;
+    uint64_t target;
+
+    if (interval == 0)
+    {
+        return;
+    }
+
+    now = eplGetMonotonicTime();
+
+    if (pwin->limiter.next_deadline == 0 || now > pwin->limiter.next_deadline + interval)
+    {
+        // This is either the first frame, or we've fallen more than a frame
+        // behind. Either way, start over from now instead of trying to
+        // catch up.
+        pwin->limiter.next_deadline = now;
+    }
+    target = pwin->limiter.next_deadline;
+    pwin->limiter.next_deadline += interval;
+
+    if (!pwin->vrr && pwin->refresh_period != 0 && pwin->last_complete_ust != 0
+            && interval >= pwin->refresh_period)
+    {
+        uint64_t period = pwin->refresh_period;
+        uint64_t origin = pwin->last_complete_ust * 1000;
+        if (target > origin)
+        {
+            uint64_t cycles = (target - origin + period / 2) / period;
+            target = origin + cycles * period;
+            if (target > period / 2)
+            {
+                target -= period / 2;
+            }
+        }
+    }
+
+    if (target > now)
+    {
+        struct timespec ts;
+        ts.tv_sec = target / 1000000000ULL;
+        ts.tv_nsec = target % 1000000000ULL;
+
+        // Release the locks while we wait, so that we don't block
+        // other threads.
+        pthread_mutex_unlock(&pwin->mutex);
+        eplDisplayUnlock(pdpy);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        {
+        }
+
+        eplDisplayLock(pdpy);
+        pthread_mutex_lock(&pwin->mutex);
+
+        now = eplGetMonotonicTime();
+    }
+
+    if (pwin->limiter.last_frame != 0)
+    {
+        uint64_t delta = now - pwin->limiter.last_frame;
+        uint64_t deviation;
+
+        if (pwin->limiter.avg_interval == 0)
+        {
+            pwin->limiter.avg_interval = delta;
+        }
+        else
+        {
+            pwin->limiter.avg_interval = (pwin->limiter.avg_interval * 7 + delta) / 8;
+        }
+        deviation = (delta > pwin->limiter.avg_interval)
+            ? delta - pwin->limiter.avg_interval
+            : pwin->limiter.avg_interval - delta;
+        pwin->limiter.jitter = (pwin->limiter.jitter * 7 + deviation) / 8;
+
+        eplX11TraceRecordAt(now, X11_TRACE_FRAME_LIMIT, pwin->xwin, pwin->last_present_serial + 1,
+                pwin->limiter.avg_interval ? (uint32_t) (1000000000000ULL / pwin->limiter.avg_interval) : 0,
+                0, pwin->limiter.jitter, 0);
+    }
+    pwin->limiter.last_frame = now;
+}
+
+/**
+ * Returns the minimum time between frames for a window, in nanoseconds, or 0
+ * if there's no limit.
+ *
+ * This is the interval from the window's frame rate limit, if it has one. With
+ * variable refresh, it's also at least the swap interval times the shortest
+ * refresh period, so that the swap interval still means the same thing as it
+ * would with a fixed refresh rate.
+ */
+static uint64_t GetFrameInterval(X11Window *pwin)
+{
+    uint64_t interval = 0;
+
+    if (pwin->policy.max_fps != 0)
+    {
+        interval = 1000000000ULL / pwin->policy.max_fps;
+    }
+
+    if (pwin->vrr && pwin->swap_interval > 0 && pwin->min_refresh_period != 0)
+    {
+        uint64_t vrrInterval = pwin->min_refresh_period * pwin->swap_interval;
+        if (vrrInterval > interval)
+        {
+            interval = vrrInterval;
         }
     }
 
-    while (!surf->deleted && !pwin->native_destroyed)
+    return interval;
+}
+
+/**
+ * Reads any pending VisibilityNotify events from the private present
+ * connection, and updates the state of the matching windows.
+ *
+ * The events for every window come through the same connection, so whichever
+ * window checks first handles all of them.
+ */
+static void ProcessVisibilityEvents(X11DisplayInstance *inst)
+{
+    xcb_generic_event_t *xcbevt;
+
+    pthread_mutex_lock(&inst->visibility_mutex);
+    while ((xcbevt = xcb_poll_for_event(inst->present_conn)) != NULL)
     {
-        X11ColorBuffer *buffer = NULL;
-        int numBuffers = 0;
-
-        // Look to see if a buffer is already free.
-        glvnd_list_for_each_entry(buffer, buffers, entry)
+        if ((xcbevt->response_type & ~0x80) == XCB_VISIBILITY_NOTIFY)
         {
-            if (buffer->status == BUFFER_STATUS_IDLE && buffer != skip)
+            xcb_visibility_notify_event_t *evt = (xcb_visibility_notify_event_t *) xcbevt;
+            X11Window *pwin;
+
+            glvnd_list_for_each_entry(pwin, &inst->visibility_windows, visibility.entry)
             {
-                return buffer;
+                if (pwin->xwin == evt->window)
+                {
+                    pwin->visibility.state = evt->state;
+                    break;
+                }
             }
-            numBuffers++;
         }
+        free(xcbevt);
+    }
+    pthread_mutex_unlock(&inst->visibility_mutex);
+}
 
-        if (numBuffers < maxBuffers)
+/**
+ * Checks whether a window is visible.
+ *
+ * A window counts as hidden if it isn't viewable, or if the last
+ * VisibilityNotify event said that it's fully obscured.
+ *
+ * We find out whether the window is viewable by sending a GetWindowAttributes
+ * request every so often, and picking up the reply on a later call, so this
+ * never waits for a round trip. VisibilityNotify events are only available
+ * with a private present connection.
+ */
+static EGLBoolean CheckWindowVisible(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11DisplayInstance *inst = pwin->inst;
+    uint64_t now = eplGetMonotonicTime();
+    EGLBoolean visible;
+
+    if (pwin->visibility.attrib_pending)
+    {
+        xcb_get_window_attributes_reply_t *reply = NULL;
+        xcb_generic_error_t *error = NULL;
+
+        if (xcb_poll_for_reply(inst->present_conn, pwin->visibility.attrib_cookie.sequence,
+                    (void **) &reply, &error))
         {
-            // We didn't find a free buffer, but we don't have our maximum
-            // number of buffers yet, so allocate a new one.
-            if (prime)
+            pwin->visibility.attrib_pending = EGL_FALSE;
+            if (reply != NULL)
             {
-                buffer = AllocatePrimeBuffer(pwin->inst, pwin->format->fourcc, pwin->width, pwin->height);
-            }
-            else
-            {
-                buffer = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->width, pwin->height,
-                        &pwin->modifier, 1, !pwin->prime);
-            }
-            if (buffer == NULL)
-            {
-                return NULL;
+                pwin->visibility.viewable = (reply->map_state == XCB_MAP_STATE_VIEWABLE);
+                free(reply);
             }
-            glvnd_list_add(&buffer->entry, buffers);
-            return buffer;
+            free(error);
         }
+    }
 
-        // Otherwise, we have to wait for a buffer to free up.
+    if (!pwin->visibility.attrib_pending
+            && now - pwin->visibility.last_poll >= VISIBILITY_POLL_INTERVAL)
+    {
+        pwin->visibility.attrib_cookie = xcb_get_window_attributes(inst->present_conn, pwin->xwin);
+        pwin->visibility.attrib_pending = EGL_TRUE;
+        pwin->visibility.last_poll = now;
+        xcb_flush(inst->present_conn);
+    }
 
-        if (pwin->use_explicit_sync)
-        {
-            /*
-             * With explicit sync, we can just wait on every buffer, even if we
-             * haven't gotten a PresentIdleNotify event.
-             *
-             * We do still poll for window events, though, in case the native
-             * window gets destroyed while we're waiting.
-             */
-            if (CheckBufferReleaseExplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT) <= 0)
-            {
-                return NULL;
-            }
+    visible = pwin->visibility.viewable;
+    if (pwin->visibility.tracking_events)
+    {
+        ProcessVisibilityEvents(inst);
 
-            PollForWindowEvents(surf);
-        }
-        else
+        pthread_mutex_lock(&inst->visibility_mutex);
+        if (pwin->visibility.state == XCB_VISIBILITY_FULLY_OBSCURED)
         {
-            int numChecked;
-
-            if (pwin->inst->supports_implicit_sync)
-            {
-                numChecked = CheckBufferReleaseImplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT);
-            }
-            else
-            {
-                numChecked = CheckBufferReleaseNoSync(pdpy, surf, buffers, skip);
-            }
-            if (numChecked < 0)
-            {
-                return NULL;
-            }
-            else if (numChecked == 0)
-            {
-                /*
-                 * There weren't any buffers to wait on yet, so wait for a
-                 * present event.
-                 *
-                 * If we receieve a PresentIdleNotify event, then HandlePresentEvent
-                 * will mark the corresponding buffer as ready to wait on, and then
-                 * CheckBufferReleaseImplicit/NoSync will find it on the next pass
-                 * through this loop.
-                 */
-                if (!WaitForWindowEvents(pdpy, surf))
-                {
-                    return NULL;
-                }
-            }
+            visible = EGL_FALSE;
         }
+        pthread_mutex_unlock(&inst->visibility_mutex);
     }
 
-    return NULL;
+    return visible;
 }
 
-static EGLBoolean CheckWindowDeleted(EplSurface *surf, EGLBoolean *ret_success)
+/**
+ * Handles eglSwapBuffers for a window that isn't visible.
+ *
+ * Nobody would see the frame, so we don't send anything to the server. The
+ * back buffer stays where it is, and the next frame just renders over it. We
+ * still throttle the application to the window's hidden frame rate, and still
+ * check for a resize, so that the buffers are the right size once the window
+ * is visible again.
+ */
+static EGLBoolean SkipHiddenFrame(EplDisplay *pdpy, EplSurface *surf)
 {
     X11Window *pwin = (X11Window *) surf->priv;
-    if (surf->deleted)
+    EGLBoolean ret = EGL_FALSE;
+
+    // eglSwapBuffers implies a flush, even if we don't present anything.
+    pwin->inst->platform->priv->egl.Flush();
+
+    eplX11TraceRecord(X11_TRACE_HIDDEN_SKIP, pwin->xwin, pwin->last_present_serial, 0, 0, 0);
+
+    // The window contents are stale by the time it's visible again, so
+    // software presentation needs to send the whole thing.
+    pwin->software_full_damage = EGL_TRUE;
+
+    LimitFrameRate(pdpy, surf, 1000000000ULL / pwin->policy.hidden_fps);
+    if (CheckWindowDeleted(surf, &ret))
     {
-        *ret_success = EGL_TRUE;
-        return EGL_TRUE;
+        return ret;
     }
-    else if (pwin->native_destroyed)
+
+    PollForWindowEvents(surf);
+    if (!CheckReallocWindow(surf, EGL_TRUE, NULL))
     {
-        *ret_success = EGL_FALSE;
-        eplSetError(pwin->inst->platform, EGL_BAD_NATIVE_WINDOW, "The X11 window has been destroyed");
-        return EGL_TRUE;
+        eplSetError(pwin->inst->platform, EGL_BAD_ALLOC, "Failed to allocate resized buffers.");
+        return EGL_FALSE;
     }
 
-    return EGL_FALSE;
+    return EGL_TRUE;
 }
 
 EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface *surf,
@@ -2190,10 +4620,19 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
     X11Window *pwin = (X11Window *) surf->priv;
     X11ColorBuffer *sharedPixmap = NULL;
     uint32_t options = 0;
+    EGLSync deferredSync = EGL_NO_SYNC;
     EGLBoolean resized = EGL_FALSE;
+    EGLBoolean frameWait = EGL_FALSE;
     EGLBoolean ret = EGL_FALSE;
+    X11_ROUNDTRIP_ENTRY("eglSwapBuffers");
 
     pthread_mutex_lock(&pwin->mutex);
+    eplX11TraceRecord(X11_TRACE_SWAP_BEGIN, pwin->xwin, pwin->last_present_serial, 0, 0, 0);
+    if (eplX11TraceEnabled())
+    {
+        pwin->swap_time = eplGetMonotonicTime();
+        UpdateFrameTimings(pwin);
+    }
 
     // Disable the update callback, so that we don't have to worry about it
     // reallocating the color buffers while we're trying to rearrange them.
@@ -2204,6 +4643,46 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         goto done;
     }
 
+    // Send any front buffer damage that's still waiting, so that it doesn't
+    // show up after this frame.
+    FlushFrontBufferPresent(surf);
+
+    // If the previous frame is still waiting in the deferred present thread,
+    // then let it go out first.
+    WaitForDeferredPresent(pdpy, surf);
+    if (CheckWindowDeleted(surf, &ret))
+    {
+        goto done;
+    }
+
+    if (pwin->software != NULL)
+    {
+        CheckSoftwareWindowSize(surf);
+        if (CheckWindowDeleted(surf, &ret))
+        {
+            goto done;
+        }
+        SetSoftwareDamage(pwin, rects, n_rects);
+    }
+
+    if (pwin->policy.hidden_fps != 0)
+    {
+        EGLBoolean hidden = !CheckWindowVisible(surf);
+        if (hidden != pwin->visibility.hidden)
+        {
+            // Start the frame rate limiter over, so that the deadlines from
+            // one rate don't carry over to the other.
+            pwin->visibility.hidden = hidden;
+            pwin->limiter.next_deadline = 0;
+            pwin->limiter.last_frame = 0;
+        }
+        if (hidden)
+        {
+            ret = SkipHiddenFrame(pdpy, surf);
+            goto done;
+        }
+    }
+
     if (pwin->prime)
     {
         sharedPixmap = GetFreeBuffer(pdpy, surf, NULL, EGL_TRUE);
@@ -2231,7 +4710,7 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         sharedPixmap = pwin->current_back;
     }
 
-    if (sharedPixmap->xpix == 0)
+    if (sharedPixmap->xpix == 0 && pwin->software == NULL)
     {
         if (!CreateSharedPixmap(surf, sharedPixmap, pwin->format->fmt))
         {
@@ -2244,16 +4723,17 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
     // use in the server.
     assert(sharedPixmap->status == BUFFER_STATUS_IDLE);
 
-    if (!SyncRendering(pdpy, surf, sharedPixmap))
+    if (!SyncRendering(pdpy, surf, sharedPixmap, &deferredSync))
     {
         goto done;
     }
 
-    if (!pwin->inst->force_prime)
+    if (!pwin->inst->force_prime && pwin->policy.modifiers == X11_MODIFIER_POLICY_OPTIMAL)
     {
         // If we're always using PRIME, then the shared pixmap will always be
         // DRM_FORMAT_MOD_LINEAR, so it doesn't matter whether that's optimal
-        // or not.
+        // or not. Likewise, if the profile says to stick with the modifier
+        // that we've got, then we don't care.
         options |= XCB_PRESENT_OPTION_SUBOPTIMAL;
     }
 
@@ -2261,11 +4741,20 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
     while (1)
     {
         uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
-        if (pending <= MAX_PENDING_FRAMES)
+        if (pending <= pwin->policy.max_pending_frames)
         {
+            if (frameWait)
+            {
+                eplX11TraceRecord(X11_TRACE_FRAME_WAIT_END, pwin->xwin, 0, pending, 0, 0);
+            }
             break;
         }
 
+        if (!frameWait)
+        {
+            eplX11TraceRecord(X11_TRACE_FRAME_WAIT_BEGIN, pwin->xwin, 0, pending, 0, 0);
+            frameWait = EGL_TRUE;
+        }
         if (!WaitForWindowEvents(pdpy, surf))
         {
             goto done;
@@ -2276,7 +4765,22 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         }
     }
 
-    SendPresentPixmap(surf, sharedPixmap, options);
+    LimitFrameRate(pdpy, surf, GetFrameInterval(pwin));
+    if (CheckWindowDeleted(surf, &ret))
+    {
+        goto done;
+    }
+
+    if (deferredSync != EGL_NO_SYNC)
+    {
+        QueueDeferredPresent(surf, sharedPixmap, options,
+                ++pwin->present_ids.last, deferredSync);
+        deferredSync = EGL_NO_SYNC;
+    }
+    else
+    {
+        SendPresentPixmap(surf, sharedPixmap, options, ++pwin->present_ids.last);
+    }
 
     /*
      * Check if we need to reallocate the buffers to deal with a resize or new
@@ -2340,11 +4844,31 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         }
     }
 
+    // After a resize, AllocWindowBuffers has already moved the old buffers
+    // to the pool, so this only finds anything on the normal path.
+    TrimIdleBuffers(pwin, &pwin->color_buffers, EGL_TRUE);
+    if (pwin->prime)
+    {
+        TrimIdleBuffers(pwin, &pwin->prime_buffers, EGL_FALSE);
+    }
+
     ret = EGL_TRUE;
     assert(pwin->current_back->status == BUFFER_STATUS_IDLE);
 
 done:
+    if (deferredSync != EGL_NO_SYNC)
+    {
+        pwin->inst->platform->priv->egl.DestroySync(pwin->inst->internal_display->edpy, deferredSync);
+    }
     pwin->skip_update_callback--;
+    if (pwin->front.pending && pwin->skip_update_callback == 0
+            && !pwin->native_destroyed && !surf->deleted)
+    {
+        // The deferred present thread skips front buffer damage while we're
+        // in here, so make sure that anything left over still goes out.
+        ScheduleFrontBufferPresent(surf);
+    }
+    eplX11TraceRecord(X11_TRACE_SWAP_END, pwin->xwin, pwin->last_present_serial, ret, 0, 0);
     pthread_mutex_unlock(&pwin->mutex);
     return ret;
 }
@@ -2395,18 +4919,169 @@ EGLBoolean eplX11SwapInterval(EGLDisplay edpy, EGLint interval)
     return ret;
 }
 
+EGLBoolean eplX11QuerySurfacePresentIdNVX(EGLDisplay edpy, EGLSurface esurf,
+        EGLuint64KHR *ret_id)
+{
+    EplDisplay *pdpy = eplDisplayAcquire(edpy);
+    EplSurface *psurf = NULL;
+    X11Window *pwin;
+    EGLBoolean ret = EGL_FALSE;
+
+    if (pdpy == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    psurf = eplSurfaceAcquire(pdpy, esurf);
+    if (psurf == NULL || psurf->type != EPL_SURFACE_TYPE_WINDOW)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_SURFACE, "Invalid window surface %p", esurf);
+        goto done;
+    }
+    if (ret_id == NULL)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid NULL pointer");
+        goto done;
+    }
+
+    pwin = (X11Window *) psurf->priv;
+    pthread_mutex_lock(&pwin->mutex);
+    *ret_id = pwin->present_ids.last;
+    pthread_mutex_unlock(&pwin->mutex);
+    ret = EGL_TRUE;
+
+done:
+    eplSurfaceRelease(pdpy, psurf);
+    eplDisplayRelease(pdpy);
+    return ret;
+}
+
+EGLint eplX11WaitForPresentNVX(EGLDisplay edpy, EGLSurface esurf,
+        EGLuint64KHR present_id, EGLTimeKHR timeout)
+{
+    EplDisplay *pdpy = eplDisplayAcquire(edpy);
+    EplSurface *psurf = NULL;
+    X11Window *pwin;
+    uint64_t deadline = 0;
+    EGLint ret = EGL_FALSE;
+
+    if (pdpy == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    psurf = eplSurfaceAcquire(pdpy, esurf);
+    if (psurf == NULL || psurf->type != EPL_SURFACE_TYPE_WINDOW)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_SURFACE, "Invalid window surface %p", esurf);
+        eplSurfaceRelease(pdpy, psurf);
+        eplDisplayRelease(pdpy);
+        return EGL_FALSE;
+    }
+    pwin = (X11Window *) psurf->priv;
+
+    if (timeout != EGL_FOREVER_KHR)
+    {
+        deadline = eplGetMonotonicTime() + timeout;
+    }
+
+    pthread_mutex_lock(&pwin->mutex);
+
+    if (present_id > pwin->present_ids.last)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_PARAMETER,
+                "Present ID %llu hasn't been presented yet", (unsigned long long) present_id);
+        goto done;
+    }
+
+    /*
+     * Unlike eglSwapBuffers, this can be called from any thread, so we can't
+     * block in xcb_wait_for_special_event: Another thread could be waiting
+     * for the same events. Instead, we poll the socket, and then read any
+     * events that showed up.
+     */
+    while (1)
+    {
+        struct pollfd pfd;
+        uint64_t now;
+        uint64_t sleep = PRESENT_WAIT_POLL_INTERVAL;
+
+        PollForWindowEvents(psurf);
+        if (psurf->deleted)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_SURFACE, "The surface was destroyed");
+            break;
+        }
+        if (pwin->present_ids.complete >= present_id)
+        {
+            ret = EGL_CONDITION_SATISFIED_KHR;
+            break;
+        }
+        if (pwin->native_destroyed)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_NATIVE_WINDOW, "The X window was destroyed");
+            break;
+        }
+        if (xcb_connection_has_error(pwin->inst->present_conn))
+        {
+            eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Failed to check window-system events.");
+            break;
+        }
+
+        now = eplGetMonotonicTime();
+        if (timeout != EGL_FOREVER_KHR)
+        {
+            if (now >= deadline)
+            {
+                ret = EGL_TIMEOUT_EXPIRED_KHR;
+                break;
+            }
+            if (deadline - now < sleep)
+            {
+                sleep = deadline - now;
+            }
+        }
+
+        pfd.fd = xcb_get_file_descriptor(pwin->inst->present_conn);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        // Like WaitForWindowEvents, release our locks while we wait.
+        pthread_mutex_unlock(&pwin->mutex);
+        eplDisplayUnlock(pdpy);
+
+        poll(&pfd, 1, (int) ((sleep + 999999) / 1000000));
+
+        eplDisplayLock(pdpy);
+        pthread_mutex_lock(&pwin->mutex);
+    }
+
+done:
+    pthread_mutex_unlock(&pwin->mutex);
+    eplSurfaceRelease(pdpy, psurf);
+    eplDisplayRelease(pdpy);
+    return ret;
+}
+
 EGLBoolean eplX11WaitGLWindow(EplDisplay *pdpy, EplSurface *psurf)
 {
     X11Window *pwin = (X11Window *) psurf->priv;
+    EGLBoolean ret = EGL_TRUE;
+
+    pthread_mutex_lock(&pwin->mutex);
+
+    WaitForDeferredPresent(pdpy, psurf);
 
     while ((pwin->last_present_serial - pwin->last_complete_serial) > 0
             && !psurf->deleted && !pwin->native_destroyed)
     {
         if (!WaitForWindowEvents(pdpy, psurf))
         {
-            return EGL_FALSE;
+            ret = EGL_FALSE;
+            break;
         }
     }
 
-    return EGL_TRUE;
+    pthread_mutex_unlock(&pwin->mutex);
+    return ret;
 }
@@ -0,0 +1,103 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * \file
+ *
+ * Replacements for the libdrm functions that the platform library uses.
+ *
+ * Every file descriptor looks like the same NVIDIA PCI device, with the
+ * primary node that the stub driver reports for its EGLDevice.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <xf86drm.h>
+
+#include "fake-server.h"
+
+typedef struct
+{
+    drmDevice device;
+    char *nodes[DRM_NODE_MAX];
+    drmPciDeviceInfo pci;
+    char primary[sizeof(FAKE_DRM_DEVICE_FILE)];
+} FakeDevice;
+
+int drmGetDevice(int fd, drmDevicePtr *device)
+{
+    FakeDevice *dev = calloc(1, sizeof(FakeDevice));
+
+    if (dev == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    memcpy(dev->primary, FAKE_DRM_DEVICE_FILE, sizeof(FAKE_DRM_DEVICE_FILE));
+    dev->nodes[DRM_NODE_PRIMARY] = dev->primary;
+    dev->pci.vendor_id = 0x10de;
+    dev->device.nodes = dev->nodes;
+    dev->device.available_nodes = (1 << DRM_NODE_PRIMARY);
+    dev->device.bustype = DRM_BUS_PCI;
+    dev->device.deviceinfo.pci = &dev->pci;
+
+    *device = &dev->device;
+    return 0;
+}
+
+void drmFreeDevice(drmDevicePtr *device)
+{
+    if (device != NULL && *device != NULL)
+    {
+        // The drmDevice is the first member of the FakeDevice struct.
+        free(*device);
+        *device = NULL;
+    }
+}
+
+drmVersionPtr drmGetVersion(int fd)
+{
+    static const char NAME[] = "nvidia-drm";
+    drmVersionPtr version = calloc(1, sizeof(drmVersion) + sizeof(NAME));
+
+    if (version != NULL)
+    {
+        version->name = (char *) (version + 1);
+        version->name_len = sizeof(NAME) - 1;
+        memcpy(version->name, NAME, sizeof(NAME));
+    }
+    return version;
+}
+
+void drmFreeVersion(drmVersionPtr version)
+{
+    free(version);
+}
+
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do
+    {
+        ret = ioctl(fd, request, arg);
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+    return ret;
+}
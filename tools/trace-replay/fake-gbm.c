@@ -0,0 +1,238 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * \file
+ *
+ * A replacement for libgbm.
+ *
+ * Each buffer is a memfd that's large enough to hold the image. Nothing
+ * ever renders into it, but it's still a real file descriptor, so the
+ * platform library can export it and pass it to the fake server the same way
+ * it would with a real dma-buf.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gbm.h>
+
+#define STRIDE_ALIGNMENT 256
+
+struct gbm_device
+{
+    int fd;
+};
+
+struct gbm_bo
+{
+    int fd;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint32_t offset;
+    uint64_t modifier;
+    size_t size;
+};
+
+typedef struct
+{
+    void *ptr;
+    size_t size;
+} FakeMapping;
+
+struct gbm_device *gbm_create_device(int fd)
+{
+    struct gbm_device *dev = calloc(1, sizeof(struct gbm_device));
+    if (dev != NULL)
+    {
+        dev->fd = fd;
+    }
+    return dev;
+}
+
+void gbm_device_destroy(struct gbm_device *dev)
+{
+    free(dev);
+}
+
+int gbm_device_get_fd(struct gbm_device *dev)
+{
+    return dev->fd;
+}
+
+const char *gbm_device_get_backend_name(struct gbm_device *dev)
+{
+    return "nvidia";
+}
+
+struct gbm_bo *gbm_bo_create_with_modifiers2(struct gbm_device *dev,
+        uint32_t width, uint32_t height, uint32_t format,
+        const uint64_t *modifiers, const unsigned int count, uint32_t flags)
+{
+    struct gbm_bo *bo;
+
+    if (width == 0 || height == 0 || count == 0)
+    {
+        return NULL;
+    }
+
+    bo = calloc(1, sizeof(struct gbm_bo));
+    if (bo == NULL)
+    {
+        return NULL;
+    }
+
+    // Every format that the stub driver supports is 32 bits per pixel.
+    bo->width = width;
+    bo->height = height;
+    bo->format = format;
+    bo->stride = (width * 4 + STRIDE_ALIGNMENT - 1) & ~(STRIDE_ALIGNMENT - 1);
+    bo->modifier = modifiers[0];
+    bo->size = ((size_t) bo->stride) * height;
+
+    bo->fd = memfd_create("gbm_bo", MFD_CLOEXEC);
+    if (bo->fd < 0 || ftruncate(bo->fd, bo->size) != 0)
+    {
+        gbm_bo_destroy(bo);
+        return NULL;
+    }
+
+    return bo;
+}
+
+struct gbm_bo *gbm_bo_import(struct gbm_device *dev, uint32_t type,
+        void *buffer, uint32_t flags)
+{
+    const struct gbm_import_fd_modifier_data *data = buffer;
+    struct gbm_bo *bo;
+
+    if (type != GBM_BO_IMPORT_FD_MODIFIER || data->num_fds != 1)
+    {
+        return NULL;
+    }
+
+    bo = calloc(1, sizeof(struct gbm_bo));
+    if (bo == NULL)
+    {
+        return NULL;
+    }
+
+    bo->width = data->width;
+    bo->height = data->height;
+    bo->format = data->format;
+    bo->stride = data->strides[0];
+    bo->offset = data->offsets[0];
+    bo->modifier = data->modifier;
+    bo->size = ((size_t) bo->stride) * bo->height + bo->offset;
+
+    bo->fd = dup(data->fds[0]);
+    if (bo->fd < 0)
+    {
+        free(bo);
+        return NULL;
+    }
+
+    return bo;
+}
+
+void gbm_bo_destroy(struct gbm_bo *bo)
+{
+    if (bo != NULL)
+    {
+        if (bo->fd >= 0)
+        {
+            close(bo->fd);
+        }
+        free(bo);
+    }
+}
+
+int gbm_bo_get_fd(struct gbm_bo *bo)
+{
+    return dup(bo->fd);
+}
+
+uint32_t gbm_bo_get_width(struct gbm_bo *bo)
+{
+    return bo->width;
+}
+
+uint32_t gbm_bo_get_height(struct gbm_bo *bo)
+{
+    return bo->height;
+}
+
+uint32_t gbm_bo_get_stride(struct gbm_bo *bo)
+{
+    return bo->stride;
+}
+
+uint32_t gbm_bo_get_format(struct gbm_bo *bo)
+{
+    return bo->format;
+}
+
+uint32_t gbm_bo_get_offset(struct gbm_bo *bo, int plane)
+{
+    return (plane == 0 ? bo->offset : 0);
+}
+
+uint64_t gbm_bo_get_modifier(struct gbm_bo *bo)
+{
+    return bo->modifier;
+}
+
+void *gbm_bo_map(struct gbm_bo *bo, uint32_t x, uint32_t y,
+        uint32_t width, uint32_t height, uint32_t flags,
+        uint32_t *stride, void **map_data)
+{
+    FakeMapping *mapping = malloc(sizeof(FakeMapping));
+    void *ptr;
+
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+
+    ptr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        free(mapping);
+        return NULL;
+    }
+
+    mapping->ptr = ptr;
+    mapping->size = bo->size;
+    *map_data = mapping;
+    *stride = bo->stride;
+    return ((uint8_t *) ptr) + bo->offset + y * bo->stride + x * 4;
+}
+
+void gbm_bo_unmap(struct gbm_bo *bo, void *map_data)
+{
+    FakeMapping *mapping = map_data;
+
+    if (mapping != NULL)
+    {
+        munmap(mapping->ptr, mapping->size);
+        free(mapping);
+    }
+}
@@ -0,0 +1,1520 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * The fake X server.
+ *
+ * A single thread accepts connections, reads and handles requests, and runs
+ * the simulated display. Everything that the thread touches is protected by
+ * one mutex, so that the replay tool can create and resize windows from
+ * another thread.
+ */
+
+#include "fake-server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <xcb/present.h>
+#include <xcb/dri3.h>
+#include <xcb/sync.h>
+#include <X11/xshmfence.h>
+
+#include "glvnd_list.h"
+#include "platform-utils.h"
+
+/**
+ * The MSC of the first refresh cycle. This is arbitrary, but starting above
+ * zero makes it easier to notice an MSC that didn't come from the server.
+ */
+#define START_MSC 1000
+
+/**
+ * The first display number to try. Real X servers almost always use small
+ * numbers, so starting higher avoids having to skip past them.
+ */
+#define FIRST_DISPLAY 100
+#define MAX_DISPLAYS 100
+
+#define MAX_CLIENTS 16
+#define MAX_CLIENT_FDS 16
+
+/**
+ * Each client gets its own range of XIDs, starting at
+ * (index << CLIENT_ID_SHIFT).
+ */
+#define CLIENT_ID_SHIFT 21
+
+#define ROOT_WINDOW 0x100
+#define ROOT_WIDTH 1920
+#define ROOT_HEIGHT 1080
+#define VISUAL_DEPTH_24 0x21
+#define VISUAL_DEPTH_32 0x22
+#define FIRST_WINDOW 0x200
+
+#define SYNC_MAJOR_OPCODE 134
+#define PRESENT_MAJOR_OPCODE 148
+#define DRI3_MAJOR_OPCODE 149
+
+#define X_ERROR 0
+#define X_REPLY 1
+#define X_BAD_REQUEST 1
+#define X_BAD_WINDOW 3
+#define X_BAD_PIXMAP 4
+#define X_BAD_MATCH 8
+#define X_BAD_DRAWABLE 9
+#define X_BAD_LENGTH 16
+
+#define PAD4(len) (((len) + 3) & ~3)
+
+typedef struct
+{
+    struct glvnd_list entry;
+    int fd;
+    uint32_t index;
+    int setup_done;
+    int failed;
+
+    /**
+     * The sequence number of the last request that we handled.
+     */
+    uint32_t sequence;
+
+    uint8_t *inbuf;
+    size_t inlen;
+    size_t insize;
+
+    /**
+     * File descriptors that came with requests that we haven't handled yet.
+     */
+    int fds[MAX_CLIENT_FDS];
+    int num_fds;
+} FakeClient;
+
+typedef struct
+{
+    struct glvnd_list entry;
+    FakeClient *client;
+    uint32_t eid;
+    uint32_t mask;
+} FakeSelection;
+
+typedef struct
+{
+    struct glvnd_list entry;
+    FakeClient *client;
+    xcb_pixmap_t pixmap;
+    uint32_t serial;
+    uint32_t options;
+    uint64_t target_msc;
+    uint32_t idle_fence;
+} FakePresent;
+
+typedef struct
+{
+    struct glvnd_list entry;
+    xcb_window_t xwin;
+    uint16_t width;
+    uint16_t height;
+
+    struct glvnd_list selections;
+
+    /**
+     * PresentPixmap requests that are waiting for their target MSC.
+     */
+    struct glvnd_list queue;
+
+    /**
+     * In flip mode, the request that's currently on the screen.
+     */
+    FakePresent *current;
+} FakeWindow;
+
+typedef struct
+{
+    struct glvnd_list entry;
+    FakeClient *client;
+    xcb_pixmap_t xid;
+    uint16_t width;
+    uint16_t height;
+    uint8_t depth;
+} FakePixmap;
+
+typedef struct
+{
+    struct glvnd_list entry;
+    FakeClient *client;
+    uint32_t xid;
+    struct xshmfence *fence;
+} FakeFence;
+
+static struct
+{
+    pthread_mutex_t mutex;
+
+    int listen_fd;
+    char display_name[16];
+
+    uint64_t refresh_period;
+    FakePresentMode mode;
+    uint64_t start_time;
+    uint64_t next_vblank;
+    uint64_t msc;
+    uint64_t ust;
+
+    uint32_t next_client;
+    int num_clients;
+    xcb_window_t next_window;
+    struct glvnd_list clients;
+    struct glvnd_list windows;
+    struct glvnd_list pixmaps;
+    struct glvnd_list fences;
+
+    uint8_t *setup;
+    size_t setup_size;
+} server = { .mutex = PTHREAD_MUTEX_INITIALIZER, .listen_fd = -1 };
+
+static const uint64_t SCREEN_MODIFIERS[] =
+{
+    FAKE_BLOCK_LINEAR_MODIFIER,
+    DRM_FORMAT_MOD_LINEAR,
+};
+
+static const uint64_t WINDOW_MODIFIERS[] =
+{
+    FAKE_BLOCK_LINEAR_MODIFIER,
+};
+
+static const char WM_CLASS_VALUE[] = "x11-trace-replay\0x11-trace-replay";
+
+/**
+ * Builds the connection setup reply. Each client gets a copy, with its own
+ * resource ID base.
+ */
+static int BuildSetup(void)
+{
+    static const char VENDOR[] = "egl-x11 trace replay";
+    size_t vendorLen = sizeof(VENDOR) - 1;
+    size_t size = sizeof(xcb_setup_t) + PAD4(vendorLen)
+        + 2 * sizeof(xcb_format_t) + sizeof(xcb_screen_t)
+        + 2 * (sizeof(xcb_depth_t) + sizeof(xcb_visualtype_t));
+    uint8_t *ptr;
+    xcb_setup_t *setup;
+    xcb_format_t *formats;
+    xcb_screen_t *screen;
+    int i;
+
+    setup = calloc(1, size);
+    if (setup == NULL)
+    {
+        return 0;
+    }
+
+    setup->status = 1;
+    setup->protocol_major_version = 11;
+    setup->protocol_minor_version = 0;
+    setup->length = (size - 8) / 4;
+    setup->resource_id_mask = (1 << CLIENT_ID_SHIFT) - 1;
+    setup->vendor_len = vendorLen;
+    setup->maximum_request_length = 0xFFFF;
+    setup->roots_len = 1;
+    setup->pixmap_formats_len = 2;
+    setup->bitmap_format_scanline_unit = 32;
+    setup->bitmap_format_scanline_pad = 32;
+    setup->min_keycode = 8;
+    setup->max_keycode = 255;
+
+    ptr = (uint8_t *) (setup + 1);
+    memcpy(ptr, VENDOR, vendorLen);
+    ptr += PAD4(vendorLen);
+
+    formats = (xcb_format_t *) ptr;
+    formats[0].depth = 24;
+    formats[0].bits_per_pixel = 32;
+    formats[0].scanline_pad = 32;
+    formats[1].depth = 32;
+    formats[1].bits_per_pixel = 32;
+    formats[1].scanline_pad = 32;
+    ptr = (uint8_t *) (formats + 2);
+
+    screen = (xcb_screen_t *) ptr;
+    screen->root = ROOT_WINDOW;
+    screen->width_in_pixels = ROOT_WIDTH;
+    screen->height_in_pixels = ROOT_HEIGHT;
+    screen->width_in_millimeters = 508;
+    screen->height_in_millimeters = 286;
+    screen->min_installed_maps = 1;
+    screen->max_installed_maps = 1;
+    screen->root_visual = VISUAL_DEPTH_24;
+    screen->root_depth = 24;
+    screen->allowed_depths_len = 2;
+    ptr = (uint8_t *) (screen + 1);
+
+    for (i=0; i<2; i++)
+    {
+        xcb_depth_t *depth = (xcb_depth_t *) ptr;
+        xcb_visualtype_t *visual = (xcb_visualtype_t *) (depth + 1);
+
+        depth->depth = (i == 0 ? 24 : 32);
+        depth->visuals_len = 1;
+        visual->visual_id = (i == 0 ? VISUAL_DEPTH_24 : VISUAL_DEPTH_32);
+        visual->_class = XCB_VISUAL_CLASS_TRUE_COLOR;
+        visual->bits_per_rgb_value = 8;
+        visual->colormap_entries = 256;
+        visual->red_mask = 0xFF0000;
+        visual->green_mask = 0x00FF00;
+        visual->blue_mask = 0x0000FF;
+        ptr = (uint8_t *) (visual + 1);
+    }
+
+    server.setup = (uint8_t *) setup;
+    server.setup_size = size;
+    return 1;
+}
+
+static FakeWindow *FindWindow(xcb_window_t xwin)
+{
+    FakeWindow *win;
+    glvnd_list_for_each_entry(win, &server.windows, entry)
+    {
+        if (win->xwin == xwin)
+        {
+            return win;
+        }
+    }
+    return NULL;
+}
+
+static FakePixmap *FindPixmap(xcb_pixmap_t xid)
+{
+    FakePixmap *pix;
+    glvnd_list_for_each_entry(pix, &server.pixmaps, entry)
+    {
+        if (pix->xid == xid)
+        {
+            return pix;
+        }
+    }
+    return NULL;
+}
+
+static FakeFence *FindFence(uint32_t xid)
+{
+    FakeFence *fence;
+    glvnd_list_for_each_entry(fence, &server.fences, entry)
+    {
+        if (fence->xid == xid)
+        {
+            return fence;
+        }
+    }
+    return NULL;
+}
+
+static FakeWindow *AddWindow(xcb_window_t xwin, uint16_t width, uint16_t height)
+{
+    FakeWindow *win = calloc(1, sizeof(FakeWindow));
+    if (win == NULL)
+    {
+        return NULL;
+    }
+    win->xwin = xwin;
+    win->width = width;
+    win->height = height;
+    glvnd_list_init(&win->selections);
+    glvnd_list_init(&win->queue);
+    glvnd_list_append(&win->entry, &server.windows);
+    return win;
+}
+
+static void FreeFence(FakeFence *fence)
+{
+    glvnd_list_del(&fence->entry);
+    xshmfence_unmap_shm(fence->fence);
+    free(fence);
+}
+
+/**
+ * Writes data to a client, along with any file descriptors.
+ *
+ * If the write fails, then this marks the client as failed, and the server
+ * thread disconnects it.
+ */
+static void WriteToClient(FakeClient *client, const void *data, size_t size,
+        const int *fds, int num_fds)
+{
+    const uint8_t *ptr = data;
+    char control[CMSG_SPACE(sizeof(int) * MAX_CLIENT_FDS)];
+
+    while (size > 0 && !client->failed)
+    {
+        struct iovec iov = { (void *) ptr, size };
+        struct msghdr msg = {};
+        ssize_t ret;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (num_fds > 0)
+        {
+            struct cmsghdr *cmsg;
+
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+            cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+        }
+
+        ret = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno != EINTR)
+            {
+                client->failed = 1;
+            }
+            continue;
+        }
+
+        // The descriptors go out with the first byte.
+        num_fds = 0;
+        ptr += ret;
+        size -= ret;
+    }
+}
+
+/**
+ * Sends a reply to the request that the client sent last.
+ *
+ * \param reply The reply, in the layout of the matching xcb reply struct.
+ *      This fills in the response type, sequence, and length fields.
+ * \param size The size of the reply, a multiple of 4. Replies shorter than
+ *      32 bytes are padded out to 32 bytes.
+ */
+static void SendReply(FakeClient *client, void *reply, size_t size, const int *fds, int num_fds)
+{
+    xcb_generic_reply_t *header = reply;
+    uint8_t buffer[32] = {};
+
+    header->response_type = X_REPLY;
+    header->sequence = client->sequence;
+    if (size < sizeof(buffer))
+    {
+        header->length = 0;
+        memcpy(buffer, reply, size);
+        WriteToClient(client, buffer, sizeof(buffer), fds, num_fds);
+    }
+    else
+    {
+        header->length = (size - 32) / 4;
+        WriteToClient(client, reply, size, fds, num_fds);
+    }
+}
+
+static void SendError(FakeClient *client, uint8_t code, uint32_t resource_id, const uint8_t *req)
+{
+    xcb_generic_error_t error = {};
+
+    error.response_type = X_ERROR;
+    error.error_code = code;
+    error.sequence = client->sequence;
+    error.resource_id = resource_id;
+    error.major_code = req[0];
+    error.minor_code = req[1];
+    WriteToClient(client, &error, sizeof(error), NULL, 0);
+}
+
+/**
+ * Sends a Present event to every client that selected for it.
+ *
+ * Each Present event struct starts with the same fields as
+ * xcb_present_generic_event_t, and has a full_sequence field at byte 32 that
+ * libxcb fills in, which isn't part of the event on the wire.
+ */
+static void SendPresentEvent(FakeWindow *win, uint16_t evtype, uint32_t mask,
+        void *event, size_t size)
+{
+    xcb_present_generic_event_t *ge = event;
+    uint8_t wire[64];
+    FakeSelection *sel;
+
+    ge->response_type = XCB_GE_GENERIC;
+    ge->extension = PRESENT_MAJOR_OPCODE;
+    ge->evtype = evtype;
+    ge->length = (size - 36) / 4;
+
+    glvnd_list_for_each_entry(sel, &win->selections, entry)
+    {
+        if (sel->mask & mask)
+        {
+            ge->sequence = sel->client->sequence;
+            ge->event = sel->eid;
+            memcpy(wire, event, 32);
+            memcpy(wire + 32, ((uint8_t *) event) + 36, size - 36);
+            WriteToClient(sel->client, wire, size - 4, NULL, 0);
+        }
+    }
+}
+
+static void SendConfigureNotify(FakeWindow *win)
+{
+    xcb_present_configure_notify_event_t event = {};
+
+    event.window = win->xwin;
+    event.width = win->width;
+    event.height = win->height;
+    event.pixmap_width = win->width;
+    event.pixmap_height = win->height;
+    SendPresentEvent(win, XCB_PRESENT_CONFIGURE_NOTIFY,
+            XCB_PRESENT_EVENT_MASK_CONFIGURE_NOTIFY, &event, sizeof(event));
+}
+
+static void CompletePresent(FakeWindow *win, FakePresent *pres, uint8_t mode,
+        uint64_t msc, uint64_t ust)
+{
+    xcb_present_complete_notify_event_t event = {};
+
+    event.kind = XCB_PRESENT_COMPLETE_KIND_PIXMAP;
+    event.mode = mode;
+    event.window = win->xwin;
+    event.serial = pres->serial;
+    event.ust = ust;
+    event.msc = msc;
+    SendPresentEvent(win, XCB_PRESENT_COMPLETE_NOTIFY,
+            XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY, &event, sizeof(event));
+}
+
+/**
+ * Releases the pixmap from a PresentPixmap request, and frees the request.
+ */
+static void IdlePresent(FakeWindow *win, FakePresent *pres)
+{
+    xcb_present_idle_notify_event_t event = {};
+    FakeFence *fence = FindFence(pres->idle_fence);
+
+    if (fence != NULL)
+    {
+        xshmfence_trigger(fence->fence);
+    }
+
+    event.window = win->xwin;
+    event.serial = pres->serial;
+    event.pixmap = pres->pixmap;
+    event.idle_fence = pres->idle_fence;
+    SendPresentEvent(win, XCB_PRESENT_IDLE_NOTIFY,
+            XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY, &event, sizeof(event));
+    free(pres);
+}
+
+static void ExecutePresent(FakeWindow *win, FakePresent *pres, uint64_t msc, uint64_t ust)
+{
+    if (server.mode == FAKE_PRESENT_MODE_FLIP)
+    {
+        CompletePresent(win, pres, XCB_PRESENT_COMPLETE_MODE_FLIP, msc, ust);
+        if (win->current != NULL)
+        {
+            IdlePresent(win, win->current);
+        }
+        win->current = pres;
+    }
+    else
+    {
+        CompletePresent(win, pres, XCB_PRESENT_COMPLETE_MODE_COPY, msc, ust);
+        IdlePresent(win, pres);
+    }
+}
+
+/**
+ * Handles the start of a refresh cycle for one window.
+ */
+static void ProcessVblank(FakeWindow *win)
+{
+    FakePresent *pres, *pnext;
+
+    glvnd_list_for_each_entry_safe(pres, pnext, &win->queue, entry)
+    {
+        if (pres->target_msc > server.msc)
+        {
+            break;
+        }
+
+        glvnd_list_del(&pres->entry);
+        ExecutePresent(win, pres, server.msc, server.ust);
+        if (server.mode == FAKE_PRESENT_MODE_FLIP)
+        {
+            // We can only flip once per refresh cycle.
+            break;
+        }
+    }
+}
+
+/*
+ * Core protocol requests.
+ */
+
+static void HandleQueryExtension(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_query_extension_request_t request;
+    xcb_query_extension_reply_t reply = {};
+    const char *name = (const char *) (req + sizeof(request));
+
+    memcpy(&request, req, sizeof(request));
+    if (sizeof(request) + request.name_len > len)
+    {
+        SendError(client, X_BAD_LENGTH, 0, req);
+        return;
+    }
+
+    if (request.name_len == 4 && memcmp(name, "DRI3", 4) == 0)
+    {
+        reply.present = 1;
+        reply.major_opcode = DRI3_MAJOR_OPCODE;
+    }
+    else if (request.name_len == 7 && memcmp(name, "Present", 7) == 0)
+    {
+        reply.present = 1;
+        reply.major_opcode = PRESENT_MAJOR_OPCODE;
+    }
+    else if (request.name_len == 4 && memcmp(name, "SYNC", 4) == 0)
+    {
+        reply.present = 1;
+        reply.major_opcode = SYNC_MAJOR_OPCODE;
+    }
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandleGetWindowAttributes(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_get_window_attributes_request_t request;
+    xcb_get_window_attributes_reply_t reply = {};
+
+    memcpy(&request, req, sizeof(request));
+    if (FindWindow(request.window) == NULL)
+    {
+        SendError(client, X_BAD_WINDOW, request.window, req);
+        return;
+    }
+
+    reply.visual = VISUAL_DEPTH_24;
+    reply._class = XCB_WINDOW_CLASS_INPUT_OUTPUT;
+    reply.map_is_installed = 1;
+    reply.map_state = XCB_MAP_STATE_VIEWABLE;
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandleGetGeometry(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_get_geometry_request_t request;
+    xcb_get_geometry_reply_t reply = {};
+    FakeWindow *win;
+    FakePixmap *pix = NULL;
+
+    memcpy(&request, req, sizeof(request));
+    win = FindWindow(request.drawable);
+    if (win == NULL)
+    {
+        pix = FindPixmap(request.drawable);
+        if (pix == NULL)
+        {
+            SendError(client, X_BAD_DRAWABLE, request.drawable, req);
+            return;
+        }
+    }
+
+    reply.root = ROOT_WINDOW;
+    reply.depth = (pix != NULL ? pix->depth : 24);
+    reply.width = (pix != NULL ? pix->width : win->width);
+    reply.height = (pix != NULL ? pix->height : win->height);
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandleGetProperty(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_get_property_request_t request;
+    struct
+    {
+        xcb_get_property_reply_t header;
+        uint8_t value[PAD4(sizeof(WM_CLASS_VALUE))];
+    } reply = {};
+    size_t size = sizeof(reply.header);
+
+    memcpy(&request, req, sizeof(request));
+    if (FindWindow(request.window) == NULL)
+    {
+        SendError(client, X_BAD_WINDOW, request.window, req);
+        return;
+    }
+
+    // The only property that the fake server knows about is WM_CLASS, so
+    // that profiles can match the replay tool. Everything else looks like
+    // it's not set.
+    if (request.property == XCB_ATOM_WM_CLASS && request.long_offset == 0)
+    {
+        reply.header.format = 8;
+        reply.header.type = XCB_ATOM_STRING;
+        reply.header.value_len = sizeof(WM_CLASS_VALUE);
+        memcpy(reply.value, WM_CLASS_VALUE, sizeof(WM_CLASS_VALUE));
+        size += sizeof(reply.value);
+    }
+    SendReply(client, &reply, size, NULL, 0);
+}
+
+static void HandleGetInputFocus(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_get_input_focus_reply_t reply = {};
+
+    reply.revert_to = XCB_INPUT_FOCUS_POINTER_ROOT;
+    reply.focus = XCB_INPUT_FOCUS_POINTER_ROOT;
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandleFreePixmap(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_free_pixmap_request_t request;
+    FakePixmap *pix;
+
+    memcpy(&request, req, sizeof(request));
+    pix = FindPixmap(request.pixmap);
+    if (pix == NULL)
+    {
+        SendError(client, X_BAD_PIXMAP, request.pixmap, req);
+        return;
+    }
+    glvnd_list_del(&pix->entry);
+    free(pix);
+}
+
+/*
+ * DRI3
+ */
+
+/**
+ * Takes the next file descriptor that the client sent, or returns -1 if
+ * there aren't any left.
+ */
+static int TakeClientFD(FakeClient *client)
+{
+    int fd;
+
+    if (client->num_fds == 0)
+    {
+        return -1;
+    }
+    fd = client->fds[0];
+    client->num_fds--;
+    memmove(client->fds, client->fds + 1, client->num_fds * sizeof(int));
+    return fd;
+}
+
+static void HandleDRI3QueryVersion(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_dri3_query_version_reply_t reply = {};
+
+    reply.major_version = 1;
+    reply.minor_version = 2;
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandleDRI3Open(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_dri3_open_reply_t reply = {};
+    int fd;
+
+    // The platform library only needs a file descriptor here. The device
+    // lookup functions in fake-drm.c don't look at the file at all.
+    fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        SendError(client, X_BAD_MATCH, 0, req);
+        return;
+    }
+
+    reply.nfd = 1;
+    SendReply(client, &reply, sizeof(reply), &fd, 1);
+    close(fd);
+}
+
+static void HandleDRI3GetSupportedModifiers(FakeClient *client, const uint8_t *req, size_t len)
+{
+    static const size_t NUM_WINDOW = sizeof(WINDOW_MODIFIERS) / sizeof(WINDOW_MODIFIERS[0]);
+    static const size_t NUM_SCREEN = sizeof(SCREEN_MODIFIERS) / sizeof(SCREEN_MODIFIERS[0]);
+    xcb_dri3_get_supported_modifiers_request_t request;
+    struct
+    {
+        xcb_dri3_get_supported_modifiers_reply_t header;
+        uint64_t modifiers[sizeof(WINDOW_MODIFIERS) / sizeof(uint64_t)
+            + sizeof(SCREEN_MODIFIERS) / sizeof(uint64_t)];
+    } reply = {};
+    size_t size = sizeof(reply.header);
+
+    memcpy(&request, req, sizeof(request));
+    if (request.depth == 24 || request.depth == 32)
+    {
+        reply.header.num_window_modifiers = NUM_WINDOW;
+        reply.header.num_screen_modifiers = NUM_SCREEN;
+        memcpy(reply.modifiers, WINDOW_MODIFIERS, sizeof(WINDOW_MODIFIERS));
+        memcpy(reply.modifiers + NUM_WINDOW, SCREEN_MODIFIERS, sizeof(SCREEN_MODIFIERS));
+        size = sizeof(reply);
+    }
+    SendReply(client, &reply, size, NULL, 0);
+}
+
+static void HandleDRI3PixmapFromBuffers(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_dri3_pixmap_from_buffers_request_t request;
+    FakePixmap *pix;
+    int i;
+
+    memcpy(&request, req, sizeof(request));
+
+    // We never look at the contents of a pixmap, so we don't need to keep
+    // the buffers.
+    for (i=0; i<request.num_buffers; i++)
+    {
+        int fd = TakeClientFD(client);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    if (FindWindow(request.window) == NULL)
+    {
+        SendError(client, X_BAD_WINDOW, request.window, req);
+        return;
+    }
+
+    pix = calloc(1, sizeof(FakePixmap));
+    if (pix == NULL)
+    {
+        SendError(client, X_BAD_MATCH, request.pixmap, req);
+        return;
+    }
+    pix->client = client;
+    pix->xid = request.pixmap;
+    pix->width = request.width;
+    pix->height = request.height;
+    pix->depth = request.depth;
+    glvnd_list_append(&pix->entry, &server.pixmaps);
+}
+
+static void HandleDRI3FenceFromFD(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_dri3_fence_from_fd_request_t request;
+    FakeFence *fence;
+    int fd;
+
+    memcpy(&request, req, sizeof(request));
+    fd = TakeClientFD(client);
+    if (fd < 0)
+    {
+        SendError(client, X_BAD_LENGTH, request.fence, req);
+        return;
+    }
+
+    fence = calloc(1, sizeof(FakeFence));
+    if (fence != NULL)
+    {
+        fence->fence = xshmfence_map_shm(fd);
+    }
+    close(fd);
+    if (fence == NULL || fence->fence == NULL)
+    {
+        free(fence);
+        SendError(client, X_BAD_MATCH, request.fence, req);
+        return;
+    }
+
+    if (request.initially_triggered)
+    {
+        xshmfence_trigger(fence->fence);
+    }
+    fence->client = client;
+    fence->xid = request.fence;
+    glvnd_list_append(&fence->entry, &server.fences);
+}
+
+static void HandleDRI3Request(FakeClient *client, const uint8_t *req, size_t len)
+{
+    switch (req[1])
+    {
+        case XCB_DRI3_QUERY_VERSION:
+            HandleDRI3QueryVersion(client, req, len);
+            break;
+        case XCB_DRI3_OPEN:
+            HandleDRI3Open(client, req, len);
+            break;
+        case XCB_DRI3_GET_SUPPORTED_MODIFIERS:
+            HandleDRI3GetSupportedModifiers(client, req, len);
+            break;
+        case XCB_DRI3_PIXMAP_FROM_BUFFERS:
+            HandleDRI3PixmapFromBuffers(client, req, len);
+            break;
+        case XCB_DRI3_FENCE_FROM_FD:
+            HandleDRI3FenceFromFD(client, req, len);
+            break;
+        default:
+            fprintf(stderr, "fake server: Unhandled DRI3 request %u\n", req[1]);
+            SendError(client, X_BAD_REQUEST, 0, req);
+            break;
+    }
+}
+
+/*
+ * Present
+ */
+
+static void HandlePresentQueryVersion(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_present_query_version_reply_t reply = {};
+
+    reply.major_version = 1;
+    reply.minor_version = 2;
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandlePresentQueryCapabilities(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_present_query_capabilities_reply_t reply = {};
+
+    reply.capabilities = XCB_PRESENT_CAPABILITY_ASYNC;
+    SendReply(client, &reply, sizeof(reply), NULL, 0);
+}
+
+static void HandlePresentSelectInput(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_present_select_input_request_t request;
+    FakeSelection *sel, *found = NULL;
+    FakeWindow *win;
+
+    memcpy(&request, req, sizeof(request));
+    win = FindWindow(request.window);
+    if (win == NULL)
+    {
+        SendError(client, X_BAD_WINDOW, request.window, req);
+        return;
+    }
+
+    glvnd_list_for_each_entry(sel, &win->selections, entry)
+    {
+        if (sel->client == client && sel->eid == request.eid)
+        {
+            found = sel;
+            break;
+        }
+    }
+
+    if (request.event_mask == XCB_PRESENT_EVENT_MASK_NO_EVENT)
+    {
+        if (found != NULL)
+        {
+            glvnd_list_del(&found->entry);
+            free(found);
+        }
+        return;
+    }
+
+    if (found == NULL)
+    {
+        found = calloc(1, sizeof(FakeSelection));
+        if (found == NULL)
+        {
+            SendError(client, X_BAD_MATCH, request.eid, req);
+            return;
+        }
+        found->client = client;
+        found->eid = request.eid;
+        glvnd_list_append(&found->entry, &win->selections);
+    }
+    found->mask = request.event_mask;
+}
+
+static void HandlePresentPixmap(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_present_pixmap_request_t request;
+    FakePresent *pres;
+    FakeWindow *win;
+
+    memcpy(&request, req, sizeof(request));
+    win = FindWindow(request.window);
+    if (win == NULL)
+    {
+        SendError(client, X_BAD_WINDOW, request.window, req);
+        return;
+    }
+    if (FindPixmap(request.pixmap) == NULL)
+    {
+        SendError(client, X_BAD_PIXMAP, request.pixmap, req);
+        return;
+    }
+
+    pres = calloc(1, sizeof(FakePresent));
+    if (pres == NULL)
+    {
+        SendError(client, X_BAD_MATCH, request.pixmap, req);
+        return;
+    }
+    pres->client = client;
+    pres->pixmap = request.pixmap;
+    pres->serial = request.serial;
+    pres->options = request.options;
+    pres->target_msc = request.target_msc;
+    pres->idle_fence = request.idle_fence;
+
+    if ((request.options & XCB_PRESENT_OPTION_ASYNC) && glvnd_list_is_empty(&win->queue)
+            && request.target_msc <= server.msc)
+    {
+        // An async request that doesn't have to wait for anything else shows
+        // up right away, without waiting for the next refresh cycle.
+        ExecutePresent(win, pres, server.msc, eplGetMonotonicTime() / 1000);
+    }
+    else
+    {
+        glvnd_list_append(&pres->entry, &win->queue);
+    }
+}
+
+static void HandlePresentRequest(FakeClient *client, const uint8_t *req, size_t len)
+{
+    switch (req[1])
+    {
+        case XCB_PRESENT_QUERY_VERSION:
+            HandlePresentQueryVersion(client, req, len);
+            break;
+        case XCB_PRESENT_QUERY_CAPABILITIES:
+            HandlePresentQueryCapabilities(client, req, len);
+            break;
+        case XCB_PRESENT_SELECT_INPUT:
+            HandlePresentSelectInput(client, req, len);
+            break;
+        case XCB_PRESENT_PIXMAP:
+            HandlePresentPixmap(client, req, len);
+            break;
+        default:
+            fprintf(stderr, "fake server: Unhandled Present request %u\n", req[1]);
+            SendError(client, X_BAD_REQUEST, 0, req);
+            break;
+    }
+}
+
+/*
+ * SYNC
+ */
+
+static void HandleSyncRequest(FakeClient *client, const uint8_t *req, size_t len)
+{
+    xcb_sync_trigger_fence_request_t request;
+    FakeFence *fence;
+
+    // TriggerFence and DestroyFence have the same layout.
+    memcpy(&request, req, sizeof(request));
+    fence = FindFence(request.fence);
+
+    switch (req[1])
+    {
+        case XCB_SYNC_TRIGGER_FENCE:
+            if (fence != NULL)
+            {
+                xshmfence_trigger(fence->fence);
+            }
+            break;
+        case XCB_SYNC_DESTROY_FENCE:
+            if (fence != NULL)
+            {
+                FreeFence(fence);
+            }
+            break;
+        default:
+            fprintf(stderr, "fake server: Unhandled SYNC request %u\n", req[1]);
+            SendError(client, X_BAD_REQUEST, 0, req);
+            return;
+    }
+}
+
+static void HandleRequest(FakeClient *client, const uint8_t *req, size_t len)
+{
+    client->sequence++;
+
+    switch (req[0])
+    {
+        case XCB_GET_WINDOW_ATTRIBUTES:
+            HandleGetWindowAttributes(client, req, len);
+            break;
+        case XCB_GET_GEOMETRY:
+            HandleGetGeometry(client, req, len);
+            break;
+        case XCB_GET_PROPERTY:
+            HandleGetProperty(client, req, len);
+            break;
+        case XCB_GET_INPUT_FOCUS:
+            HandleGetInputFocus(client, req, len);
+            break;
+        case XCB_FREE_PIXMAP:
+            HandleFreePixmap(client, req, len);
+            break;
+        case XCB_QUERY_EXTENSION:
+            HandleQueryExtension(client, req, len);
+            break;
+        case DRI3_MAJOR_OPCODE:
+            HandleDRI3Request(client, req, len);
+            break;
+        case PRESENT_MAJOR_OPCODE:
+            HandlePresentRequest(client, req, len);
+            break;
+        case SYNC_MAJOR_OPCODE:
+            HandleSyncRequest(client, req, len);
+            break;
+        default:
+            fprintf(stderr, "fake server: Unhandled request %u\n", req[0]);
+            SendError(client, X_BAD_REQUEST, 0, req);
+            break;
+    }
+}
+
+/**
+ * Handles the connection setup request, and then any complete requests in a
+ * client's input buffer.
+ */
+static void ProcessClientInput(FakeClient *client)
+{
+    size_t offset = 0;
+
+    if (!client->setup_done)
+    {
+        xcb_setup_request_t request;
+        xcb_setup_t *setup;
+        size_t size;
+
+        if (client->inlen < sizeof(request))
+        {
+            return;
+        }
+        memcpy(&request, client->inbuf, sizeof(request));
+        size = sizeof(request) + PAD4(request.authorization_protocol_name_len)
+            + PAD4(request.authorization_protocol_data_len);
+        if (client->inlen < size)
+        {
+            return;
+        }
+
+        // We don't check the authorization, and the client always uses the
+        // same byte order as us.
+        setup = (xcb_setup_t *) server.setup;
+        setup->resource_id_base = client->index << CLIENT_ID_SHIFT;
+        WriteToClient(client, server.setup, server.setup_size, NULL, 0);
+        client->setup_done = 1;
+        offset = size;
+    }
+
+    while (client->inlen - offset >= 4 && !client->failed)
+    {
+        const uint8_t *req = client->inbuf + offset;
+        uint16_t length;
+
+        memcpy(&length, req + 2, sizeof(length));
+        if (length == 0)
+        {
+            // We don't support BIG-REQUESTS, so this is a broken client.
+            client->failed = 1;
+            break;
+        }
+        if (client->inlen - offset < length * 4U)
+        {
+            break;
+        }
+
+        HandleRequest(client, req, length * 4U);
+        offset += length * 4U;
+    }
+
+    memmove(client->inbuf, client->inbuf + offset, client->inlen - offset);
+    client->inlen -= offset;
+}
+
+static void ReadFromClient(FakeClient *client)
+{
+    char control[CMSG_SPACE(sizeof(int) * MAX_CLIENT_FDS)];
+    struct iovec iov;
+    struct msghdr msg = {};
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    if (client->insize - client->inlen < 4096)
+    {
+        size_t size = client->insize * 2 + 4096;
+        uint8_t *buf = realloc(client->inbuf, size);
+        if (buf == NULL)
+        {
+            client->failed = 1;
+            return;
+        }
+        client->inbuf = buf;
+        client->insize = size;
+    }
+
+    iov.iov_base = client->inbuf + client->inlen;
+    iov.iov_len = client->insize - client->inlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ret = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (ret <= 0)
+    {
+        if (ret == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            client->failed = 1;
+        }
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *fds = (int *) CMSG_DATA(cmsg);
+            int i;
+
+            for (i=0; i<count; i++)
+            {
+                if (client->num_fds < MAX_CLIENT_FDS)
+                {
+                    client->fds[client->num_fds++] = fds[i];
+                }
+                else
+                {
+                    close(fds[i]);
+                }
+            }
+        }
+    }
+
+    client->inlen += ret;
+    ProcessClientInput(client);
+}
+
+static void AcceptClient(void)
+{
+    FakeClient *client;
+    int fd;
+
+    fd = accept4(server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    client = calloc(1, sizeof(FakeClient));
+    if (client == NULL || server.num_clients >= MAX_CLIENTS)
+    {
+        free(client);
+        close(fd);
+        return;
+    }
+    client->fd = fd;
+    client->index = ++server.next_client;
+    glvnd_list_append(&client->entry, &server.clients);
+    server.num_clients++;
+}
+
+/**
+ * Disconnects a client, and frees everything that it created.
+ */
+static void FreeClient(FakeClient *client)
+{
+    FakeWindow *win;
+    FakePixmap *pix, *pixNext;
+    FakeFence *fence, *fenceNext;
+    int i;
+
+    glvnd_list_for_each_entry(win, &server.windows, entry)
+    {
+        FakeSelection *sel, *selNext;
+        FakePresent *pres, *presNext;
+
+        glvnd_list_for_each_entry_safe(sel, selNext, &win->selections, entry)
+        {
+            if (sel->client == client)
+            {
+                glvnd_list_del(&sel->entry);
+                free(sel);
+            }
+        }
+        glvnd_list_for_each_entry_safe(pres, presNext, &win->queue, entry)
+        {
+            if (pres->client == client)
+            {
+                glvnd_list_del(&pres->entry);
+                free(pres);
+            }
+        }
+        if (win->current != NULL && win->current->client == client)
+        {
+            free(win->current);
+            win->current = NULL;
+        }
+    }
+    glvnd_list_for_each_entry_safe(pix, pixNext, &server.pixmaps, entry)
+    {
+        if (pix->client == client)
+        {
+            glvnd_list_del(&pix->entry);
+            free(pix);
+        }
+    }
+    glvnd_list_for_each_entry_safe(fence, fenceNext, &server.fences, entry)
+    {
+        if (fence->client == client)
+        {
+            FreeFence(fence);
+        }
+    }
+
+    for (i=0; i<client->num_fds; i++)
+    {
+        close(client->fds[i]);
+    }
+    glvnd_list_del(&client->entry);
+    server.num_clients--;
+    close(client->fd);
+    free(client->inbuf);
+    free(client);
+}
+
+static void *ServerThread(void *param)
+{
+    while (1)
+    {
+        struct pollfd pfds[MAX_CLIENTS + 1];
+        FakeClient *polled[MAX_CLIENTS + 1];
+        FakeClient *client, *clientNext;
+        uint64_t now = eplGetMonotonicTime();
+        struct timespec timeout;
+        nfds_t count = 0;
+        nfds_t i;
+
+        pthread_mutex_lock(&server.mutex);
+        if (now >= server.next_vblank)
+        {
+            uint64_t cycle = (now - server.start_time) / server.refresh_period;
+            FakeWindow *win;
+
+            server.msc = START_MSC + cycle;
+            server.ust = (server.start_time + cycle * server.refresh_period) / 1000;
+            server.next_vblank = server.start_time + (cycle + 1) * server.refresh_period;
+            glvnd_list_for_each_entry(win, &server.windows, entry)
+            {
+                ProcessVblank(win);
+            }
+            now = eplGetMonotonicTime();
+        }
+
+        pfds[count].fd = server.listen_fd;
+        pfds[count].events = POLLIN;
+        polled[count] = NULL;
+        count++;
+        glvnd_list_for_each_entry(client, &server.clients, entry)
+        {
+            pfds[count].fd = client->fd;
+            pfds[count].events = POLLIN;
+            polled[count] = client;
+            count++;
+        }
+        pthread_mutex_unlock(&server.mutex);
+
+        if (server.next_vblank > now)
+        {
+            timeout.tv_sec = (server.next_vblank - now) / 1000000000ULL;
+            timeout.tv_nsec = (server.next_vblank - now) % 1000000000ULL;
+        }
+        else
+        {
+            timeout.tv_sec = timeout.tv_nsec = 0;
+        }
+        if (ppoll(pfds, count, &timeout, NULL) <= 0)
+        {
+            continue;
+        }
+
+        // Only this thread adds or removes clients, so everything in polled
+        // is still valid.
+        pthread_mutex_lock(&server.mutex);
+        for (i=0; i<count; i++)
+        {
+            if (pfds[i].revents == 0)
+            {
+                continue;
+            }
+            if (polled[i] == NULL)
+            {
+                AcceptClient();
+            }
+            else
+            {
+                ReadFromClient(polled[i]);
+            }
+        }
+        glvnd_list_for_each_entry_safe(client, clientNext, &server.clients, entry)
+        {
+            if (client->failed)
+            {
+                FreeClient(client);
+            }
+        }
+        pthread_mutex_unlock(&server.mutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * Creates the listening socket, using the first display number that isn't
+ * already taken.
+ */
+static int OpenListenSocket(void)
+{
+    int fd;
+    int i;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    for (i=FIRST_DISPLAY; i<FIRST_DISPLAY + MAX_DISPLAYS; i++)
+    {
+        struct sockaddr_un addr = {};
+        socklen_t addrLen;
+
+        // This is the same abstract socket name that libxcb tries first for
+        // a local display.
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "/tmp/.X11-unix/X%d", i);
+        addrLen = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1);
+
+        if (bind(fd, (struct sockaddr *) &addr, addrLen) == 0)
+        {
+            if (listen(fd, MAX_CLIENTS) != 0)
+            {
+                break;
+            }
+            snprintf(server.display_name, sizeof(server.display_name), ":%d", i);
+            return fd;
+        }
+        if (errno != EADDRINUSE)
+        {
+            break;
+        }
+    }
+
+    close(fd);
+    return -1;
+}
+
+const char *fakeServerStart(uint64_t refresh_period, FakePresentMode mode)
+{
+    const char *name = NULL;
+    pthread_t thread;
+
+    pthread_mutex_lock(&server.mutex);
+    if (server.listen_fd >= 0)
+    {
+        name = server.display_name;
+        goto done;
+    }
+
+    glvnd_list_init(&server.clients);
+    glvnd_list_init(&server.windows);
+    glvnd_list_init(&server.pixmaps);
+    glvnd_list_init(&server.fences);
+
+    server.refresh_period = (refresh_period > 0 ? refresh_period : 16666667);
+    server.mode = mode;
+    server.start_time = eplGetMonotonicTime();
+    server.next_vblank = server.start_time;
+    server.next_window = FIRST_WINDOW;
+
+    if (!BuildSetup() || AddWindow(ROOT_WINDOW, ROOT_WIDTH, ROOT_HEIGHT) == NULL)
+    {
+        goto done;
+    }
+
+    server.listen_fd = OpenListenSocket();
+    if (server.listen_fd < 0)
+    {
+        fprintf(stderr, "fake server: Can't find a free display number\n");
+        goto done;
+    }
+
+    if (pthread_create(&thread, NULL, ServerThread, NULL) != 0)
+    {
+        close(server.listen_fd);
+        server.listen_fd = -1;
+        goto done;
+    }
+    pthread_detach(thread);
+    name = server.display_name;
+
+done:
+    pthread_mutex_unlock(&server.mutex);
+    return name;
+}
+
+xcb_window_t fakeServerCreateWindow(uint16_t width, uint16_t height)
+{
+    xcb_window_t xwin = XCB_NONE;
+
+    pthread_mutex_lock(&server.mutex);
+    if (server.listen_fd >= 0 && AddWindow(server.next_window, width, height) != NULL)
+    {
+        xwin = server.next_window++;
+    }
+    pthread_mutex_unlock(&server.mutex);
+    return xwin;
+}
+
+void fakeServerConfigureWindow(xcb_window_t xwin, uint16_t width, uint16_t height)
+{
+    FakeWindow *win;
+
+    pthread_mutex_lock(&server.mutex);
+    win = FindWindow(xwin);
+    if (win != NULL)
+    {
+        win->width = width;
+        win->height = height;
+        SendConfigureNotify(win);
+    }
+    pthread_mutex_unlock(&server.mutex);
+}
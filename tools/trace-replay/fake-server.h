@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FAKE_SERVER_H
+#define FAKE_SERVER_H
+
+/**
+ * \file
+ *
+ * A fake X server for replaying present traces.
+ *
+ * The server runs in a thread in the same process, and clients connect to it
+ * with the normal libxcb through an abstract Unix socket. It only handles the
+ * requests that the platform library sends for a window surface, and it
+ * answers anything else with a BadRequest error. It reports DRI3 1.2 and
+ * Present 1.2, and runs a simulated display that starts a new refresh cycle
+ * once every refresh period.
+ *
+ * In flip mode, the server shows at most one PresentPixmap request per
+ * refresh cycle, and a pixmap goes idle when the next one replaces it, like a
+ * fullscreen window that the server can page flip. In copy mode, every
+ * request whose target MSC has arrived is copied at the next refresh cycle,
+ * and its pixmap goes idle right away, like a composited or windowed client.
+ */
+
+#include <stdint.h>
+#include <xcb/xcb.h>
+#include <drm_fourcc.h>
+
+/**
+ * The block linear modifier that both the fake server and the stub driver
+ * support, so that the platform library picks the direct presentation path.
+ */
+#define FAKE_BLOCK_LINEAR_MODIFIER DRM_FORMAT_MOD_NVIDIA_BLOCK_LINEAR_2D(0, 1, 2, 0x06, 4)
+
+/**
+ * The device node that the fake server and the stub driver both report.
+ */
+#define FAKE_DRM_DEVICE_FILE "/dev/dri/card0"
+
+typedef enum
+{
+    FAKE_PRESENT_MODE_FLIP,
+    FAKE_PRESENT_MODE_COPY,
+} FakePresentMode;
+
+/**
+ * Starts the fake server.
+ *
+ * \param refresh_period The refresh period of the simulated display, in
+ *      nanoseconds.
+ * \param mode How the server displays a PresentPixmap request.
+ * \return The display name to pass to xcb_connect, or NULL on failure.
+ */
+const char *fakeServerStart(uint64_t refresh_period, FakePresentMode mode);
+
+/**
+ * Creates a mapped top-level window with the root visual.
+ */
+xcb_window_t fakeServerCreateWindow(uint16_t width, uint16_t height);
+
+/**
+ * Resizes a window, and sends a PresentConfigureNotify event to every client
+ * that selected for one.
+ */
+void fakeServerConfigureWindow(xcb_window_t xwin, uint16_t width, uint16_t height);
+
+#endif // FAKE_SERVER_H
@@ -0,0 +1,992 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * \file
+ *
+ * The stub EGL driver. See stub-driver.h.
+ *
+ * The driver has one EGLDeviceEXT, one internal EGLDisplay, and one
+ * EGLConfig, all of which are static objects. It doesn't support contexts, so
+ * eglGetCurrentContext just returns a dummy handle whenever a surface is
+ * current.
+ */
+
+#include "stub-driver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <GL/gl.h>
+#include <drm_fourcc.h>
+
+#include "driver-platform-surface.h"
+#include "platform-utils.h"
+#include "fake-server.h"
+
+typedef struct
+{
+    int width;
+    int height;
+    int format;
+    int stride;
+    int offset;
+    unsigned long long modifier;
+
+    /**
+     * A memfd for a buffer from eglPlatformAllocColorBufferNVX, or -1 for an
+     * imported buffer.
+     */
+    int fd;
+} StubColorBuffer;
+
+typedef struct
+{
+    StubColorBuffer *front;
+    StubColorBuffer *back;
+    StubColorBuffer *blit_target;
+    EGLExtPlatformSurfaceUpdateCallback update_callback;
+    void *update_param;
+    EGLint swap_interval;
+} StubSurface;
+
+typedef struct
+{
+    uint64_t render_done;
+} StubSync;
+
+static struct
+{
+    StubSyncMode sync_mode;
+    const EGLExtPlatform *platform;
+    EGLint error;
+
+    EGLDisplay current_display;
+    EGLSurface current_surface;
+    StubSurface *current_internal;
+
+    /**
+     * The time that the most recent frame finishes rendering.
+     */
+    uint64_t render_done;
+} stub;
+
+static int stubDeviceObj;
+static int stubDisplayObj;
+static int stubConfigObj;
+static int stubContextObj;
+
+#define STUB_DEVICE ((EGLDeviceEXT) &stubDeviceObj)
+#define STUB_DISPLAY ((EGLDisplay) &stubDisplayObj)
+#define STUB_CONFIG ((EGLConfig) &stubConfigObj)
+#define STUB_CONTEXT ((EGLContext) &stubContextObj)
+
+static const char CLIENT_EXTENSIONS[] =
+    "EGL_EXT_client_extensions EGL_EXT_platform_base EGL_EXT_platform_device "
+    "EGL_EXT_device_base EGL_EXT_device_enumeration EGL_EXT_device_query";
+
+static const char DISPLAY_EXTENSIONS_FENCE[] =
+    "EGL_EXT_image_dma_buf_import EGL_EXT_image_dma_buf_import_modifiers "
+    "EGL_KHR_fence_sync EGL_KHR_wait_sync";
+
+static const char DISPLAY_EXTENSIONS_FINISH[] =
+    "EGL_EXT_image_dma_buf_import EGL_EXT_image_dma_buf_import_modifiers";
+
+static const EGLint STUB_FORMATS[] =
+{
+    DRM_FORMAT_XRGB8888,
+    DRM_FORMAT_ARGB8888,
+};
+
+static EGLBoolean SetError(EGLint error)
+{
+    stub.error = error;
+    return EGL_FALSE;
+}
+
+static EGLBoolean CheckDisplay(EGLDisplay dpy)
+{
+    if (dpy != STUB_DISPLAY)
+    {
+        return SetError(EGL_BAD_DISPLAY);
+    }
+    return EGL_TRUE;
+}
+
+static void SleepUntil(uint64_t deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static EGLBoolean StubSetError(EGLint error, EGLint msgType, const char *msg)
+{
+    fprintf(stderr, "egl-x11: error 0x%04x: %s\n", error, (msg != NULL ? msg : ""));
+    return EGL_TRUE;
+}
+
+static EGLint StubGetError(void)
+{
+    EGLint error = stub.error;
+    stub.error = EGL_SUCCESS;
+    return error;
+}
+
+static const char *StubQueryString(EGLDisplay dpy, EGLint name)
+{
+    if (dpy == EGL_NO_DISPLAY)
+    {
+        if (name == EGL_EXTENSIONS)
+        {
+            return CLIENT_EXTENSIONS;
+        }
+        else if (name == EGL_VERSION)
+        {
+            return "1.5";
+        }
+        SetError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+    if (!CheckDisplay(dpy))
+    {
+        return NULL;
+    }
+
+    switch (name)
+    {
+        case EGL_EXTENSIONS:
+            return (stub.sync_mode == STUB_SYNC_FENCE ? DISPLAY_EXTENSIONS_FENCE : DISPLAY_EXTENSIONS_FINISH);
+        case EGL_VENDOR:
+            return "egl-x11 stub driver";
+        case EGL_VERSION:
+            return "1.5";
+        case EGL_CLIENT_APIS:
+            return "OpenGL_ES";
+        default:
+            SetError(EGL_BAD_PARAMETER);
+            return NULL;
+    }
+}
+
+static EGLDisplay StubGetPlatformDisplay(EGLenum platform, void *native_display, const EGLAttrib *attrib_list)
+{
+    if (platform != EGL_PLATFORM_DEVICE_EXT || native_display != STUB_DEVICE)
+    {
+        SetError(EGL_BAD_PARAMETER);
+        return EGL_NO_DISPLAY;
+    }
+    return STUB_DISPLAY;
+}
+
+static EGLBoolean StubInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (major != NULL)
+    {
+        *major = 1;
+    }
+    if (minor != NULL)
+    {
+        *minor = 5;
+    }
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubTerminate(EGLDisplay dpy)
+{
+    return CheckDisplay(dpy);
+}
+
+static EGLBoolean StubQueryDevicesEXT(EGLint max_devices, EGLDeviceEXT *devices, EGLint *num_devices)
+{
+    if (num_devices == NULL)
+    {
+        return SetError(EGL_BAD_PARAMETER);
+    }
+    if (devices != NULL && max_devices > 0)
+    {
+        devices[0] = STUB_DEVICE;
+    }
+    *num_devices = 1;
+    return EGL_TRUE;
+}
+
+static const char *StubQueryDeviceStringEXT(EGLDeviceEXT device, EGLint name)
+{
+    if (device != STUB_DEVICE)
+    {
+        SetError(EGL_BAD_DEVICE_EXT);
+        return NULL;
+    }
+    if (name == EGL_EXTENSIONS)
+    {
+        return "EGL_EXT_device_drm";
+    }
+    else if (name == EGL_DRM_DEVICE_FILE_EXT)
+    {
+        return FAKE_DRM_DEVICE_FILE;
+    }
+    SetError(EGL_BAD_PARAMETER);
+    return NULL;
+}
+
+static EGLBoolean StubQueryDeviceAttribEXT(EGLDeviceEXT device, EGLint attribute, EGLAttrib *value)
+{
+    if (device != STUB_DEVICE)
+    {
+        return SetError(EGL_BAD_DEVICE_EXT);
+    }
+    return SetError(EGL_BAD_ATTRIBUTE);
+}
+
+static EGLBoolean StubQueryDisplayAttribEXT(EGLDisplay dpy, EGLint attribute, EGLAttrib *value)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (attribute == EGL_DEVICE_EXT)
+    {
+        *value = (EGLAttrib) STUB_DEVICE;
+        return EGL_TRUE;
+    }
+    return SetError(EGL_BAD_ATTRIBUTE);
+}
+
+static EGLBoolean StubQueryDisplayAttribKHR(EGLDisplay dpy, EGLint name, EGLAttrib *value)
+{
+    return StubQueryDisplayAttribEXT(dpy, name, value);
+}
+
+static EGLBoolean StubGetConfigs(EGLDisplay dpy, EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (num_config == NULL)
+    {
+        return SetError(EGL_BAD_PARAMETER);
+    }
+    if (configs != NULL)
+    {
+        *num_config = 0;
+        if (config_size > 0)
+        {
+            configs[0] = STUB_CONFIG;
+            *num_config = 1;
+        }
+    }
+    else
+    {
+        *num_config = 1;
+    }
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubChooseConfig(EGLDisplay dpy, const EGLint *attrib_list,
+        EGLConfig *configs, EGLint config_size, EGLint *num_config)
+{
+    // There's only one config, so don't bother filtering it.
+    return StubGetConfigs(dpy, configs, config_size, num_config);
+}
+
+static EGLBoolean StubGetConfigAttrib(EGLDisplay dpy, EGLConfig config, EGLint attribute, EGLint *value)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (config != STUB_CONFIG)
+    {
+        return SetError(EGL_BAD_CONFIG);
+    }
+
+    switch (attribute)
+    {
+        case EGL_RED_SIZE:
+        case EGL_GREEN_SIZE:
+        case EGL_BLUE_SIZE:
+            *value = 8;
+            return EGL_TRUE;
+        case EGL_ALPHA_SIZE:
+        case EGL_DEPTH_SIZE:
+        case EGL_STENCIL_SIZE:
+        case EGL_SAMPLES:
+        case EGL_SAMPLE_BUFFERS:
+        case EGL_NATIVE_VISUAL_ID:
+            *value = 0;
+            return EGL_TRUE;
+        case EGL_BUFFER_SIZE:
+            *value = 24;
+            return EGL_TRUE;
+        case EGL_CONFIG_ID:
+            *value = 1;
+            return EGL_TRUE;
+        case EGL_SURFACE_TYPE:
+            *value = EGL_WINDOW_BIT | EGL_PBUFFER_BIT | EGL_STREAM_BIT_KHR;
+            return EGL_TRUE;
+        case EGL_RENDERABLE_TYPE:
+        case EGL_CONFORMANT:
+            *value = EGL_OPENGL_ES2_BIT;
+            return EGL_TRUE;
+        case EGL_COLOR_BUFFER_TYPE:
+            *value = EGL_RGB_BUFFER;
+            return EGL_TRUE;
+        case EGL_CONFIG_CAVEAT:
+        case EGL_NATIVE_VISUAL_TYPE:
+        case EGL_TRANSPARENT_TYPE:
+            *value = EGL_NONE;
+            return EGL_TRUE;
+        default:
+            return SetError(EGL_BAD_ATTRIBUTE);
+    }
+}
+
+static EGLBoolean StubPlatformGetConfigAttribNVX(EGLDisplay dpy, EGLConfig config, EGLint attribute, EGLint *value)
+{
+    if (attribute == EGL_LINUX_DRM_FOURCC_EXT)
+    {
+        if (!CheckDisplay(dpy))
+        {
+            return EGL_FALSE;
+        }
+        if (config != STUB_CONFIG)
+        {
+            return SetError(EGL_BAD_CONFIG);
+        }
+        *value = DRM_FORMAT_XRGB8888;
+        return EGL_TRUE;
+    }
+    return StubGetConfigAttrib(dpy, config, attribute, value);
+}
+
+static EGLBoolean StubQueryDmaBufFormatsEXT(EGLDisplay dpy, EGLint max_formats, EGLint *formats, EGLint *num_formats)
+{
+    static const EGLint count = sizeof(STUB_FORMATS) / sizeof(STUB_FORMATS[0]);
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (formats != NULL)
+    {
+        *num_formats = (max_formats < count ? max_formats : count);
+        memcpy(formats, STUB_FORMATS, *num_formats * sizeof(EGLint));
+    }
+    else
+    {
+        *num_formats = count;
+    }
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubQueryDmaBufModifiersEXT(EGLDisplay dpy, EGLint format, EGLint max_modifiers,
+        EGLuint64KHR *modifiers, EGLBoolean *external_only, EGLint *num_modifiers)
+{
+    // The driver renders to block linear buffers, and can only sample from
+    // pitch linear buffers.
+    static const EGLuint64KHR MODIFIERS[] = { FAKE_BLOCK_LINEAR_MODIFIER, DRM_FORMAT_MOD_LINEAR };
+    static const EGLBoolean EXTERNAL[] = { EGL_FALSE, EGL_TRUE };
+    static const EGLint count = sizeof(MODIFIERS) / sizeof(MODIFIERS[0]);
+    EGLint i;
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (format != DRM_FORMAT_XRGB8888 && format != DRM_FORMAT_ARGB8888)
+    {
+        return SetError(EGL_BAD_PARAMETER);
+    }
+
+    if (modifiers == NULL)
+    {
+        *num_modifiers = count;
+        return EGL_TRUE;
+    }
+
+    *num_modifiers = (max_modifiers < count ? max_modifiers : count);
+    for (i=0; i<*num_modifiers; i++)
+    {
+        modifiers[i] = MODIFIERS[i];
+        if (external_only != NULL)
+        {
+            external_only[i] = EXTERNAL[i];
+        }
+    }
+    return EGL_TRUE;
+}
+
+static EGLPlatformColorBufferNVX NewColorBuffer(int width, int height, int format,
+        int stride, int offset, unsigned long long modifier, int fd)
+{
+    StubColorBuffer *buffer = calloc(1, sizeof(StubColorBuffer));
+    if (buffer == NULL)
+    {
+        SetError(EGL_BAD_ALLOC);
+        return NULL;
+    }
+    buffer->width = width;
+    buffer->height = height;
+    buffer->format = format;
+    buffer->stride = stride;
+    buffer->offset = offset;
+    buffer->modifier = modifier;
+    buffer->fd = fd;
+    return (EGLPlatformColorBufferNVX) buffer;
+}
+
+static EGLPlatformColorBufferNVX StubPlatformImportColorBufferNVX(EGLDisplay dpy,
+        int fd, int width, int height, int format, int stride, int offset,
+        unsigned long long modifier)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return NULL;
+    }
+    if (fd < 0 || width <= 0 || height <= 0)
+    {
+        SetError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+
+    // Like the real driver, this doesn't take ownership of the file
+    // descriptor.
+    return NewColorBuffer(width, height, format, stride, offset, modifier, -1);
+}
+
+static EGLPlatformColorBufferNVX StubPlatformAllocColorBufferNVX(EGLDisplay dpy,
+        int width, int height, int format, unsigned long long modifier,
+        EGLBoolean force_sysmem)
+{
+    EGLPlatformColorBufferNVX buffer;
+    int stride = (width * 4 + 255) & ~255;
+    int fd;
+
+    if (!CheckDisplay(dpy))
+    {
+        return NULL;
+    }
+
+    fd = memfd_create("stub-color-buffer", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, ((off_t) stride) * height) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        SetError(EGL_BAD_ALLOC);
+        return NULL;
+    }
+
+    buffer = NewColorBuffer(width, height, format, stride, 0, modifier, fd);
+    if (buffer == NULL)
+    {
+        close(fd);
+    }
+    return buffer;
+}
+
+static EGLBoolean StubPlatformExportColorBufferNVX(EGLDisplay dpy, EGLPlatformColorBufferNVX handle,
+        int *ret_fd, int *ret_width, int *ret_height, int *ret_format, int *ret_stride, int *ret_offset,
+        unsigned long long *ret_modifier)
+{
+    StubColorBuffer *buffer = (StubColorBuffer *) handle;
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (buffer == NULL || buffer->fd < 0)
+    {
+        // Only allocated buffers can be exported.
+        return SetError(EGL_BAD_PARAMETER);
+    }
+
+    if (ret_fd != NULL)
+    {
+        *ret_fd = dup(buffer->fd);
+        if (*ret_fd < 0)
+        {
+            return SetError(EGL_BAD_ALLOC);
+        }
+    }
+    if (ret_width != NULL)
+    {
+        *ret_width = buffer->width;
+    }
+    if (ret_height != NULL)
+    {
+        *ret_height = buffer->height;
+    }
+    if (ret_format != NULL)
+    {
+        *ret_format = buffer->format;
+    }
+    if (ret_stride != NULL)
+    {
+        *ret_stride = buffer->stride;
+    }
+    if (ret_offset != NULL)
+    {
+        *ret_offset = buffer->offset;
+    }
+    if (ret_modifier != NULL)
+    {
+        *ret_modifier = buffer->modifier;
+    }
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubPlatformCopyColorBufferNVX(EGLDisplay dpy,
+        EGLPlatformColorBufferNVX src, EGLPlatformColorBufferNVX dst)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (src == NULL || dst == NULL)
+    {
+        return SetError(EGL_BAD_PARAMETER);
+    }
+    return EGL_TRUE;
+}
+
+static void StubPlatformFreeColorBufferNVX(EGLDisplay dpy, EGLPlatformColorBufferNVX handle)
+{
+    StubColorBuffer *buffer = (StubColorBuffer *) handle;
+
+    if (buffer != NULL)
+    {
+        if (buffer->fd >= 0)
+        {
+            close(buffer->fd);
+        }
+        free(buffer);
+    }
+}
+
+static void ParseColorBuffers(StubSurface *surf, const EGLAttrib *attribs)
+{
+    int i;
+
+    for (i=0; attribs[i] != EGL_NONE; i += 2)
+    {
+        if (attribs[i] == GL_FRONT)
+        {
+            surf->front = (StubColorBuffer *) attribs[i + 1];
+        }
+        else if (attribs[i] == GL_BACK)
+        {
+            surf->back = (StubColorBuffer *) attribs[i + 1];
+        }
+        else if (attribs[i] == EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX)
+        {
+            surf->blit_target = (StubColorBuffer *) attribs[i + 1];
+        }
+        else if (attribs[i] == EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_NVX)
+        {
+            surf->update_callback = (EGLExtPlatformSurfaceUpdateCallback) attribs[i + 1];
+        }
+        else if (attribs[i] == EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_PARAM_NVX)
+        {
+            surf->update_param = (void *) attribs[i + 1];
+        }
+    }
+}
+
+static EGLSurface StubPlatformCreateSurfaceNVX(EGLDisplay dpy, EGLConfig config,
+        const EGLAttrib *platformAttribs, const EGLAttrib *attribs)
+{
+    StubSurface *surf;
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_NO_SURFACE;
+    }
+    if (config != STUB_CONFIG)
+    {
+        SetError(EGL_BAD_CONFIG);
+        return EGL_NO_SURFACE;
+    }
+
+    surf = calloc(1, sizeof(StubSurface));
+    if (surf == NULL)
+    {
+        SetError(EGL_BAD_ALLOC);
+        return EGL_NO_SURFACE;
+    }
+    surf->swap_interval = 1;
+    if (platformAttribs != NULL)
+    {
+        ParseColorBuffers(surf, platformAttribs);
+    }
+    if (surf->back == NULL)
+    {
+        free(surf);
+        SetError(EGL_BAD_PARAMETER);
+        return EGL_NO_SURFACE;
+    }
+    return (EGLSurface) surf;
+}
+
+static EGLBoolean StubPlatformSetColorBuffersNVX(EGLDisplay dpy, EGLSurface esurf, const EGLAttrib *buffers)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (esurf == EGL_NO_SURFACE || buffers == NULL)
+    {
+        return SetError(EGL_BAD_PARAMETER);
+    }
+    ParseColorBuffers((StubSurface *) esurf, buffers);
+    return EGL_TRUE;
+}
+
+static EGLSurface StubCreatePbufferSurface(EGLDisplay dpy, EGLConfig config, const EGLint *attrib_list)
+{
+    SetError(EGL_BAD_MATCH);
+    return EGL_NO_SURFACE;
+}
+
+static EGLBoolean StubDestroySurface(EGLDisplay dpy, EGLSurface esurf)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (esurf == EGL_NO_SURFACE)
+    {
+        return SetError(EGL_BAD_SURFACE);
+    }
+    if (stub.current_internal == (StubSurface *) esurf)
+    {
+        stub.current_internal = NULL;
+    }
+    free(esurf);
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubSwapBuffers(EGLDisplay dpy, EGLSurface esurf)
+{
+    // Window surfaces go through the platform library, and the stub driver
+    // doesn't support any other kind.
+    return SetError(EGL_BAD_SURFACE);
+}
+
+static EGLBoolean StubSwapInterval(EGLDisplay dpy, EGLint interval)
+{
+    if (stub.current_internal == NULL)
+    {
+        return SetError(EGL_BAD_SURFACE);
+    }
+    stub.current_internal->swap_interval = interval;
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubQuerySurface(EGLDisplay dpy, EGLSurface esurf, EGLint attribute, EGLint *value)
+{
+    StubSurface *surf = (StubSurface *) esurf;
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    if (surf == NULL)
+    {
+        return SetError(EGL_BAD_SURFACE);
+    }
+
+    switch (attribute)
+    {
+        case EGL_WIDTH:
+            *value = surf->back->width;
+            return EGL_TRUE;
+        case EGL_HEIGHT:
+            *value = surf->back->height;
+            return EGL_TRUE;
+        case EGL_CONFIG_ID:
+            *value = 1;
+            return EGL_TRUE;
+        case EGL_RENDER_BUFFER:
+            *value = (surf->front != NULL ? EGL_BACK_BUFFER : EGL_SINGLE_BUFFER);
+            return EGL_TRUE;
+        case EGL_SURFACE_Y_INVERTED_NVX:
+            *value = EGL_TRUE;
+            return EGL_TRUE;
+        default:
+            return SetError(EGL_BAD_ATTRIBUTE);
+    }
+}
+
+static EGLDisplay StubGetCurrentDisplay(void)
+{
+    return stub.current_display;
+}
+
+static EGLSurface StubGetCurrentSurface(EGLint readdraw)
+{
+    return stub.current_surface;
+}
+
+static EGLContext StubGetCurrentContext(void)
+{
+    return (stub.current_surface != EGL_NO_SURFACE ? STUB_CONTEXT : EGL_NO_CONTEXT);
+}
+
+static EGLBoolean StubMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
+{
+    StubSurface *internal = NULL;
+
+    if (draw != read)
+    {
+        return SetError(EGL_BAD_MATCH);
+    }
+
+    if (draw != EGL_NO_SURFACE)
+    {
+        // Like the real driver, look up the internal surface through the
+        // platform library.
+        if (stub.platform == NULL)
+        {
+            return SetError(EGL_BAD_SURFACE);
+        }
+        internal = stub.platform->exports.getInternalHandle(dpy, EGL_OBJECT_SURFACE_KHR, draw);
+        if (internal == NULL)
+        {
+            return SetError(EGL_BAD_SURFACE);
+        }
+    }
+
+    stub.current_display = (draw != EGL_NO_SURFACE ? dpy : EGL_NO_DISPLAY);
+    stub.current_surface = draw;
+    stub.current_internal = internal;
+
+    if (internal != NULL && internal->update_callback != NULL)
+    {
+        internal->update_callback(internal->update_param);
+    }
+    return EGL_TRUE;
+}
+
+static EGLSync StubCreateSync(EGLDisplay dpy, EGLenum type, const EGLAttrib *attrib_list)
+{
+    StubSync *sync;
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_NO_SYNC;
+    }
+    if (type != EGL_SYNC_FENCE || stub.sync_mode != STUB_SYNC_FENCE)
+    {
+        SetError(EGL_BAD_PARAMETER);
+        return EGL_NO_SYNC;
+    }
+
+    sync = malloc(sizeof(StubSync));
+    if (sync == NULL)
+    {
+        SetError(EGL_BAD_ALLOC);
+        return EGL_NO_SYNC;
+    }
+    sync->render_done = stub.render_done;
+    return (EGLSync) sync;
+}
+
+static EGLBoolean StubDestroySync(EGLDisplay dpy, EGLSync sync)
+{
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+    free(sync);
+    return EGL_TRUE;
+}
+
+static EGLBoolean StubWaitSync(EGLDisplay dpy, EGLSync sync, EGLint flags)
+{
+    // A server-side wait doesn't block the caller.
+    return CheckDisplay(dpy);
+}
+
+static EGLint StubClientWaitSync(EGLDisplay dpy, EGLSync handle, EGLint flags, EGLTime timeout)
+{
+    StubSync *sync = handle;
+    uint64_t now = eplGetMonotonicTime();
+
+    if (!CheckDisplay(dpy))
+    {
+        return EGL_FALSE;
+    }
+
+    if (now < sync->render_done)
+    {
+        if (timeout == EGL_FOREVER || now + timeout >= sync->render_done)
+        {
+            SleepUntil(sync->render_done);
+        }
+        else
+        {
+            SleepUntil(now + timeout);
+            return EGL_TIMEOUT_EXPIRED;
+        }
+    }
+    return EGL_CONDITION_SATISFIED;
+}
+
+static EGLint StubDupNativeFenceFDANDROID(EGLDisplay dpy, EGLSync sync)
+{
+    SetError(EGL_BAD_PARAMETER);
+    return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+}
+
+static void StubFlush(void)
+{
+}
+
+static void StubFinish(void)
+{
+    SleepUntil(stub.render_done);
+}
+
+static EGLint StubPlatformGetVersionNVX(void)
+{
+    return (EGL_PLATFORM_SURFACE_INTERFACE_MAJOR_VERSION << 16) | 1;
+}
+
+typedef struct
+{
+    const char *name;
+    void *func;
+} StubProc;
+
+static const StubProc STUB_PROCS[] =
+{
+    { "eglChooseConfig", StubChooseConfig },
+    { "eglClientWaitSync", StubClientWaitSync },
+    { "eglCreatePbufferSurface", StubCreatePbufferSurface },
+    { "eglCreateSync", StubCreateSync },
+    { "eglDestroySurface", StubDestroySurface },
+    { "eglDestroySync", StubDestroySync },
+    { "eglDupNativeFenceFDANDROID", StubDupNativeFenceFDANDROID },
+    { "eglGetConfigAttrib", StubGetConfigAttrib },
+    { "eglGetConfigs", StubGetConfigs },
+    { "eglGetCurrentContext", StubGetCurrentContext },
+    { "eglGetCurrentDisplay", StubGetCurrentDisplay },
+    { "eglGetCurrentSurface", StubGetCurrentSurface },
+    { "eglGetError", StubGetError },
+    { "eglGetPlatformDisplay", StubGetPlatformDisplay },
+    { "eglInitialize", StubInitialize },
+    { "eglMakeCurrent", StubMakeCurrent },
+    { "eglPlatformAllocColorBufferNVX", StubPlatformAllocColorBufferNVX },
+    { "eglPlatformCopyColorBufferNVX", StubPlatformCopyColorBufferNVX },
+    { "eglPlatformCreateSurfaceNVX", StubPlatformCreateSurfaceNVX },
+    { "eglPlatformExportColorBufferNVX", StubPlatformExportColorBufferNVX },
+    { "eglPlatformFreeColorBufferNVX", StubPlatformFreeColorBufferNVX },
+    { "eglPlatformGetConfigAttribNVX", StubPlatformGetConfigAttribNVX },
+    { "eglPlatformGetVersionNVX", StubPlatformGetVersionNVX },
+    { "eglPlatformImportColorBufferNVX", StubPlatformImportColorBufferNVX },
+    { "eglPlatformSetColorBuffersNVX", StubPlatformSetColorBuffersNVX },
+    { "eglQueryDeviceAttribEXT", StubQueryDeviceAttribEXT },
+    { "eglQueryDeviceStringEXT", StubQueryDeviceStringEXT },
+    { "eglQueryDevicesEXT", StubQueryDevicesEXT },
+    { "eglQueryDisplayAttribEXT", StubQueryDisplayAttribEXT },
+    { "eglQueryDisplayAttribKHR", StubQueryDisplayAttribKHR },
+    { "eglQueryDmaBufFormatsEXT", StubQueryDmaBufFormatsEXT },
+    { "eglQueryDmaBufModifiersEXT", StubQueryDmaBufModifiersEXT },
+    { "eglQueryString", StubQueryString },
+    { "eglQuerySurface", StubQuerySurface },
+    { "eglSwapBuffers", StubSwapBuffers },
+    { "eglSwapInterval", StubSwapInterval },
+    { "eglTerminate", StubTerminate },
+    { "eglWaitSync", StubWaitSync },
+    { "glFinish", StubFinish },
+    { "glFlush", StubFlush },
+};
+
+static void *StubGetProcAddress(const char *name)
+{
+    size_t i;
+
+    for (i=0; i<sizeof(STUB_PROCS) / sizeof(STUB_PROCS[0]); i++)
+    {
+        if (strcmp(STUB_PROCS[i].name, name) == 0)
+        {
+            return STUB_PROCS[i].func;
+        }
+    }
+    return NULL;
+}
+
+const EGLExtDriver *stubDriverInit(StubSyncMode mode)
+{
+    static EGLExtDriver driver;
+
+    stub.sync_mode = mode;
+    driver.getProcAddress = StubGetProcAddress;
+    driver.setError = StubSetError;
+    return &driver;
+}
+
+void stubDriverSetPlatform(const EGLExtPlatform *platform)
+{
+    stub.platform = platform;
+}
+
+EGLConfig stubDriverGetConfig(void)
+{
+    return STUB_CONFIG;
+}
+
+EGLBoolean stubDriverMakeCurrent(EGLDisplay edpy, EGLSurface esurf)
+{
+    return StubMakeCurrent(edpy, esurf, esurf, (esurf != EGL_NO_SURFACE ? STUB_CONTEXT : EGL_NO_CONTEXT));
+}
+
+void stubDriverBeginFrame(void)
+{
+    StubSurface *surf = stub.current_internal;
+
+    if (surf != NULL && surf->update_callback != NULL)
+    {
+        surf->update_callback(surf->update_param);
+    }
+}
+
+void stubDriverEndFrame(uint64_t gpu_time)
+{
+    uint64_t now = eplGetMonotonicTime();
+    uint64_t start = (stub.render_done > now ? stub.render_done : now);
+
+    stub.render_done = start + gpu_time;
+}
@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STUB_DRIVER_H
+#define STUB_DRIVER_H
+
+/**
+ * \file
+ *
+ * A stub EGL driver for replaying present traces.
+ *
+ * The stub driver implements the functions that the platform library needs
+ * from an EGLExtDriver, including the EGL_NVX platform surface interface, but
+ * it never renders anything. Instead, the caller tells it how long each frame
+ * would take on the GPU, and the driver's sync functions wait until that
+ * rendering would have finished.
+ */
+
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <eglexternalplatform.h>
+
+typedef enum
+{
+    /**
+     * Advertise EGL_KHR_fence_sync, so that the platform library waits for
+     * rendering in its deferred present thread.
+     */
+    STUB_SYNC_FENCE,
+
+    /**
+     * Don't advertise any sync extensions, so that the platform library
+     * calls glFinish in eglSwapBuffers.
+     */
+    STUB_SYNC_FINISH,
+} StubSyncMode;
+
+/**
+ * Returns the EGLExtDriver struct to pass to loadEGLExternalPlatform.
+ */
+const EGLExtDriver *stubDriverInit(StubSyncMode mode);
+
+/**
+ * Tells the stub driver about the platform library, so that it can look up
+ * the internal handles for an EGLSurface in eglMakeCurrent.
+ */
+void stubDriverSetPlatform(const EGLExtPlatform *platform);
+
+/**
+ * Returns the driver's only EGLConfig, which is a 24-bit XRGB8888 config.
+ */
+EGLConfig stubDriverGetConfig(void);
+
+/**
+ * Makes a surface current, the same way that the driver's eglMakeCurrent
+ * would if it were called through libglvnd.
+ *
+ * \param edpy The external EGLDisplay handle.
+ * \param esurf The external EGLSurface handle, or EGL_NO_SURFACE.
+ */
+EGLBoolean stubDriverMakeCurrent(EGLDisplay edpy, EGLSurface esurf);
+
+/**
+ * Starts rendering a frame to the current surface.
+ *
+ * The real driver calls the platform library's update callback before it
+ * draws anything, so this does the same.
+ */
+void stubDriverBeginFrame(void);
+
+/**
+ * Finishes rendering a frame.
+ *
+ * Rendering is serialized, like it would be on a GPU, so the frame finishes
+ * \p gpu_time nanoseconds after the later of now and the end of the previous
+ * frame.
+ */
+void stubDriverEndFrame(uint64_t gpu_time);
+
+#endif // STUB_DRIVER_H
@@ -0,0 +1,965 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * \file
+ *
+ * Replays a present trace against a fake X server and a stub driver.
+ *
+ * The tool reads a trace from __NV_X11_EGL_PRESENT_TRACE, and for one window
+ * in it, works out how long the application spent between eglSwapBuffers
+ * calls and how long each frame took to render. It then runs the same frame
+ * loop through the platform library, with the same timing, and records a new
+ * trace. Finally, it prints summaries of both traces side by side.
+ *
+ * Since the replay runs the real presentation code, this shows how a change
+ * to the library, or to any of its environment variables, would have changed
+ * the recorded frame timing.
+ *
+ * The replay runs in a child process, because the platform library only
+ * closes its trace file when the process exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <xcb/xcb.h>
+#include <xcb/present.h>
+
+#include "x11-trace.h"
+#include "fake-server.h"
+#include "stub-driver.h"
+
+#ifndef EGL_EXT_platform_xcb
+#define EGL_EXT_platform_xcb 1
+#define EGL_PLATFORM_XCB_EXT              0x31DC
+#define EGL_PLATFORM_XCB_SCREEN_EXT       0x31DE
+#endif /* EGL_EXT_platform_xcb */
+
+#define DEFAULT_REFRESH_PERIOD 16666667ULL
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define PRESENT_WINDOW_DESTROYED_FLAG (1 << 0)
+
+static const char *PRESENT_TRACE_ENV = "__NV_X11_EGL_PRESENT_TRACE";
+
+EGLBoolean loadEGLExternalPlatform(int major, int minor,
+        const EGLExtDriver *driver, EGLExtPlatform *extplatform);
+
+typedef struct
+{
+    X11TraceRecord *records;
+    size_t count;
+} Trace;
+
+typedef struct
+{
+    /**
+     * The time between the end of the previous eglSwapBuffers call and the
+     * start of this one.
+     */
+    uint64_t app_time;
+
+    /**
+     * How long after the start of eglSwapBuffers rendering finished.
+     */
+    uint64_t gpu_time;
+
+    /**
+     * The serial number that this frame's PresentPixmap request used.
+     */
+    uint32_t serial;
+
+    /**
+     * If non-zero, the window size changed before this frame.
+     */
+    uint16_t width;
+    uint16_t height;
+} ReplayFrame;
+
+typedef struct
+{
+    const char *input_path;
+    const char *output_path;
+    uint32_t window;
+    size_t max_frames;
+    uint64_t refresh_period;
+    uint16_t width;
+    uint16_t height;
+    StubSyncMode sync_mode;
+    FakePresentMode present_mode;
+} ReplayOptions;
+
+typedef struct
+{
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+typedef struct
+{
+    size_t frames;
+    uint64_t elapsed;
+    Samples swap_time;
+    Samples frame_interval;
+    Samples latency;
+    size_t modes[4];
+    size_t late;
+    size_t buffer_waits;
+    uint64_t buffer_wait_time;
+    size_t frame_waits;
+    uint64_t frame_wait_time;
+    size_t frame_limits;
+    size_t hidden_skips;
+} TraceStats;
+
+static void *CheckAlloc(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void AddSample(Samples *samples, uint64_t value)
+{
+    if (samples->count >= samples->capacity)
+    {
+        samples->capacity = (samples->capacity > 0 ? samples->capacity * 2 : 256);
+        samples->values = CheckAlloc(realloc(samples->values,
+                    samples->capacity * sizeof(uint64_t)));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int CompareU64(const void *p1, const void *p2)
+{
+    uint64_t v1 = *((const uint64_t *) p1);
+    uint64_t v2 = *((const uint64_t *) p2);
+    return (v1 < v2 ? -1 : (v1 > v2 ? 1 : 0));
+}
+
+/**
+ * Returns a percentile of a set of samples. This sorts the samples in place.
+ */
+static uint64_t Percentile(Samples *samples, int percent)
+{
+    if (samples->count == 0)
+    {
+        return 0;
+    }
+    qsort(samples->values, samples->count, sizeof(uint64_t), CompareU64);
+    return samples->values[(samples->count - 1) * percent / 100];
+}
+
+static uint64_t Mean(const Samples *samples)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    if (samples->count == 0)
+    {
+        return 0;
+    }
+    for (i=0; i<samples->count; i++)
+    {
+        sum += samples->values[i];
+    }
+    return sum / samples->count;
+}
+
+static int CompareRecords(const void *p1, const void *p2)
+{
+    const X11TraceRecord *r1 = p1;
+    const X11TraceRecord *r2 = p2;
+
+    if (r1->timestamp != r2->timestamp)
+    {
+        return (r1->timestamp < r2->timestamp ? -1 : 1);
+    }
+    return (int) r1->type - (int) r2->type;
+}
+
+/**
+ * Reads a trace file, and sorts the records by timestamp.
+ *
+ * The render and release records are written after the fact, so they aren't
+ * in order in the file.
+ */
+static int LoadTrace(const char *path, Trace *trace)
+{
+    X11TraceHeader header;
+    size_t capacity = 0;
+    FILE *fp;
+
+    trace->records = NULL;
+    trace->count = 0;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1
+            || memcmp(header.magic, X11_TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a present trace\n", path);
+        fclose(fp);
+        return 0;
+    }
+    if (header.byte_order != 0x01020304)
+    {
+        fprintf(stderr, "%s was recorded on a host with a different byte order\n", path);
+        fclose(fp);
+        return 0;
+    }
+    if (header.version != X11_TRACE_VERSION)
+    {
+        fprintf(stderr, "%s has version %u, but only version %d is supported\n",
+                path, header.version, X11_TRACE_VERSION);
+        fclose(fp);
+        return 0;
+    }
+
+    while (1)
+    {
+        if (trace->count >= capacity)
+        {
+            capacity = (capacity > 0 ? capacity * 2 : 4096);
+            trace->records = CheckAlloc(realloc(trace->records, capacity * sizeof(X11TraceRecord)));
+        }
+        if (fread(&trace->records[trace->count], sizeof(X11TraceRecord), 1, fp) != 1)
+        {
+            break;
+        }
+        trace->count++;
+    }
+    fclose(fp);
+
+    qsort(trace->records, trace->count, sizeof(X11TraceRecord), CompareRecords);
+    return 1;
+}
+
+/**
+ * Returns the first window in a trace that called eglSwapBuffers.
+ */
+static uint32_t FindTraceWindow(const Trace *trace)
+{
+    size_t i;
+
+    for (i=0; i<trace->count; i++)
+    {
+        if (trace->records[i].type == X11_TRACE_SWAP_BEGIN)
+        {
+            return trace->records[i].window;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Estimates the refresh period from the MSC and timestamp of each
+ * PresentCompleteNotify event.
+ */
+static uint64_t EstimateRefreshPeriod(const Trace *trace, uint32_t window)
+{
+    const X11TraceRecord *prev = NULL;
+    Samples samples = {};
+    uint64_t period = DEFAULT_REFRESH_PERIOD;
+    size_t i;
+
+    for (i=0; i<trace->count; i++)
+    {
+        const X11TraceRecord *rec = &trace->records[i];
+        if (rec->window != window || rec->type != X11_TRACE_COMPLETE_NOTIFY)
+        {
+            continue;
+        }
+        if (prev != NULL && rec->msc > prev->msc && rec->timestamp > prev->timestamp)
+        {
+            AddSample(&samples, (rec->timestamp - prev->timestamp) / (rec->msc - prev->msc));
+        }
+        prev = rec;
+    }
+
+    if (samples.count > 0)
+    {
+        period = Percentile(&samples, 50);
+    }
+    free(samples.values);
+    return period;
+}
+
+/**
+ * Finds the last frame that used a given present serial.
+ *
+ * If eglSwapBuffers skipped a present because the window was hidden, then
+ * the next frame reuses the serial, so there can be more than one.
+ */
+static ReplayFrame *FindFrameForSerial(ReplayFrame *frames, size_t count, uint32_t serial)
+{
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (frames[mid].serial <= serial)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low > 0 && frames[low - 1].serial == serial)
+    {
+        return &frames[low - 1];
+    }
+    return NULL;
+}
+
+/**
+ * Works out the frame loop for one window in a trace.
+ *
+ * \param trace The trace.
+ * \param opts The replay options. If the caller didn't specify a window size,
+ *      then this fills it in from the trace.
+ * \param[out] ret_count Returns the number of frames.
+ * \param[out] ret_swap_interval Returns the swap interval to use.
+ * \return An array of frames, or NULL if the window doesn't have any.
+ */
+static ReplayFrame *ExtractFrames(const Trace *trace, ReplayOptions *opts,
+        size_t *ret_count, EGLint *ret_swap_interval)
+{
+    ReplayFrame *frames = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t numPresents = 0;
+    size_t numAsync = 0;
+    uint64_t lastEnd = 0;
+    uint16_t pendingWidth = 0;
+    uint16_t pendingHeight = 0;
+    int sizeFromTrace = (opts->width == 0);
+    size_t i;
+
+    for (i=0; i<trace->count; i++)
+    {
+        const X11TraceRecord *rec = &trace->records[i];
+
+        if (rec->window != opts->window)
+        {
+            continue;
+        }
+
+        if (rec->type == X11_TRACE_CONFIGURE_NOTIFY)
+        {
+            if (rec->flags & PRESENT_WINDOW_DESTROYED_FLAG)
+            {
+                break;
+            }
+            if (count == 0 && sizeFromTrace)
+            {
+                opts->width = rec->value >> 16;
+                opts->height = rec->value & 0xFFFF;
+            }
+            else if (count > 0)
+            {
+                pendingWidth = rec->value >> 16;
+                pendingHeight = rec->value & 0xFFFF;
+            }
+        }
+        else if (rec->type == X11_TRACE_SWAP_BEGIN)
+        {
+            ReplayFrame *frame;
+
+            if (opts->max_frames > 0 && count >= opts->max_frames)
+            {
+                break;
+            }
+            if (count >= capacity)
+            {
+                capacity = (capacity > 0 ? capacity * 2 : 1024);
+                frames = CheckAlloc(realloc(frames, capacity * sizeof(ReplayFrame)));
+            }
+
+            frame = &frames[count++];
+            memset(frame, 0, sizeof(*frame));
+            if (lastEnd != 0 && rec->timestamp > lastEnd)
+            {
+                frame->app_time = rec->timestamp - lastEnd;
+            }
+            frame->serial = rec->serial + 1;
+            frame->width = pendingWidth;
+            frame->height = pendingHeight;
+            pendingWidth = pendingHeight = 0;
+        }
+        else if (rec->type == X11_TRACE_SWAP_END)
+        {
+            lastEnd = rec->timestamp;
+        }
+        else if (rec->type == X11_TRACE_PRESENT)
+        {
+            numPresents++;
+            if (rec->value & XCB_PRESENT_OPTION_ASYNC)
+            {
+                numAsync++;
+            }
+        }
+    }
+
+    // The render records are out of order, so match them up afterward. Note
+    // that they can also come after the last frame that we replay.
+    for (i=0; i<trace->count; i++)
+    {
+        const X11TraceRecord *rec = &trace->records[i];
+        if (rec->window == opts->window && rec->type == X11_TRACE_RENDER_DONE)
+        {
+            ReplayFrame *frame = FindFrameForSerial(frames, count, rec->serial);
+            if (frame != NULL)
+            {
+                frame->gpu_time = rec->duration;
+            }
+        }
+    }
+
+    if (opts->width == 0 || opts->height == 0)
+    {
+        opts->width = DEFAULT_WIDTH;
+        opts->height = DEFAULT_HEIGHT;
+    }
+
+    *ret_count = count;
+    *ret_swap_interval = (numAsync * 2 > numPresents ? 0 : 1);
+    return frames;
+}
+
+static void ComputeStats(const Trace *trace, uint32_t window, TraceStats *stats)
+{
+    // The PRESENT records for requests that haven't completed yet, in order.
+    const X11TraceRecord **presents = NULL;
+    size_t numPresents = 0;
+    size_t firstPending = 0;
+    uint64_t firstBegin = 0;
+    uint64_t lastEnd = 0;
+    uint64_t swapBegin = 0;
+    uint64_t bufferWaitBegin = 0;
+    uint64_t frameWaitBegin = 0;
+    uint64_t lastComplete = 0;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    presents = CheckAlloc(malloc((trace->count + 1) * sizeof(X11TraceRecord *)));
+
+    for (i=0; i<trace->count; i++)
+    {
+        const X11TraceRecord *rec = &trace->records[i];
+        size_t j;
+
+        if (rec->window != window)
+        {
+            continue;
+        }
+
+        switch (rec->type)
+        {
+            case X11_TRACE_SWAP_BEGIN:
+                swapBegin = rec->timestamp;
+                if (firstBegin == 0)
+                {
+                    firstBegin = rec->timestamp;
+                }
+                break;
+            case X11_TRACE_SWAP_END:
+                if (swapBegin != 0)
+                {
+                    stats->frames++;
+                    AddSample(&stats->swap_time, rec->timestamp - swapBegin);
+                    lastEnd = rec->timestamp;
+                    swapBegin = 0;
+                }
+                break;
+            case X11_TRACE_PRESENT:
+                presents[numPresents++] = rec;
+                break;
+            case X11_TRACE_COMPLETE_NOTIFY:
+                if (rec->value < sizeof(stats->modes) / sizeof(stats->modes[0]))
+                {
+                    stats->modes[rec->value]++;
+                }
+                if (lastComplete != 0)
+                {
+                    AddSample(&stats->frame_interval, rec->timestamp - lastComplete);
+                }
+                lastComplete = rec->timestamp;
+
+                // Completions come in order, so the matching request is
+                // usually the oldest one that's still pending.
+                for (j=firstPending; j<numPresents; j++)
+                {
+                    if (presents[j]->serial == rec->serial)
+                    {
+                        AddSample(&stats->latency, rec->timestamp - presents[j]->timestamp);
+                        if (presents[j]->msc != 0 && rec->msc > presents[j]->msc)
+                        {
+                            stats->late++;
+                        }
+                        firstPending = j + 1;
+                        break;
+                    }
+                }
+                break;
+            case X11_TRACE_BUFFER_WAIT_BEGIN:
+                bufferWaitBegin = rec->timestamp;
+                break;
+            case X11_TRACE_BUFFER_WAIT_END:
+                if (bufferWaitBegin != 0)
+                {
+                    stats->buffer_waits++;
+                    stats->buffer_wait_time += rec->timestamp - bufferWaitBegin;
+                    bufferWaitBegin = 0;
+                }
+                break;
+            case X11_TRACE_FRAME_WAIT_BEGIN:
+                frameWaitBegin = rec->timestamp;
+                break;
+            case X11_TRACE_FRAME_WAIT_END:
+                if (frameWaitBegin != 0)
+                {
+                    stats->frame_waits++;
+                    stats->frame_wait_time += rec->timestamp - frameWaitBegin;
+                    frameWaitBegin = 0;
+                }
+                break;
+            case X11_TRACE_FRAME_LIMIT:
+                stats->frame_limits++;
+                break;
+            case X11_TRACE_HIDDEN_SKIP:
+                stats->hidden_skips++;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (lastEnd > firstBegin)
+    {
+        stats->elapsed = lastEnd - firstBegin;
+    }
+    free(presents);
+}
+
+static void FreeStats(TraceStats *stats)
+{
+    free(stats->swap_time.values);
+    free(stats->frame_interval.values);
+    free(stats->latency.values);
+}
+
+static void PrintCount(const char *name, size_t recorded, size_t replayed)
+{
+    printf("%-28s %12zu %12zu\n", name, recorded, replayed);
+}
+
+static void PrintMs(const char *name, uint64_t recorded, uint64_t replayed)
+{
+    printf("%-28s %12.3f %12.3f\n", name, recorded / 1000000.0, replayed / 1000000.0);
+}
+
+static double FrameRate(const TraceStats *stats)
+{
+    if (stats->elapsed == 0 || stats->frames < 2)
+    {
+        return 0.0;
+    }
+    return (stats->frames - 1) * 1000000000.0 / stats->elapsed;
+}
+
+static void PrintSummary(TraceStats *recorded, TraceStats *replayed)
+{
+    printf("%-28s %12s %12s\n", "", "recorded", "replayed");
+    PrintCount("frames", recorded->frames, replayed->frames);
+    printf("%-28s %12.2f %12.2f\n", "frame rate (Hz)", FrameRate(recorded), FrameRate(replayed));
+    PrintMs("swap time mean (ms)", Mean(&recorded->swap_time), Mean(&replayed->swap_time));
+    PrintMs("swap time p50 (ms)", Percentile(&recorded->swap_time, 50), Percentile(&replayed->swap_time, 50));
+    PrintMs("swap time p95 (ms)", Percentile(&recorded->swap_time, 95), Percentile(&replayed->swap_time, 95));
+    PrintMs("swap time max (ms)", Percentile(&recorded->swap_time, 100), Percentile(&replayed->swap_time, 100));
+    PrintMs("frame interval p50 (ms)", Percentile(&recorded->frame_interval, 50),
+            Percentile(&replayed->frame_interval, 50));
+    PrintMs("frame interval p95 (ms)", Percentile(&recorded->frame_interval, 95),
+            Percentile(&replayed->frame_interval, 95));
+    PrintMs("present latency p50 (ms)", Percentile(&recorded->latency, 50), Percentile(&replayed->latency, 50));
+    PrintMs("present latency p95 (ms)", Percentile(&recorded->latency, 95), Percentile(&replayed->latency, 95));
+    PrintCount("late presents", recorded->late, replayed->late);
+    PrintCount("flips", recorded->modes[XCB_PRESENT_COMPLETE_MODE_FLIP],
+            replayed->modes[XCB_PRESENT_COMPLETE_MODE_FLIP]);
+    PrintCount("copies", recorded->modes[XCB_PRESENT_COMPLETE_MODE_COPY]
+                + recorded->modes[XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY],
+            replayed->modes[XCB_PRESENT_COMPLETE_MODE_COPY]
+                + replayed->modes[XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY]);
+    PrintCount("skips", recorded->modes[XCB_PRESENT_COMPLETE_MODE_SKIP],
+            replayed->modes[XCB_PRESENT_COMPLETE_MODE_SKIP]);
+    PrintCount("buffer waits", recorded->buffer_waits, replayed->buffer_waits);
+    PrintMs("buffer wait time (ms)", recorded->buffer_wait_time, replayed->buffer_wait_time);
+    PrintCount("frame waits", recorded->frame_waits, replayed->frame_waits);
+    PrintMs("frame wait time (ms)", recorded->frame_wait_time, replayed->frame_wait_time);
+    PrintCount("frame limiter waits", recorded->frame_limits, replayed->frame_limits);
+    PrintCount("hidden skips", recorded->hidden_skips, replayed->hidden_skips);
+}
+
+static void SleepFor(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+/**
+ * Runs the frame loop through the platform library. This is called in the
+ * child process.
+ *
+ * \return The exit status for the child process.
+ */
+static int RunReplay(const ReplayOptions *opts, const ReplayFrame *frames,
+        size_t count, EGLint swap_interval)
+{
+    static const EGLAttrib DISPLAY_ATTRIBS[] = { EGL_PLATFORM_XCB_SCREEN_EXT, 0, EGL_NONE };
+    static EGLExtPlatform platform;
+    const EGLExtDriver *driver;
+    PFNEGLINITIALIZEPROC Initialize;
+    PFNEGLTERMINATEPROC Terminate;
+    PFNEGLCREATEPLATFORMWINDOWSURFACEPROC CreatePlatformWindowSurface;
+    PFNEGLDESTROYSURFACEPROC DestroySurface;
+    PFNEGLSWAPBUFFERSPROC SwapBuffers;
+    PFNEGLSWAPINTERVALPROC SwapInterval;
+    xcb_connection_t *conn = NULL;
+    const char *display_name;
+    xcb_window_t xwin;
+    EGLDisplay edpy = EGL_NO_DISPLAY;
+    EGLSurface esurf = EGL_NO_SURFACE;
+    int ret = 1;
+    size_t i;
+
+    if (setenv(PRESENT_TRACE_ENV, opts->output_path, 1) != 0)
+    {
+        fprintf(stderr, "Can't set %s\n", PRESENT_TRACE_ENV);
+        return 1;
+    }
+
+    display_name = fakeServerStart(opts->refresh_period, opts->present_mode);
+    if (display_name == NULL)
+    {
+        fprintf(stderr, "Can't start the fake server\n");
+        return 1;
+    }
+
+    // The platform library opens its own connections with a NULL display
+    // name, so point those at the fake server too.
+    if (setenv("DISPLAY", display_name, 1) != 0)
+    {
+        fprintf(stderr, "Can't set DISPLAY\n");
+        return 1;
+    }
+
+    driver = stubDriverInit(opts->sync_mode);
+    if (!loadEGLExternalPlatform(EGL_EXTERNAL_PLATFORM_VERSION_MAJOR,
+                EGL_EXTERNAL_PLATFORM_VERSION_MINOR, driver, &platform))
+    {
+        fprintf(stderr, "Can't load the platform library\n");
+        return 1;
+    }
+    stubDriverSetPlatform(&platform);
+
+    Initialize = platform.exports.getHookAddress(platform.data, "eglInitialize");
+    Terminate = platform.exports.getHookAddress(platform.data, "eglTerminate");
+    CreatePlatformWindowSurface = platform.exports.getHookAddress(platform.data, "eglCreatePlatformWindowSurface");
+    DestroySurface = platform.exports.getHookAddress(platform.data, "eglDestroySurface");
+    SwapBuffers = platform.exports.getHookAddress(platform.data, "eglSwapBuffers");
+    SwapInterval = platform.exports.getHookAddress(platform.data, "eglSwapInterval");
+    if (Initialize == NULL || Terminate == NULL || CreatePlatformWindowSurface == NULL
+            || DestroySurface == NULL || SwapBuffers == NULL || SwapInterval == NULL)
+    {
+        fprintf(stderr, "Missing hook functions in the platform library\n");
+        goto done;
+    }
+
+    conn = xcb_connect(display_name, NULL);
+    if (xcb_connection_has_error(conn))
+    {
+        fprintf(stderr, "Can't connect to the fake server\n");
+        goto done;
+    }
+    xwin = fakeServerCreateWindow(opts->width, opts->height);
+
+    edpy = platform.exports.getPlatformDisplay(platform.data,
+            EGL_PLATFORM_XCB_EXT, conn, DISPLAY_ATTRIBS);
+    if (edpy == EGL_NO_DISPLAY || !Initialize(edpy, NULL, NULL))
+    {
+        fprintf(stderr, "Can't initialize the EGLDisplay\n");
+        goto done;
+    }
+
+    esurf = CreatePlatformWindowSurface(edpy, stubDriverGetConfig(), &xwin, NULL);
+    if (esurf == EGL_NO_SURFACE)
+    {
+        fprintf(stderr, "Can't create the window surface\n");
+        goto done;
+    }
+    if (!stubDriverMakeCurrent(edpy, esurf))
+    {
+        fprintf(stderr, "Can't make the window surface current\n");
+        goto done;
+    }
+    if (swap_interval != 1)
+    {
+        SwapInterval(edpy, swap_interval);
+    }
+
+    for (i=0; i<count; i++)
+    {
+        if (frames[i].width != 0 && frames[i].height != 0)
+        {
+            fakeServerConfigureWindow(xwin, frames[i].width, frames[i].height);
+        }
+
+        stubDriverBeginFrame();
+        SleepFor(frames[i].app_time);
+        stubDriverEndFrame(frames[i].gpu_time);
+        if (!SwapBuffers(edpy, esurf))
+        {
+            fprintf(stderr, "eglSwapBuffers failed at frame %zu\n", i);
+            goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    if (esurf != EGL_NO_SURFACE)
+    {
+        stubDriverMakeCurrent(edpy, EGL_NO_SURFACE);
+        DestroySurface(edpy, esurf);
+    }
+    if (edpy != EGL_NO_DISPLAY)
+    {
+        Terminate(edpy);
+    }
+    if (conn != NULL)
+    {
+        xcb_disconnect(conn);
+    }
+    platform.exports.unloadEGLExternalPlatform(platform.data);
+    return ret;
+}
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options] TRACE\n"
+            "\n"
+            "Replays a trace from %s against a fake X server, and compares\n"
+            "the recorded and replayed frame timing.\n"
+            "\n"
+            "  -w XID     Replay this window (default: the first window that presented)\n"
+            "  -n COUNT   Replay at most COUNT frames\n"
+            "  -r HZ      Refresh rate of the fake display (default: estimated from the trace)\n"
+            "  -g WxH     Initial window size (default: from the trace)\n"
+            "  -s MODE    Wait for rendering with a fence thread (\"fence\", default) or\n"
+            "             with glFinish (\"finish\")\n"
+            "  -c         Copy every frame, as if composited, instead of page flipping\n"
+            "  -o FILE    Keep the replayed trace in FILE\n",
+            name, PRESENT_TRACE_ENV);
+}
+
+int main(int argc, char **argv)
+{
+    ReplayOptions opts = {};
+    Trace recorded = {};
+    Trace replayed = {};
+    TraceStats recordedStats;
+    TraceStats replayedStats;
+    ReplayFrame *frames = NULL;
+    size_t count = 0;
+    EGLint swapInterval = 1;
+    char tempPath[] = "/tmp/x11-trace-replay-XXXXXX";
+    int removeOutput = 0;
+    int status = 0;
+    pid_t pid;
+    int opt;
+
+    opts.sync_mode = STUB_SYNC_FENCE;
+    opts.present_mode = FAKE_PRESENT_MODE_FLIP;
+
+    while ((opt = getopt(argc, argv, "w:n:r:g:s:co:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                opts.window = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                opts.max_frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                {
+                    double hz = strtod(optarg, NULL);
+                    if (hz <= 0.0)
+                    {
+                        fprintf(stderr, "Invalid refresh rate: %s\n", optarg);
+                        return 2;
+                    }
+                    opts.refresh_period = (uint64_t) (1000000000.0 / hz);
+                }
+                break;
+            case 'g':
+                {
+                    unsigned int width, height;
+                    if (sscanf(optarg, "%ux%u", &width, &height) != 2
+                            || width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF)
+                    {
+                        fprintf(stderr, "Invalid window size: %s\n", optarg);
+                        return 2;
+                    }
+                    opts.width = width;
+                    opts.height = height;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "fence") == 0)
+                {
+                    opts.sync_mode = STUB_SYNC_FENCE;
+                }
+                else if (strcmp(optarg, "finish") == 0)
+                {
+                    opts.sync_mode = STUB_SYNC_FINISH;
+                }
+                else
+                {
+                    fprintf(stderr, "Invalid sync mode: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'c':
+                opts.present_mode = FAKE_PRESENT_MODE_COPY;
+                break;
+            case 'o':
+                opts.output_path = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+    opts.input_path = argv[optind];
+
+    if (!LoadTrace(opts.input_path, &recorded))
+    {
+        return 1;
+    }
+    if (opts.window == 0)
+    {
+        opts.window = FindTraceWindow(&recorded);
+    }
+    frames = ExtractFrames(&recorded, &opts, &count, &swapInterval);
+    if (count == 0)
+    {
+        fprintf(stderr, "No frames to replay for window 0x%x\n", opts.window);
+        return 1;
+    }
+    if (opts.refresh_period == 0)
+    {
+        opts.refresh_period = EstimateRefreshPeriod(&recorded, opts.window);
+    }
+
+    if (opts.output_path == NULL)
+    {
+        int fd = mkstemp(tempPath);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Can't create a temporary file: %s\n", strerror(errno));
+            return 1;
+        }
+        close(fd);
+        opts.output_path = tempPath;
+        removeOutput = 1;
+    }
+
+    printf("Replaying %zu frames of window 0x%x at %ux%u, %.2f Hz, swap interval %d\n\n",
+            count, opts.window, opts.width, opts.height,
+            1000000000.0 / opts.refresh_period, swapInterval);
+    fflush(stdout);
+
+    pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (pid == 0)
+    {
+        exit(RunReplay(&opts, frames, count, swapInterval));
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "Replay failed\n");
+        if (removeOutput)
+        {
+            unlink(opts.output_path);
+        }
+        return 1;
+    }
+
+    if (!LoadTrace(opts.output_path, &replayed))
+    {
+        return 1;
+    }
+    if (removeOutput)
+    {
+        unlink(opts.output_path);
+    }
+
+    ComputeStats(&recorded, opts.window, &recordedStats);
+    ComputeStats(&replayed, FindTraceWindow(&replayed), &replayedStats);
+    PrintSummary(&recordedStats, &replayedStats);
+
+    FreeStats(&recordedStats);
+    FreeStats(&replayedStats);
+    free(recorded.records);
+    free(replayed.records);
+    free(frames);
+    return 0;
+}